@@ -41,6 +41,7 @@
 #include <vm.h>
 #include <mainbus.h>
 #include <syscall.h>
+#include <kstat.h>
 
 
 /* in exception-*.S */
@@ -115,11 +116,12 @@ kill_curthread(vaddr_t epc, unsigned code, vaddr_t vaddr)
 		code, sig, trapcodenames[code], epc, vaddr);
 
 	/*
-	 * Call proc_exit, creating an exit status that reflects the
+	 * Call proc_exitall, creating an exit status that reflects the
 	 * signal number we died on. Since we don't implement core
-	 * dumps, we don't ever use _MKWAIT_CORE().
+	 * dumps, we don't ever use _MKWAIT_CORE(). The whole process
+	 * dies, not just this thread.
 	 */
-	proc_exit(_MKWAIT_SIG(sig));
+	proc_exitall(_MKWAIT_SIG(sig));
 
 	/* Now, the thread can go away too. */
 	thread_exit();
@@ -193,6 +195,7 @@ mips_trap(struct trapframe *tf)
 			doadjust = false;
 		}
 
+		counter_inc(&kstat_interrupts);
 		mainbus_interrupt(tf);
 
 		if (doadjust) {
@@ -203,6 +206,18 @@ mips_trap(struct trapframe *tf)
 		}
 
 		curthread->t_in_interrupt = old_in;
+
+		/*
+		 * If another thread has made the process exit, this
+		 * one must leave too rather than go back to user mode.
+		 * Take the long way out, which turns interrupts back
+		 * on first.
+		 */
+		if (!iskern && curproc->p_exiting) {
+			spl = splhigh();
+			splx(spl);
+			goto done;
+		}
 		goto done2;
 	}
 
@@ -323,6 +338,11 @@ mips_trap(struct trapframe *tf)
 	panic("I can't handle this... I think I'll just die now...\n");
 
  done:
+	/* Don't go back to user mode in a process that's exiting. */
+	if (!iskern) {
+		proc_checkexit();
+	}
+
 	/*
 	 * Turn interrupts off on the processor, without affecting the
 	 * stored interrupt state.
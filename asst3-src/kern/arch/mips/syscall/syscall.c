@@ -37,6 +37,7 @@
 #include <current.h>
 #include <copyinout.h>
 #include <syscall.h>
+#include <kstat.h>
 
 
 /*
@@ -89,6 +90,7 @@ syscall(struct trapframe *tf)
 	KASSERT(curthread->t_iplhigh_count == 0);
 
 	callno = tf->tf_v0;
+	counter_inc(&kstat_syscalls);
 
 	/*
 	 * Initialize retval to 0. Many of the system calls don't
@@ -113,6 +115,11 @@ syscall(struct trapframe *tf)
 				 (userptr_t)tf->tf_a1);
 		break;
 
+	    case SYS_nanosleep:
+		err = sys_nanosleep((const_userptr_t)tf->tf_a0,
+				    (userptr_t)tf->tf_a1);
+		break;
+
 
 	    /* process calls */
 
@@ -120,6 +127,10 @@ syscall(struct trapframe *tf)
 		err = sys_fork(tf, &retval);
 		break;
 
+	    case SYS_vfork:
+		err = sys_vfork(tf, &retval);
+		break;
+
 	    case SYS_execv:
 		err = sys_execv(
 			(userptr_t)tf->tf_a0,
@@ -142,6 +153,33 @@ syscall(struct trapframe *tf)
 		err = sys_getpid(&retval);
 		break;
 
+	    case SYS_getaffinity:
+		err = sys_getaffinity((userptr_t)tf->tf_a0);
+		break;
+
+	    case SYS_setaffinity:
+		err = sys_setaffinity(tf->tf_a0);
+		break;
+
+	    case SYS_futex_wait:
+		err = sys_futex_wait((userptr_t)tf->tf_a0, tf->tf_a1);
+		break;
+
+	    case SYS_futex_wake:
+		err = sys_futex_wake((userptr_t)tf->tf_a0, tf->tf_a1,
+				     &retval);
+		break;
+
+	    case SYS_threadfork:
+		err = sys_threadfork(tf, (userptr_t)tf->tf_a0,
+				     (userptr_t)tf->tf_a1,
+				     (userptr_t)tf->tf_a2);
+		break;
+
+	    case SYS_threadexit:
+		sys_threadexit();
+		panic("Returning from threadexit\n");
+
 
 	    /* file calls */
 
@@ -316,3 +354,23 @@ enter_forked_process(struct trapframe *tf)
 
 	mips_usermode(tf);
 }
+
+/*
+ * Enter user mode for a new thread of the current process.
+ *
+ * TF is a copy of the creating thread's trapframe, which supplies the
+ * registers every thread of the program shares (notably gp). The new
+ * thread calls ENTRY(ARG) with its stack pointer at STACKPTR. It has
+ * nowhere to return to, so it must leave with threadexit.
+ */
+void
+enter_new_thread(struct trapframe *tf, vaddr_t entry, userptr_t arg,
+		 vaddr_t stackptr)
+{
+	tf->tf_epc = entry;
+	tf->tf_a0 = (vaddr_t)arg;
+	tf->tf_sp = stackptr;
+	tf->tf_ra = 0;
+
+	mips_usermode(tf);
+}
@@ -38,6 +38,7 @@
 #include <mips/tlb.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <kstat.h>
 
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
@@ -163,6 +164,8 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	paddr_t paddr;
 	int i;
 	uint32_t ehi, elo;
+
+	counter_inc(&kstat_vmfaults);
 	struct addrspace *as;
 	int spl;
 
@@ -400,6 +403,50 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+/*
+ * The dumbvm stack is one physically contiguous block, so the pages
+ * can't be mapped in as they are; copy them into the top of it.
+ */
+int
+as_define_stack_pages(struct addrspace *as, const vaddr_t *pages,
+		      unsigned npages, vaddr_t *stackptr)
+{
+	vaddr_t top;
+	unsigned i;
+
+	KASSERT(as->as_stackpbase != 0);
+
+	if (npages > DUMBVM_STACKPAGES) {
+		return E2BIG;
+	}
+
+	top = PADDR_TO_KVADDR(as->as_stackpbase) + DUMBVM_STACKPAGES*PAGE_SIZE;
+	for (i=0; i<npages; i++) {
+		memmove((void *)(top - (npages - i) * PAGE_SIZE),
+			(const void *)pages[i], PAGE_SIZE);
+		free_kpages(pages[i]);
+	}
+
+	*stackptr = USERSTACK - npages * PAGE_SIZE;
+	return 0;
+}
+
+/*
+ * dumbvm segments are physically contiguous, so there is nothing to
+ * share; load_elf reads the text in as usual.
+ */
+int
+as_map_text(struct addrspace *as, struct vnode *v, off_t offset,
+	    vaddr_t vaddr, unsigned npages)
+{
+	(void)as;
+	(void)v;
+	(void)offset;
+	(void)vaddr;
+	(void)npages;
+	return ENOSYS;
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
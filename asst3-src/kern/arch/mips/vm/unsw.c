@@ -43,6 +43,7 @@ static paddr_t lastpaddr;   /* one past end of last free physical page */
 typedef struct ft_entry {
         unsigned allocated:1; /* the corresponding frame is allocated */
         unsigned not_last:1; /* the frame is part of a multiframe allocation */
+        unsigned refcount:30; /* mappings of a shared single frame */
 } ft_entry_t;
 
 
@@ -56,10 +57,11 @@ static uint32_t last_frame;
 
 
 /* frame_table protected by spinlock (interrupt disabling on
- * uniprocessor) as this implementation does not block.
+ * uniprocessor) as this implementation does not block. Every page
+ * allocation and free on every cpu takes it, so it is a ticket lock.
  */ 
 
-static struct spinlock frame_table_spinlock = SPINLOCK_INITIALIZER;
+static struct spinlock frame_table_spinlock = SPINLOCK_TICKET_INITIALIZER;
 
 /*
  * Called very early in system boot to figure out how much physical
@@ -212,6 +214,7 @@ static paddr_t alloc_one_frame(unsigned int npages)
                 if (frame_table[i].allocated == FALSE) {
                         frame_table[i].allocated = TRUE;
                         frame_table[i].not_last = FALSE;
+                        frame_table[i].refcount = 1;
 
                         spinlock_release(&frame_table_spinlock);
 
@@ -254,9 +257,11 @@ static paddr_t alloc_multiple_frames(unsigned int npages)
                 for (j = i; j < i + npages - 1; j++) {
                         frame_table[j].allocated = TRUE; /* mark frame allocated */
                         frame_table[j].not_last = TRUE;  /* as a contiguous block */
+                        frame_table[j].refcount = 1;
                 }
                 frame_table[j].allocated = TRUE;
                 frame_table[j].not_last = FALSE;
+                frame_table[j].refcount = 1;
 
                 spinlock_release(&frame_table_spinlock);
                 
@@ -285,6 +290,13 @@ static void free_frames(vaddr_t vaddr)
         if (frame_table[i].allocated == FALSE) { /* check for double free error */
                 panic("Double free error!!");
         }
+
+        /* a shared frame only goes when its last reference does */
+        if (frame_table[i].refcount > 1) {
+                frame_table[i].refcount--;
+                spinlock_release(&frame_table_spinlock);
+                return;
+        }
         
         while (frame_table[i].allocated == TRUE) { /* otherwise mark block free */
                 frame_table[i].allocated = FALSE;
@@ -319,3 +331,40 @@ free_kpages(vaddr_t addr)
         free_frames(addr);
 }
 
+/*
+ * Add a reference to a single page from alloc_kpages, so it can be
+ * mapped in more than one place. Each free_kpages drops one
+ * reference; the page is only freed with the last.
+ */
+void
+share_kpage(vaddr_t addr)
+{
+        uint32_t i;
+
+        i = KVADDR_TO_PADDR(addr) >> PAGE_BITS;
+
+        spinlock_acquire(&frame_table_spinlock);
+        KASSERT(frame_table[i].allocated == TRUE);
+        KASSERT(frame_table[i].not_last == FALSE);
+        frame_table[i].refcount++;
+        spinlock_release(&frame_table_spinlock);
+}
+
+/*
+ * Return the number of references to a page. Only meaningful if the
+ * caller knows nobody else is taking a reference at the same time.
+ */
+unsigned
+kpage_refcount(vaddr_t addr)
+{
+        uint32_t i;
+        unsigned ret;
+
+        i = KVADDR_TO_PADDR(addr) >> PAGE_BITS;
+
+        spinlock_acquire(&frame_table_spinlock);
+        KASSERT(frame_table[i].allocated == TRUE);
+        ret = frame_table[i].refcount;
+        spinlock_release(&frame_table_spinlock);
+        return ret;
+}
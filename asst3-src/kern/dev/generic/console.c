@@ -135,18 +135,23 @@ putch_intr(struct con_softc *cs, int ch)
 
 /*
  * Read a character, using interrupts to wait for I/O completion.
+ * Returns EINTR if the thread is interrupted while waiting (see
+ * thread_interrupt), which only happens to user threads.
  */
 static
 int
-getch_intr(struct con_softc *cs)
+getch_intr(struct con_softc *cs, char *ret)
 {
-	unsigned char ret;
+	int result;
 
-	P(cs->cs_rsem);
-	ret = cs->cs_gotchars[cs->cs_gotchars_tail];
+	result = P_intr(cs->cs_rsem);
+	if (result) {
+		return result;
+	}
+	*ret = cs->cs_gotchars[cs->cs_gotchars_tail];
 	cs->cs_gotchars_tail =
 		(cs->cs_gotchars_tail + 1) % CONSOLE_INPUT_BUFFER_SIZE;
-	return ret;
+	return 0;
 }
 
 /*
@@ -219,10 +224,15 @@ int
 getch(void)
 {
 	struct con_softc *cs = the_console;
+	char ch;
+	int result;
+
 	KASSERT(cs != NULL);
 	KASSERT(!curthread->t_in_interrupt && curthread->t_iplhigh_count == 0);
 
-	return getch_intr(cs);
+	result = getch_intr(cs, &ch);
+	KASSERT(result == 0);
+	return (unsigned char)ch;
 }
 
 ////////////////////////////////////////////////////////////
@@ -244,12 +254,11 @@ static
 int
 con_io(struct device *dev, struct uio *uio)
 {
+	struct con_softc *cs = dev->d_data;
 	int result;
 	char ch;
 	struct lock *lk;
 
-	(void)dev;  // unused
-
 	if (uio->uio_rw==UIO_READ) {
 		lk = con_userlock_read;
 	}
@@ -262,7 +271,11 @@ con_io(struct device *dev, struct uio *uio)
 
 	while (uio->uio_resid > 0) {
 		if (uio->uio_rw==UIO_READ) {
-			ch = getch();
+			result = getch_intr(cs, &ch);
+			if (result) {
+				lock_release(lk);
+				return result;
+			}
 			if (ch=='\r') {
 				ch = '\n';
 			}
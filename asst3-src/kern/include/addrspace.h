@@ -35,11 +35,14 @@
  */
 
 
+#include <spinlock.h>
 #include <vm.h>
 #include "opt-dumbvm.h"
 
 struct vnode;
 
+/* Size of the user stack region, in pages. */
+#define STACKPAGES 16
 
 /*
  * Address space - data structure associated with the virtual memory
@@ -74,6 +77,10 @@ struct addrspace {
 #else
         // linked list of regions
         struct region_node *head;
+        // two level page table, see vm.c
+        paddr_t **pagetable;
+        // protects pagetable against concurrent faults
+        struct spinlock as_lock;
         paddr_t stackbase;
         int nregions;
         //int counter = 0;
@@ -118,6 +125,25 @@ struct addrspace {
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_define_stack_pages - like as_define_stack, but the top NPAGES
+ *                pages of the stack are to be the pages PAGES[0..]
+ *                (lowest first), which are single pages from
+ *                alloc_kpages that the caller has already filled
+ *                in. On success the address space takes the pages
+ *                over, and the initial stack pointer is the bottom
+ *                of them; on failure the caller still owns them.
+ *                NPAGES may be at most STACKPAGES.
+ *                Used by exec to hand over the argv without copying
+ *                it.
+ *
+ *    as_map_text - map NPAGES pages of file V, starting at the
+ *                page-aligned file offset OFFSET, read-only at the
+ *                page-aligned address VADDR, sharing the physical
+ *                pages with every other address space that has the
+ *                same pages of the same file mapped. Returns ENOSYS
+ *                if the VM system can't share pages, in which case
+ *                the caller should read them in itself.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -136,6 +162,11 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_define_stack_pages(struct addrspace *as,
+                                        const vaddr_t *pages, unsigned npages,
+                                        vaddr_t *initstackptr);
+int               as_map_text(struct addrspace *as, struct vnode *v,
+                              off_t offset, vaddr_t vaddr, unsigned npages);
 
 
 /*
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _CALLOUT_H_
+#define _CALLOUT_H_
+
+/*
+ * Callouts: functions to be called from the timer interrupt after a
+ * given number of hardclock ticks.
+ *
+ * Each cpu has a hierarchical timer wheel, advanced by its own
+ * hardclock(). A callout is placed on the wheel of the cpu that
+ * schedules it and runs on that cpu. Scheduling and cancelling are
+ * O(1); each tick costs O(1) plus the callouts that fire, plus an
+ * occasional cascade of one higher-level slot into the levels below.
+ *
+ * Callout functions run in interrupt context: they may not sleep,
+ * and should be short. They may take spinlocks, wake up wait
+ * channels, and reschedule callouts (including their own).
+ */
+
+#include <spinlock.h>
+
+
+/*
+ * The wheel has CALLWHEEL_LEVELS levels of CALLWHEEL_SLOTS slots
+ * each. Level 0 slots are one tick wide; each slot at level N is as
+ * wide as all of level N-1. With 4 levels of 64 slots, callouts can
+ * be up to 2^24 ticks (about 46 hours at HZ=100) in the future;
+ * longer delays are clamped.
+ */
+#define CALLWHEEL_BITS		6
+#define CALLWHEEL_SLOTS		(1U << CALLWHEEL_BITS)
+#define CALLWHEEL_LEVELS	4
+#define CALLOUT_MAXTICKS	((1U << (CALLWHEEL_BITS*CALLWHEEL_LEVELS)) - 1)
+
+struct callwheel;
+
+/*
+ * A callout. Allocate it wherever convenient (it is usually embedded
+ * in some other structure) and initialize it with callout_init.
+ * The contents are private to callout.c.
+ */
+struct callout {
+	struct callout *co_next;	/* Next in slot */
+	struct callout **co_prevp;	/* Pointer to us in slot */
+	struct callwheel *co_wheel;	/* Wheel we're on; NULL if idle */
+	unsigned co_expire;		/* Tick to fire at */
+	void (*co_func)(void *);	/* Function to call */
+	void *co_arg;			/* Argument for co_func */
+};
+
+/*
+ * Per-cpu timer wheel. Lives in struct cpu.
+ */
+struct callwheel {
+	struct spinlock cw_lock;	/* Protects everything here */
+	unsigned cw_now;		/* Ticks so far */
+	struct callout *cw_slots[CALLWHEEL_LEVELS][CALLWHEEL_SLOTS];
+};
+
+/*
+ * Functions:
+ *
+ * callout_init     - Set up a callout that will call FUNC(ARG).
+ * callout_schedule - Arrange for the callout to fire TICKS hardclocks
+ *                    from now (at least 1). If it was already pending
+ *                    it is rescheduled.
+ * callout_stop     - Cancel the callout if it's pending. Returns true
+ *                    if it was pending, false if it had already fired
+ *                    (or was never scheduled). Note that this does not
+ *                    wait for a callout function that's already running
+ *                    on another cpu to finish.
+ * callout_pending  - Check if the callout is scheduled and hasn't fired.
+ *
+ * Operations on any one callout must be serialized by the caller.
+ * A callout must not be pending when the memory holding it is freed.
+ */
+void callout_init(struct callout *co, void (*func)(void *), void *arg);
+void callout_schedule(struct callout *co, unsigned ticks);
+bool callout_stop(struct callout *co);
+bool callout_pending(struct callout *co);
+
+/*
+ * Per-cpu setup (from cpu_create) and the per-tick hook (from
+ * hardclock).
+ */
+void callwheel_init(struct callwheel *cw);
+void callout_hardclock(void);
+
+
+#endif /* _CALLOUT_H_ */
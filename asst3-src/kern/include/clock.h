@@ -79,5 +79,16 @@ void timespec_sub(const struct timespec *t1,
  */
 void clocksleep(int seconds);
 
+/*
+ * timespec_to_ticks() converts a duration to hardclocks, rounding up
+ * (and clamping at the longest delay a callout can have).
+ *
+ * clocksleep_timespec() suspends execution for at least the duration
+ * given, to within the hardclock resolution. It returns EINTR early if
+ * the thread is interrupted (see thread_interrupt), otherwise 0.
+ */
+unsigned timespec_to_ticks(const struct timespec *ts);
+int clocksleep_timespec(const struct timespec *ts);
+
 
 #endif /* _CLOCK_H_ */
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _COUNTER_H_
+#define _COUNTER_H_
+
+/*
+ * Per-cpu counters: for statistics and the like that get bumped on
+ * hot paths, from many cpus at once, but only read once in a while.
+ *
+ * Each counter has a slot in every cpu's struct cpu holding that
+ * cpu's recent changes. Adding to a counter only touches the current
+ * cpu's slot (with interrupts off, so it can't move to another cpu
+ * halfway through); once a slot's value gets to COUNTER_BATCH either
+ * way from zero it is folded into the global total under the
+ * counter's spinlock. So the common case shares no cache lines and
+ * takes no locks.
+ *
+ * counter_read returns the global total, which can be off by up to
+ * COUNTER_BATCH-1 for each cpu. counter_read_exact also adds up the
+ * per-cpu slots; it reflects every counter_add that finished before
+ * it was called, but costs time proportional to the number of cpus.
+ *
+ * There are COUNTER_MAX slots, so there can be at most that many
+ * counters at once. They're meant for a fixed set of statistics, not
+ * for every instance of some object.
+ */
+
+#include <spinlock.h>
+
+#define COUNTER_MAX	32	/* Number of counters at once */
+#define COUNTER_BATCH	256	/* Fold per-cpu changes this big */
+
+struct counter {
+	const char *ctr_name;
+	unsigned ctr_slot;		/* Index in cpu->c_counters[] */
+	struct spinlock ctr_lock;	/* Protects ctr_total */
+	int64_t ctr_total;		/* Everything folded in so far */
+};
+
+/*
+ * Functions:
+ *
+ * counter_init       - Set up a counter (initially 0). NAME is not
+ *                      copied. Panics if there are no slots left.
+ * counter_cleanup    - Give back the counter's slot.
+ * counter_add        - Add AMT (which may be negative).
+ * counter_inc        - Add 1.
+ * counter_dec        - Subtract 1.
+ * counter_read       - Cheap, approximate value (see above).
+ * counter_read_exact - Exact value (see above).
+ * counter_reset      - Set the counter back to 0. Changes racing with
+ *                      this on other cpus may or may not be kept.
+ *
+ * counter_add and friends may be called from interrupt handlers.
+ */
+void counter_init(struct counter *ctr, const char *name);
+void counter_cleanup(struct counter *ctr);
+void counter_add(struct counter *ctr, int32_t amt);
+int64_t counter_read(struct counter *ctr);
+int64_t counter_read_exact(struct counter *ctr);
+void counter_reset(struct counter *ctr);
+
+#define counter_inc(ctr)	counter_add(ctr, 1)
+#define counter_dec(ctr)	counter_add(ctr, -1)
+
+
+#endif /* _COUNTER_H_ */
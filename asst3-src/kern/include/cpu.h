@@ -33,6 +33,10 @@
 
 #include <spinlock.h>
 #include <threadlist.h>
+#include <thread.h>	/* for NPRIORITIES */
+#include <callout.h>
+#include <workqueue.h>
+#include <counter.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
 
@@ -55,21 +59,51 @@ struct cpu {
 	unsigned c_hardware_number;	/* Hardware-defined cpu number */
 
 	/*
-	 * Accessed only by this cpu.
+	 * Accessed only by this cpu. (Except that other cpus peek at
+	 * c_curthread, unlocked, to see if a lock holder is running.)
 	 */
-	struct thread *c_curthread;	/* Current thread on cpu */
+	struct thread *volatile c_curthread; /* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	void *c_stackcache[STACK_CACHE_SIZE]; /* Free thread stacks */
+	unsigned c_stackcache_count;	/* Number in c_stackcache */
+
+	/*
+	 * Written only by this cpu; read by others (see qsbr.c and
+	 * counter.c).
+	 */
+	volatile unsigned c_qsbr_count;	/* Quiescent states passed */
+	volatile int32_t c_counters[COUNTER_MAX]; /* Per-cpu counter slots */
 
 	/*
 	 * Accessed by other cpus.
-	 * Protected by the runqueue lock.
+	 * Protected by the runqueue lock. (Other cpus looking for work
+	 * to steal read c_runqueue_count without it, as a hint.)
+	 * Bit N of c_runqueue_mask is set iff c_runqueue[N] is nonempty.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	struct threadlist c_runqueue[NPRIORITIES]; /* Run queues, by level */
+	uint32_t c_runqueue_mask;	/* Nonempty levels */
+	unsigned c_runqueue_count;	/* Total threads on all levels */
 	struct spinlock c_runqueue_lock;
 
+	/*
+	 * Accessed by other cpus.
+	 * Protected by its own lock.
+	 *
+	 * Callouts scheduled from this cpu, run from its hardclock.
+	 */
+	struct callwheel c_callwheel;
+
+	/*
+	 * Accessed by other cpus.
+	 * Protected by its own lock.
+	 *
+	 * Deferred work queued from this cpu, run by its worker thread.
+	 */
+	struct workq c_workq;
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the IPI lock.
@@ -112,6 +146,13 @@ void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
+/*
+ * The cpus that exist, numbered 0 to cpu_count()-1 by c_number.
+ * The set is fixed once cpus have been probed at boot.
+ */
+unsigned cpu_count(void);
+struct cpu *cpu_get(unsigned num);
+
 /*
  * Produce a string describing the CPU type.
  */
@@ -196,6 +196,15 @@
 #define SYS_sync         118
 #define SYS_reboot       119
 //#define SYS___sysctl   120
+//                              (cpu affinity)
+#define SYS_getaffinity  121
+#define SYS_setaffinity  122
+//                              (user synchronization)
+#define SYS_futex_wait   123
+#define SYS_futex_wake   124
+//                              (user threads)
+#define SYS_threadfork   125
+#define SYS_threadexit   126
 
 /*CALLEND*/
 
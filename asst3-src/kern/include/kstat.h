@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KSTAT_H_
+#define _KSTAT_H_
+
+/*
+ * Kernel statistics. These are per-cpu counters (see counter.h) that
+ * the code they count bumps directly, e.g.
+ *
+ *	counter_inc(&kstat_syscalls);
+ *
+ * The "kstat" menu command prints them.
+ */
+
+#include <counter.h>
+
+extern struct counter kstat_syscalls;	/* System calls */
+extern struct counter kstat_interrupts;	/* Hardware interrupts */
+extern struct counter kstat_switches;	/* Context switches */
+extern struct counter kstat_vmfaults;	/* VM faults */
+extern struct counter kstat_forks;	/* Successful forks */
+extern struct counter kstat_execs;	/* Successful execs */
+extern struct counter kstat_procs;	/* User processes in existence */
+extern struct counter kstat_readbytes;	/* Bytes read by read() */
+extern struct counter kstat_writebytes;	/* Bytes written by write() */
+
+/*
+ * Set up the counters. Must come right after thread_bootstrap, before
+ * anything that might count.
+ */
+void kstat_bootstrap(void);
+
+/* Print them all; EXACT chooses counter_read_exact over counter_read. */
+void kstat_print(bool exact);
+
+/* Zero them all (except ones that count things in existence). */
+void kstat_reset(void);
+
+
+#endif /* _KSTAT_H_ */
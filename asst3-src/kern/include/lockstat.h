@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+
+/*
+ * Lock contention statistics. Enable with "options lockstat" in the
+ * kernel config.
+ *
+ * Sleep locks are always counted. Spinlocks are counted once given a
+ * name with spinlock_setname. Counters are kept per lock, updated
+ * while holding the lock being counted, and reported (summed over
+ * locks of the same name) by the "lockstat" menu command.
+ *
+ * Times are only collected once lockstat_bootstrap has been called,
+ * because they come from the realtime clock, which isn't available
+ * until devices have been probed.
+ */
+
+#include "opt-lockstat.h"
+
+#if OPT_LOCKSTAT
+
+struct lockstat {
+	const char *ls_name;		/* Name reported under */
+	bool ls_sleeplock;		/* Sleep lock or spinlock */
+	struct lockstat *ls_next;	/* Registered locks list */
+	struct lockstat **ls_prevp;	/* NULL if not registered */
+	uint64_t ls_acquires;		/* Times acquired */
+	uint64_t ls_contended;		/* ...of which had to wait */
+	uint64_t ls_waitns;		/* Total time spent waiting */
+	uint64_t ls_maxwaitns;		/* Longest wait */
+	uint64_t ls_holdns;		/* Total time held */
+	uint64_t ls_maxholdns;		/* Longest hold */
+	uint64_t ls_holdstart;		/* When last acquired */
+};
+
+/* Per-acquire scratch state, kept by the acquiring thread. */
+struct lockstat_wait {
+	bool lw_contended;
+	uint64_t lw_start;
+};
+
+void lockstat_bootstrap(void);
+void lockstat_register(struct lockstat *ls, const char *name, bool sleeplock);
+void lockstat_unregister(struct lockstat *ls);
+void lockstat_contended(struct lockstat_wait *lw);
+void lockstat_acquired(struct lockstat *ls, struct lockstat_wait *lw);
+void lockstat_release(struct lockstat *ls);
+
+/* Print the report; optionally zero all the counters afterwards. */
+void lockstat_report(bool reset);
+
+#define LOCKSTAT(sym)			struct lockstat sym
+#define LOCKSTAT_WAIT(sym)		struct lockstat_wait sym = { false, 0 }
+#define LOCKSTAT_INITIALIZER		{ NULL, false, NULL, NULL, \
+					  0, 0, 0, 0, 0, 0, 0 }
+
+#define LOCKSTAT_INIT(ls)		((ls)->ls_prevp = NULL)
+#define LOCKSTAT_REGISTER(ls, n, s)	lockstat_register(ls, n, s)
+#define LOCKSTAT_UNREGISTER(ls)		lockstat_unregister(ls)
+#define LOCKSTAT_CONTENDED(lw)		lockstat_contended(lw)
+#define LOCKSTAT_ACQUIRED(ls, lw)	lockstat_acquired(ls, lw)
+#define LOCKSTAT_RELEASE(ls)		lockstat_release(ls)
+
+#else
+
+#define lockstat_bootstrap()
+
+#define LOCKSTAT(sym)
+#define LOCKSTAT_WAIT(sym)
+
+#define LOCKSTAT_INIT(ls)
+#define LOCKSTAT_REGISTER(ls, n, s)
+#define LOCKSTAT_UNREGISTER(ls)
+#define LOCKSTAT_CONTENDED(lw)
+#define LOCKSTAT_ACQUIRED(ls, lw)
+#define LOCKSTAT_RELEASE(ls)
+
+#endif
+
+#endif /* _LOCKSTAT_H_ */
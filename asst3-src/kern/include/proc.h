@@ -45,8 +45,8 @@ struct vnode;
 /*
  * Process structure.
  *
- * Note that unless you implement multithreaded processes, p_threads
- * will only contain one thread for all processes other than kproc.
+ * p_threads holds every thread of the process; threads other than
+ * the first come from threadfork.
  *
  * Note: you can't protect p_threads with a spinlock because it needs
  * to be able to call kmalloc.
@@ -57,9 +57,13 @@ struct proc {
 	struct threadarray p_threads;	/* Threads in this process */
 	struct spinlock p_lock;		/* Lock for rest of this structure */
 	pid_t p_pid;			/* Process ID */
+	bool p_exiting;			/* Some thread called _exit */
+	int p_exitstatus;		/* Status it gave, if so */
 
 	/* VM */
 	struct addrspace *p_addrspace;	/* virtual address space */
+	struct proc *p_vforkparent;	/* Lender of p_addrspace, if any */
+	bool p_vforking;		/* Waiting for a vfork child */
 
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
@@ -80,7 +84,21 @@ int proc_create_runprogram(const char *name, struct proc **ret);
 /* Create a fresh process for use by fork() */
 int proc_fork(struct proc **ret);
 
-/* Undo proc_fork if nothing's run in the new process yet. */
+/*
+ * Create a process for vfork(). Like proc_fork, except that the new
+ * process borrows the current process's address space instead of
+ * getting a copy. The current process must call proc_vforkwait once
+ * the child is running, and the child gives the address space back
+ * with proc_vforkdone when it execs or exits. Until then the child
+ * must do nothing with it but call execv or _exit, since the parent
+ * will see every change. proc_vfork fails with EBUSY if another thread
+ * of the process is in the middle of a vfork already.
+ */
+int proc_vfork(struct proc **ret);
+void proc_vforkwait(void);
+void proc_vforkdone(struct proc *proc);
+
+/* Undo proc_fork or proc_vfork if nothing's run in the new process yet. */
 void proc_unfork(struct proc *proc);
 
 /* Destroy a process. */
@@ -95,6 +113,28 @@ void proc_destroy(struct proc *proc);
  */
 void proc_exit(int status);
 
+/*
+ * Cause the current thread to leave its process, as with threadexit.
+ * Whichever thread leaves last causes the process to exit, with the
+ * status from proc_exitall if it was called and 0 otherwise. Does
+ * not return.
+ */
+void proc_threadexit(void);
+
+/*
+ * Make the whole process exit with STATUS: the current thread leaves,
+ * and every other thread leaves the next time it heads back to user
+ * mode (see proc_checkexit). A thread asleep in the kernel holds up
+ * the exit until it wakes up. Does not return.
+ */
+void proc_exitall(int status);
+
+/*
+ * Call on the way back to user mode: leave if another thread has
+ * made the process exit.
+ */
+void proc_checkexit(void);
+
 /* Attach a thread to a process. Must not already have a process. */
 int proc_addthread(struct proc *proc, struct thread *t);
 
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _QSBR_H_
+#define _QSBR_H_
+
+/*
+ * Quiescent-state-based reclamation (QSBR), a flavor of RCU.
+ *
+ * This lets read-mostly data be read without locks. Readers bracket
+ * their accesses with qsbr_read_enter/qsbr_read_exit, which only
+ * raise and restore the interrupt level. Writers still serialize
+ * among themselves with a lock. When a writer unlinks an object that
+ * readers might still be looking at, it hands the object to
+ * qsbr_defer instead of freeing it. The free is then delayed until
+ * every cpu has passed through a quiescent state.
+ *
+ * A quiescent state is any point where no read section can be in
+ * progress on that cpu. There are three kinds:
+ *   - a context switch;
+ *   - a hardclock interrupt (read sections run with interrupts off,
+ *     so a timer interrupt can't land in one);
+ *   - being idle.
+ * Once each cpu has passed one after the object was unlinked, no
+ * reader can still hold a pointer to it.
+ *
+ * Rules for readers: don't sleep, don't block, and keep the section
+ * short; interrupts are off. Pointers obtained inside the section
+ * must not be used after it ends.
+ *
+ * Rules for writers: fully initialize an object before publishing
+ * a pointer to it (use qsbr_publish, which orders the stores), and
+ * never free or reuse an unlinked object except via qsbr_defer.
+ *
+ * Deferred functions are run later from a workqueue, in thread
+ * context, so they may sleep.
+ */
+
+#include <spl.h>
+#include <membar.h>
+
+/* Inlining support - for making sure an out-of-line copy gets built */
+#ifndef QSBR_INLINE
+#define QSBR_INLINE INLINE
+#endif
+
+/*
+ * A deferred call. Usually embedded in the object being freed.
+ * The contents are private to qsbr.c.
+ */
+struct qsbr_cb {
+	struct qsbr_cb *qc_next;
+	void (*qc_func)(void *);
+	void *qc_arg;
+};
+
+/*
+ * Functions:
+ *
+ * qsbr_read_enter    - Begin a read section; returns a value to pass
+ *                      to qsbr_read_exit. Sections may nest.
+ * qsbr_read_exit     - End a read section.
+ * qsbr_publish       - Store a pointer to a fully initialized object
+ *                      where readers can find it.
+ * qsbr_defer         - Call FUNC(ARG) once all current readers are done.
+ *                      May not be called from inside a read section
+ *                      that's still using the object.
+ * qsbr_quiescent     - Note a quiescent state on this cpu. Called from
+ *                      thread_switch.
+ * qsbr_hardclock     - Note a quiescent state and advance grace
+ *                      periods. Called from hardclock.
+ * qsbr_bootstrap     - Start up. Until then (when there's only one cpu
+ *                      running) deferred calls are made right away.
+ */
+QSBR_INLINE int qsbr_read_enter(void);
+QSBR_INLINE void qsbr_read_exit(int spl);
+#define qsbr_publish(pp, val) (membar_store_store(), *(pp) = (val))
+
+void qsbr_defer(struct qsbr_cb *qc, void (*func)(void *), void *arg);
+void qsbr_quiescent(void);
+void qsbr_hardclock(void);
+void qsbr_bootstrap(void);
+
+////////////////////////////////////////////////////////////
+
+QSBR_INLINE
+int
+qsbr_read_enter(void)
+{
+	return splhigh();
+}
+
+QSBR_INLINE
+void
+qsbr_read_exit(int spl)
+{
+	splx(spl);
+}
+
+
+#endif /* _QSBR_H_ */
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _RINGBUF_H_
+#define _RINGBUF_H_
+
+/*
+ * Ring buffer: a bounded FIFO of pointers for any number of producers
+ * and consumers.
+ *
+ * The slots form a circular array indexed by free-running head (next
+ * to get) and tail (next to put) counters. Each slot carries a
+ * sequence number that says whose turn it is: a producer may fill
+ * slot I when its sequence number is I, and a consumer may empty it
+ * when it is I+1. Producers claim slots by advancing the tail with a
+ * compare-and-swap, consumers by advancing the head the same way, so
+ * the nonblocking operations take no locks, cost O(1) per item, and
+ * can be called from interrupt handlers. The batch versions claim a
+ * run of slots with a single compare-and-swap.
+ *
+ * The blocking operations are wrappers that sleep when the ring is
+ * full (or empty). The spinlock and counts that go with them are
+ * only touched when somebody actually has to wait.
+ */
+
+#include <spinlock.h>
+
+struct wchan;
+
+struct ringbuf_slot {
+	volatile uint32_t rs_seq;	/* Whose turn it is (see above) */
+	void *volatile rs_data;		/* The item */
+};
+
+struct ringbuf {
+	char *rb_name;
+	struct ringbuf_slot *rb_slots;	/* Array of rb_mask+1 slots */
+	uint32_t rb_mask;		/* Size-1; size is a power of 2 */
+	volatile uint32_t rb_head;	/* Next slot to get from */
+	volatile uint32_t rb_tail;	/* Next slot to put into */
+
+	struct spinlock rb_lock;	/* For sleeping; protects counts */
+	struct wchan *rb_notfull;	/* Producers wait here */
+	struct wchan *rb_notempty;	/* Consumers wait here */
+	volatile unsigned rb_putwaiters;/* Producers sleeping (or about to) */
+	volatile unsigned rb_getwaiters;/* Consumers sleeping (or about to) */
+};
+
+/*
+ * Functions:
+ *
+ * ringbuf_create        - Create a ring that holds SIZE items. SIZE is
+ *                         rounded up to a power of 2.
+ * ringbuf_destroy       - Destroy it. It must be empty and have no
+ *                         waiters.
+ *
+ * ringbuf_tryput        - Add ITEM (which must not be NULL). Returns
+ *                         false if the ring is full.
+ * ringbuf_tryget        - Remove the oldest item. Returns NULL if the
+ *                         ring is empty.
+ * ringbuf_tryput_batch  - Add as many of the N items in ITEMS as fit, in
+ *                         order; returns how many were added.
+ * ringbuf_tryget_batch  - Remove up to N items into ITEMS; returns how
+ *                         many were removed.
+ *
+ * ringbuf_put           - Add ITEM, sleeping while the ring is full.
+ * ringbuf_get           - Remove the oldest item, sleeping while the
+ *                         ring is empty.
+ * ringbuf_put_batch     - Add all N items, sleeping as needed.
+ * ringbuf_get_batch     - Remove up to N items, sleeping until there is
+ *                         at least one; returns how many were removed.
+ *
+ * ringbuf_count         - Number of items in the ring. Only a snapshot.
+ *
+ * The try versions never sleep and may be used in interrupt handlers.
+ * Items from one producer come out in the order it put them in.
+ */
+struct ringbuf *ringbuf_create(const char *name, unsigned size);
+void ringbuf_destroy(struct ringbuf *rb);
+
+bool ringbuf_tryput(struct ringbuf *rb, void *item);
+void *ringbuf_tryget(struct ringbuf *rb);
+unsigned ringbuf_tryput_batch(struct ringbuf *rb, void *const *items,
+			      unsigned n);
+unsigned ringbuf_tryget_batch(struct ringbuf *rb, void **items, unsigned n);
+
+void ringbuf_put(struct ringbuf *rb, void *item);
+void *ringbuf_get(struct ringbuf *rb);
+void ringbuf_put_batch(struct ringbuf *rb, void *const *items, unsigned n);
+unsigned ringbuf_get_batch(struct ringbuf *rb, void **items, unsigned n);
+
+unsigned ringbuf_count(struct ringbuf *rb);
+
+
+#endif /* _RINGBUF_H_ */
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SCHEDTRACE_H_
+#define _SCHEDTRACE_H_
+
+/*
+ * Scheduler event tracing. Enable with "options schedtrace" in the
+ * kernel config.
+ *
+ * Each cpu records context switches, wakeups, migrations, and idle
+ * transitions into its own ring buffer, with a realtime timestamp.
+ * Only the owning cpu writes a ring, with interrupts off, so no lock
+ * is needed; readers detect entries overwritten under them by the
+ * sequence number. When a ring is full the oldest events are lost.
+ *
+ * The "schedtrace" menu command dumps all the rings, merged in time
+ * order, one event per line; the host tool hostbin/host-schedtrace
+ * turns a console log with such a dump into a per-thread timeline.
+ *
+ * Recording starts once schedtrace_bootstrap has been called, late
+ * in boot, after the other cpus are up.
+ */
+
+#include "opt-schedtrace.h"
+
+/* Event types. */
+#define SCHEDTRACE_SWITCH	1	/* thread: next; other: previous */
+#define SCHEDTRACE_WAKEUP	2	/* thread: woken; other: its cpu */
+#define SCHEDTRACE_MIGRATE	3	/* thread: moved; arg: from; other: to */
+#define SCHEDTRACE_IDLE		4	/* cpu went idle */
+#define SCHEDTRACE_UNIDLE	5	/* cpu came out of idle */
+
+#if OPT_SCHEDTRACE
+
+struct thread;
+
+void schedtrace_bootstrap(void);
+void schedtrace_record(unsigned type, struct thread *t, unsigned arg,
+		       uint32_t other);
+
+/* Dump the rings to the console; optionally empty them afterwards. */
+void schedtrace_dump(bool clear);
+
+#define SCHEDTRACE(type, t, arg, other) \
+	schedtrace_record(type, t, arg, other)
+
+#else
+
+#define schedtrace_bootstrap()
+#define SCHEDTRACE(type, t, arg, other)
+
+#endif
+
+#endif /* _SCHEDTRACE_H_ */
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SLEEPQ_H_
+#define _SLEEPQ_H_
+
+/*
+ * Sleep queues: a fixed, global hash table of wait channels keyed by
+ * object address, so synchronization objects don't each need their
+ * own wchan.
+ *
+ * A thread waiting for an object is put on the wait channel of the
+ * hash chain the object's address falls in, tagged with the address;
+ * wakeups only pick threads with the right tag. Nothing is allocated
+ * per object, and the queue an object's waiters are on only exists,
+ * in effect, while there are any.
+ *
+ * Each chain has its own spinlock. The object keeps its own spinlock
+ * (the "interlock") for its state, and the caller holds it across
+ * every call here, so the usual wchan pattern carries over:
+ *
+ *	spinlock_acquire(&obj->lock);
+ *	while (!condition) {
+ *		sleepq_sleep(obj, &obj->lock);
+ *	}
+ *	...
+ *	spinlock_release(&obj->lock);
+ *
+ * sleepq_sleep takes the chain lock before dropping the interlock and
+ * holds it until the thread is asleep; wakers take the chain lock
+ * after changing the object's state. So no wakeup can get lost in
+ * between, even though the two locks are different. The lock order
+ * is interlock, then chain lock, then run queue locks.
+ */
+
+struct spinlock;
+struct thread;
+struct wchan_timeout;
+
+/*
+ * Functions:
+ *
+ * sleepq_sleep         - Sleep waiting for KEY. LK (the interlock) must
+ *                        be held; it's released while sleeping and
+ *                        reacquired before returning.
+ * sleepq_sleep_intr    - Same, but interruptible: returns EINTR if
+ *                        the thread is interrupted (see
+ *                        wchan_sleep_intr), otherwise 0. Not for keys
+ *                        that may be passed to sleepq_transfer.
+ * sleepq_wakeone       - Wake one thread waiting for KEY. LK must be
+ *                        held.
+ * sleepq_wakeall       - Wake every thread waiting for KEY.
+ * sleepq_transfer      - Move one (or all) threads waiting for FROM
+ *                        over to waiting for TO, without waking them.
+ *                        Both interlocks must be held. MOVED, if not
+ *                        NULL, is called with DATA on each thread
+ *                        moved, with the interlocks and the sleep
+ *                        queue locks held. Returns the number moved.
+ * sleepq_isempty       - Return true if nothing is waiting for KEY.
+ *                        For diagnostics only.
+ *
+ * Timeouts work as with wchan_timeout (see wchan.h), except that
+ * sleepq_sleep_timeout must be used to sleep, and all of them are
+ * called with the interlock held instead of the chain lock. A thread
+ * moved to another key by sleepq_transfer is no longer subject to
+ * the timeout, and sleepq_timeout_timedout is then false.
+ */
+void sleepq_sleep(const void *key, struct spinlock *lk);
+int sleepq_sleep_intr(const void *key, struct spinlock *lk);
+void sleepq_wakeone(const void *key, struct spinlock *lk);
+void sleepq_wakeall(const void *key, struct spinlock *lk);
+unsigned sleepq_transfer(const void *from, struct spinlock *fromlk,
+			 const void *to, struct spinlock *tolk, bool all,
+			 void (*moved)(struct thread *, void *), void *data);
+bool sleepq_isempty(const void *key);
+
+void sleepq_timeout_arm(struct wchan_timeout *wt, const void *key,
+			unsigned ticks);
+bool sleepq_timeout_expired(struct wchan_timeout *wt);
+bool sleepq_timeout_timedout(struct wchan_timeout *wt);
+void sleepq_timeout_disarm(struct wchan_timeout *wt);
+void sleepq_sleep_timeout(const void *key, struct spinlock *lk,
+			  struct wchan_timeout *wt);
+
+/*
+ * Set up the table. Must come before anything sleeps.
+ */
+void sleepq_bootstrap(void);
+
+
+#endif /* _SLEEPQ_H_ */
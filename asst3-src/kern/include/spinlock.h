@@ -37,6 +37,7 @@
 
 #include <cdefs.h>
 #include <hangman.h>
+#include <lockstat.h>
 
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
@@ -51,6 +52,20 @@
  *
  * Note that spinlocks are held by CPUs, not by threads.
  *
+ * There are two kinds, chosen when the lock is initialized:
+ *
+ *  - Test-and-set locks (the default): splk_lock is 1 while the lock
+ *    is held. Cheapest when uncontended, but under contention every
+ *    waiting cpu keeps trying to write the same word, and who gets
+ *    the lock next is arbitrary.
+ *
+ *  - Ticket locks: splk_lock is the next ticket to hand out and
+ *    splk_serving the ticket that holds the lock. Each cpu takes a
+ *    ticket with one atomic add and then only reads splk_serving
+ *    until its number comes up, backing off in proportion to how far
+ *    back in line it is. Waiters get the lock in the order they
+ *    asked for it. Use these for locks that are often contended.
+ *
  * This structure is made public so spinlocks do not have to be
  * malloc'd; however, code that uses spinlocks should not look inside
  * the structure directly but always use the spinlock API functions.
@@ -58,38 +73,68 @@
 struct spinlock {
 	volatile spinlock_data_t splk_lock; /* Memory word where we spin. */
 	struct cpu *splk_holder;	    /* CPU holding this lock. */
+	volatile spinlock_data_t splk_serving; /* Ticket now served. */
+	bool splk_ticket;		    /* True for ticket locks. */
 	HANGMAN_LOCKABLE(splk_hangman);     /* Deadlock detector hook. */
+	LOCKSTAT(splk_stat);		    /* Contention statistics. */
 };
 
 /*
- * Initializer for cases where a spinlock needs to be static or global.
+ * Initializers for cases where a spinlock needs to be static or
+ * global: SPINLOCK_INITIALIZER for a test-and-set lock, and
+ * SPINLOCK_TICKET_INITIALIZER for a ticket lock.
  */
-#ifdef OPT_HANGMAN
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL, \
-				  HANGMAN_LOCKABLE_INITIALIZER }
+#if OPT_LOCKSTAT
+#define SPINLOCK_LOCKSTAT_INITIALIZER	, LOCKSTAT_INITIALIZER
 #else
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#define SPINLOCK_LOCKSTAT_INITIALIZER
 #endif
+#if OPT_HANGMAN
+#define SPINLOCK_KIND_INITIALIZER(ticket) \
+				{ SPINLOCK_DATA_INITIALIZER, NULL, \
+				  SPINLOCK_DATA_INITIALIZER, ticket, \
+				  HANGMAN_LOCKABLE_INITIALIZER \
+				  SPINLOCK_LOCKSTAT_INITIALIZER }
+#else
+#define SPINLOCK_KIND_INITIALIZER(ticket) \
+				{ SPINLOCK_DATA_INITIALIZER, NULL, \
+				  SPINLOCK_DATA_INITIALIZER, ticket \
+				  SPINLOCK_LOCKSTAT_INITIALIZER }
+#endif
+#define SPINLOCK_INITIALIZER		SPINLOCK_KIND_INITIALIZER(false)
+#define SPINLOCK_TICKET_INITIALIZER	SPINLOCK_KIND_INITIALIZER(true)
 
 /*
  * Spinlock functions.
  *
- * init		Initialize the contents of a spinlock.
+ * init		Initialize the contents of a spinlock, as a test-and-set
+ *		lock.
+ * init_ticket	Initialize the contents of a spinlock, as a ticket lock.
  * cleanup	Opposite of init. Lock must be unlocked.
  *
  * acquire	Get the lock, spinning as necessary. Also disables interrupts.
+ * tryacquire	Get the lock if it's free, without spinning. Returns true
+ *		(with interrupts disabled, as for acquire) on success.
  * release	Release the lock. May re-enable interrupts.
  *
  * do_i_hold	Check if the current CPU holds the lock.
+ *
+ * setname	Give the lock a name for lockstat, which counts only named
+ *		spinlocks. NAME must last until the lock is cleaned up.
+ *		Does nothing unless lockstat is enabled.
  */
 
 void spinlock_init(struct spinlock *lk);
+void spinlock_init_ticket(struct spinlock *lk);
 void spinlock_cleanup(struct spinlock *lk);
 
 void spinlock_acquire(struct spinlock *lk);
+bool spinlock_tryacquire(struct spinlock *lk);
 void spinlock_release(struct spinlock *lk);
 
 bool spinlock_do_i_hold(struct spinlock *lk);
 
+void spinlock_setname(struct spinlock *lk, const char *name);
+
 
 #endif /* _SPINLOCK_H_ */
@@ -32,10 +32,15 @@
 
 /*
  * Header file for synchronization primitives.
+ *
+ * None of these have wait channels of their own; threads waiting for
+ * them sleep on the shared hashed sleep queues (see sleepq.h), keyed
+ * by the object's address, with the object's spinlock as interlock.
  */
 
 
 #include <spinlock.h>
+#include <thread.h>	/* for NPRIORITIES */
 
 /*
  * Dijkstra-style semaphore.
@@ -45,7 +50,6 @@
  */
 struct semaphore {
         char *sem_name;
-        struct wchan *sem_wchan;
         struct spinlock sem_lock;
         volatile unsigned sem_count;
 };
@@ -62,6 +66,20 @@ void sem_destroy(struct semaphore *);
 void P(struct semaphore *);
 void V(struct semaphore *);
 
+/*
+ * P_timeout is P, but gives up after TICKS hardclocks (see clock.h)
+ * without decrementing the count. Returns 0 on success or ETIMEDOUT.
+ * With TICKS of 0 it does not wait at all.
+ */
+int P_timeout(struct semaphore *, unsigned ticks);
+
+/*
+ * P_intr is P, but gives up without decrementing the count if the
+ * thread is interrupted (see thread_interrupt). Returns 0 on success
+ * or EINTR.
+ */
+int P_intr(struct semaphore *);
+
 
 /*
  * Simple lock for mutual exclusion.
@@ -71,13 +89,18 @@ void V(struct semaphore *);
  *
  * The name field is for easier debugging. A copy of the name is
  * (should be) made internally.
+ *
+ * A thread holding a lock that higher-priority threads are asleep
+ * waiting for is scheduled at their priority until it releases it.
  */
 struct lock {
         char *lk_name;
         HANGMAN_LOCKABLE(lk_hangman);   /* Deadlock detector hook. */
-        struct wchan *lk_wchan;
         struct spinlock lk_lock;
         struct thread *volatile lk_holder;
+        unsigned lk_nwaiters;           /* Threads asleep waiting */
+        unsigned lk_waitcount[NPRIORITIES]; /* ...by scheduling level */
+        LOCKSTAT(lk_stat);              /* Contention statistics. */
 };
 
 struct lock *lock_create(const char *name);
@@ -98,6 +121,13 @@ void lock_acquire(struct lock *);
 void lock_release(struct lock *);
 bool lock_do_i_hold(struct lock *);
 
+/*
+ * lock_acquire_timeout - Like lock_acquire, but gives up after TICKS
+ *                   hardclocks. Returns 0 if the lock was acquired or
+ *                   ETIMEDOUT.
+ */
+int lock_acquire_timeout(struct lock *, unsigned ticks);
+
 
 /*
  * Condition variable.
@@ -115,7 +145,6 @@ bool lock_do_i_hold(struct lock *);
 
 struct cv {
         char *cv_name;
-        struct wchan *cv_wchan;
         struct spinlock cv_wchanlock;
 };
 
@@ -131,7 +160,9 @@ void cv_destroy(struct cv *);
  *
  * For all three operations, the current thread must hold the lock passed
  * in. Note that under normal circumstances the same lock should be used
- * on all operations with any particular CV.
+ * on all operations with any particular CV. (cv_signal and cv_broadcast
+ * hand waiters directly to the lock passed in, so it must be the one
+ * they'll be waiting for.)
  *
  * These operations must be atomic. You get to write them.
  */
@@ -139,5 +170,60 @@ void cv_wait(struct cv *cv, struct lock *lock);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
+/*
+ * cv_wait_timeout - Like cv_wait, but wakes up on its own after TICKS
+ *                   hardclocks if not signalled first. The lock is
+ *                   re-acquired either way. Returns 0 or ETIMEDOUT.
+ *                   As with cv_wait, the caller should recheck its
+ *                   condition regardless of which it gets.
+ */
+int cv_wait_timeout(struct cv *cv, struct lock *lock, unsigned ticks);
+
+
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers may hold the lock at once, or one writer.
+ * Writers are preferred: once a writer is waiting, newly arriving
+ * readers wait behind it. To keep a steady stream of writers from
+ * starving readers, when a writer releases the lock every reader
+ * waiting at that point is let in ahead of the next writer.
+ *
+ * The name field is for easier debugging. A copy of the name is
+ * made internally.
+ */
+
+struct rwlock {
+        char *rwlock_name;
+        struct spinlock rw_lock;	/* Protects everything below */
+        unsigned rw_readers;		/* Readers holding the lock */
+        unsigned rw_readwaiters;	/* Readers waiting */
+        unsigned rw_readpasses;		/* Readers let past waiting writers */
+        unsigned rw_writewaiters;	/* Writers waiting */
+        struct thread *rw_writer;	/* Writer holding the lock */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading. Multiple threads
+ *                           can hold the lock for reading at the same
+ *                           time.
+ *    rwlock_release_read  - Free the lock from reading.
+ *    rwlock_acquire_write - Get the lock for writing. Only one thread
+ *                           can hold the write lock at one time, and
+ *                           not while anyone holds it for reading.
+ *    rwlock_release_write - Free the write lock.
+ *
+ * The lock is not recursive: a thread that holds it (either way)
+ * must not try to acquire it again.
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+
 
 #endif /* _SYNCH_H_ */
@@ -47,6 +47,10 @@ void syscall(struct trapframe *tf);
 /* Helper for fork(). You write this. */
 void enter_forked_process(struct trapframe *tf);
 
+/* Helper for threadfork(). */
+__DEAD void enter_new_thread(struct trapframe *tf, vaddr_t entry,
+			     userptr_t arg, vaddr_t stackptr);
+
 /* Enter user mode. Does not return. */
 __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 		       vaddr_t stackptr, vaddr_t entrypoint);
@@ -54,6 +58,9 @@ __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 /* Setup function for exec. */
 void exec_bootstrap(void);
 
+/* Setup function for the futex wait table. */
+void futex_bootstrap(void);
+
 
 /*
  * Prototypes for IN-KERNEL entry points for system call implementations.
@@ -64,12 +71,21 @@ void exec_bootstrap(void);
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(const_userptr_t req, userptr_t rem);
 
 int sys_fork(struct trapframe *tf, pid_t *retval);
+int sys_vfork(struct trapframe *tf, pid_t *retval);
 int sys_execv(userptr_t prog, userptr_t args);
 __DEAD void sys__exit(int code);
 int sys_waitpid(pid_t pid, userptr_t returncode, int flags, pid_t *retval);
 int sys_getpid(pid_t *retval);
+int sys_getaffinity(userptr_t mask);
+int sys_setaffinity(unsigned mask);
+int sys_futex_wait(userptr_t uaddr, int32_t val);
+int sys_futex_wake(userptr_t uaddr, int n, int *retval);
+int sys_threadfork(struct trapframe *tf, userptr_t func, userptr_t arg,
+		   userptr_t stack);
+__DEAD void sys_threadexit(void);
 
 int sys_open(const_userptr_t filename, int flags, mode_t mode, int *retval);
 int sys_dup2(int oldfd, int newfd, int *retval);
@@ -57,6 +57,16 @@ int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
 int cvtest2(int, char **);
+int timedtest(int, char **);
+int rwtest(int, char **);
+int callouttest(int, char **);
+int workqtest(int, char **);
+int ringtest(int, char **);
+int countertest(int, char **);
+
+/* synchronization benchmarks */
+int spinbench(int, char **);
+int synchbench(int, char **);
 
 /* semaphore unit tests */
 int semu1(int, char **);
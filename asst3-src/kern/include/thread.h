@@ -41,14 +41,29 @@
 #include <threadlist.h>
 
 struct cpu;
+struct lock;
 
 /* get machine-dependent defs */
 #include <machine/thread.h>
 
 
+/* Affinity mask allowing every cpu */
+#define THREAD_AFFINITY_ALL  0xffffffff
+
+/*
+ * Number of scheduler priority levels. Each cpu has one run queue
+ * per level; level 0 is the highest priority. See schedule() in
+ * thread.c for the policy.
+ */
+#define NPRIORITIES 4
+
 /* Size of kernel stacks; must be power of 2 */
 #define STACK_SIZE 4096
 
+/* Free kernel stacks kept per cpu for reuse, and how many to start with */
+#define STACK_CACHE_SIZE 16
+#define STACK_CACHE_PREFILL 2
+
 /* Mask for extracting the stack base address of a kernel stack pointer */
 #define STACK_MASK  (~(vaddr_t)(STACK_SIZE-1))
 
@@ -72,6 +87,7 @@ struct thread {
 	 */
 	char *t_name;			/* Name of this thread */
 	const char *t_wchan_name;	/* Name of wait channel, if sleeping */
+	const void *t_sleepkey;		/* Object slept on, for sleepq.c */
 	threadstate_t t_state;		/* State this thread is in */
 
 	/*
@@ -85,6 +101,34 @@ struct thread {
 	struct proc *t_proc;		/* Process thread belongs to */
 	HANGMAN_ACTOR(t_hangman);	/* Deadlock detector hook */
 
+	/*
+	 * Scheduler fields. Protected by the run queue lock of t_cpu
+	 * while the thread is on a run queue; otherwise owned by the
+	 * thread itself.
+	 */
+	unsigned t_priority;		/* Current level; 0 is highest */
+	unsigned t_ticks;		/* Hardclocks used at this level */
+	uint32_t t_affinity;		/* Allowed cpus, by c_number */
+	unsigned t_lastrun;		/* t_cpu->c_hardclocks when last ran */
+	unsigned t_inherited;		/* Level lent by lock waiters */
+
+	/*
+	 * Priority inheritance fields. Protected by the priority
+	 * inheritance lock in synch.c.
+	 */
+	unsigned t_inheritcount[NPRIORITIES]; /* Waiters on our locks */
+	struct lock *t_blockedon;	/* Lock we're waiting for */
+	unsigned t_blockedlevel;	/* Level we're counted at there */
+
+	/*
+	 * Interruptible sleep fields (see wchan_sleep_intr). The wchan
+	 * and spinlock are set only while in an interruptible sleep, and
+	 * are protected by that spinlock; t_interrupted is sticky.
+	 */
+	struct wchan *t_intrwchan;	/* Wchan slept on */
+	struct spinlock *t_intrlock;	/* ...and its spinlock */
+	volatile bool t_interrupted;	/* thread_interrupt was called */
+
 	/*
 	 * Interrupt state fields.
 	 *
@@ -158,16 +202,57 @@ __DEAD void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * Charge the current thread for one hardclock, and preempt it if its
+ * quantum is used up or a higher-priority thread is ready to run.
+ * Called from the timer interrupt.
+ */
+void thread_timeslice(void);
+
+/*
+ * Get or set the mask of CPUs (bit N for cpu number N) the current
+ * thread is allowed to run on. Threads created with thread_fork
+ * inherit the mask. thread_setaffinity returns EINVAL if the mask
+ * includes no CPU that exists.
+ */
+int thread_setaffinity(uint32_t mask);
+uint32_t thread_getaffinity(void);
+
+/*
+ * Priority inheritance support for locks (see synch.c).
+ *
+ * thread_priority returns the level a thread is scheduled at: the
+ * better of its own MLFQ level and the level it has inherited.
+ * thread_setinherited changes the inherited level (NPRIORITIES for
+ * none), moving the thread between run queues if necessary.
+ */
+unsigned thread_priority(struct thread *t);
+void thread_setinherited(struct thread *t, unsigned level);
+
+/*
+ * Interrupt a thread: make its current interruptible sleep, if any,
+ * and every later one fail with EINTR (see wchan_sleep_intr). Used to
+ * get the other threads of an exiting process out of the kernel. The
+ * caller must make sure the thread doesn't exit meanwhile.
+ */
+void thread_interrupt(struct thread *t);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
 void schedule(void);
 
 /*
- * Potentially migrate ready threads to other CPUs. Called from the
- * timer interrupt.
+ * Potentially pull ready threads over from busier CPUs. Called from
+ * the timer interrupt.
  */
 void thread_consider_migration(void);
 
+/*
+ * Free the current cpu's cached thread stacks. Called by kmalloc when
+ * it runs out of memory; returns true if anything was freed.
+ */
+bool thread_stack_drain(void);
+
 
 #endif /* _THREAD_H_ */
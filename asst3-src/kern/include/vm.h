@@ -37,12 +37,22 @@
  * You'll probably want to add stuff here.
  */
 
-// page table
-paddr_t **pagetable;
+struct addrspace;
+struct vnode;
 
-paddr_t lookup_pt(vaddr_t faultaddress);
+// page table entries are a physical page address plus these flags
+#define PTE_WRITABLE 0x1 // may be written; loaded into the tlb as dirty
+#define PTE_SHARED   0x2 // shared text page, from the text cache
+
+paddr_t lookup_pt(struct addrspace *as, vaddr_t faultaddress);
+int insert_pt(struct addrspace *as, vaddr_t vaddr, paddr_t pte);
 //paddr_t add_page(struct region *region);
 
+// shared text pages (vm/textcache.c)
+void textcache_bootstrap(void);
+int textcache_get(struct vnode *v, off_t offset, paddr_t *ret);
+void textcache_put(paddr_t paddr);
+
 
 #include <machine/vm.h>
 
@@ -62,6 +72,10 @@ int vm_fault(int faulttype, vaddr_t faultaddress);
 vaddr_t alloc_kpages(unsigned npages);
 void free_kpages(vaddr_t addr);
 
+/* Reference counts on single kernel pages (UNSW frame allocator only) */
+void share_kpage(vaddr_t addr);
+unsigned kpage_refcount(vaddr_t addr);
+
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *);
 
@@ -34,8 +34,10 @@
  * Wait channel.
  */
 
+#include <callout.h>
 
 struct spinlock; /* in spinlock.h */
+struct thread; /* in thread.h */
 struct wchan; /* Opaque */
 
 /*
@@ -66,6 +68,13 @@ bool wchan_isempty(struct wchan *wc, struct spinlock *lk);
  */
 void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Same, but return EINTR if the thread is interrupted with
+ * thread_interrupt, before or during the sleep; otherwise 0. Only
+ * for wait channels that are never destroyed (see thread.c).
+ */
+int wchan_sleep_intr(struct wchan *wc, struct spinlock *lk);
+
 /*
  * Wake up one thread, or all threads, sleeping on a wait channel.
  * The associated spinlock should be locked.
@@ -76,5 +85,86 @@ void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeone(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeall(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Move one thread, or all threads, sleeping on FROM over to TO
+ * without waking them; they'll be woken by whoever wakes TO instead.
+ * Both associated spinlocks must be locked. Returns the number of
+ * threads moved.
+ */
+unsigned wchan_transfer(struct wchan *from, struct spinlock *fromlk,
+			struct wchan *to, struct spinlock *tolk, bool all);
+
+/*
+ * Keyed versions, for channels shared by many objects (see sleepq.h).
+ * The sleeping thread is tagged with KEY (which must not be NULL),
+ * and wakeups and transfers only apply to threads with the matching
+ * key. wchan_haskey returns true if any thread is sleeping with KEY;
+ * like wchan_isempty it's meant for diagnostics.
+ *
+ * wchan_transferkey calls MOVED (if not NULL) with DATA on each
+ * thread it moves, with both spinlocks held.
+ */
+void wchan_sleepkey(struct wchan *wc, struct spinlock *lk, const void *key);
+int wchan_sleepkey_intr(struct wchan *wc, struct spinlock *lk,
+			const void *key);
+unsigned wchan_wakekey(struct wchan *wc, struct spinlock *lk,
+		       const void *key, bool all);
+unsigned wchan_transferkey(struct wchan *from, struct spinlock *fromlk,
+			   const void *fromkey, struct wchan *to,
+			   struct spinlock *tolk, const void *tokey, bool all,
+			   void (*moved)(struct thread *, void *), void *data);
+bool wchan_haskey(struct wchan *wc, struct spinlock *lk, const void *key);
+
+/*
+ * Timeouts for sleeping on a wait channel.
+ *
+ * A timeout is armed once for a whole wait, which may involve going
+ * to sleep on the channel several times. When it expires the thread
+ * is woken up (if it's asleep on the channel at the time) and the
+ * timeout is marked as expired. The caller loops as usual, checking
+ * wchan_timeout_expired before each wchan_sleep, and must disarm the
+ * timeout before it goes away.
+ *
+ * wchan_timeout_armkey is the same for a keyed sleep (wchan_sleepkey);
+ * the timeout only takes the thread off the channel if it's still
+ * waiting for KEY, so a wait that has been moved to another key (see
+ * wchan_transferkey) is left alone. wchan_sleepkey_timeout sleeps only
+ * if the timeout hasn't expired yet.
+ *
+ * wchan_timeout_timedout tells whether it was the timeout that ended
+ * the wait, rather than a wakeup: the timeout may also expire after
+ * someone else has woken the thread, or moved it elsewhere, in which
+ * case it's too late for it to count.
+ *
+ * All of these calls must be made with the associated spinlock held,
+ * by the thread that sleeps. wchan_timeout_disarm may briefly drop the
+ * spinlock (if the timeout is expiring on another cpu at the time)
+ * but returns with it held.
+ *
+ * The structure is private to thread.c; it's public so it can be
+ * allocated on the stack.
+ */
+struct wchan_timeout {
+	struct callout wt_callout;
+	struct thread *wt_thread;
+	struct wchan *wt_wchan;
+	struct spinlock *wt_lock;
+	const void *wt_key;		/* Key slept on, or NULL */
+	bool wt_expired;		/* Protected by wt_lock */
+	bool wt_timedout;		/* Protected by wt_lock */
+	volatile bool wt_done;		/* Callout has finished */
+};
+
+void wchan_timeout_arm(struct wchan_timeout *wt, struct wchan *wc,
+		       struct spinlock *lk, unsigned ticks);
+void wchan_timeout_armkey(struct wchan_timeout *wt, struct wchan *wc,
+			  struct spinlock *lk, const void *key,
+			  unsigned ticks);
+bool wchan_timeout_expired(struct wchan_timeout *wt);
+bool wchan_timeout_timedout(struct wchan_timeout *wt);
+void wchan_sleepkey_timeout(struct wchan *wc, struct spinlock *lk,
+			    const void *key, struct wchan_timeout *wt);
+void wchan_timeout_disarm(struct wchan_timeout *wt);
+
 
 #endif /* _WCHAN_H_ */
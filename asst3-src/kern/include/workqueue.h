@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+
+/*
+ * Workqueue: deferred work, run in thread context.
+ *
+ * Each cpu has a queue of work items and a worker thread (a kernel
+ * thread pinned to that cpu) that runs them in order. Unlike callout
+ * functions, work functions may sleep: they can take sleep locks, do
+ * I/O, allocate memory, and so on. This lets interrupt handlers and
+ * system calls hand off things that don't need to be done right away
+ * or that can't be done where they are.
+ *
+ * Work can be queued to run as soon as possible (work_queue), or
+ * after a delay in hardclock ticks (work_queue_delayed), in which case
+ * a callout moves it onto the queue when the time comes. Either way it
+ * runs on the cpu it was queued from.
+ */
+
+#include <spinlock.h>
+#include <callout.h>
+
+struct wchan;
+struct workq;
+
+/*
+ * A work item. Allocate it wherever convenient (usually embedded in
+ * the object the work is for) and initialize it with work_init. The
+ * contents are private to workqueue.c.
+ */
+struct work {
+	struct work *wk_next;		/* Next in queue */
+	struct work **wk_prevp;		/* Pointer to us in queue */
+	struct workq *wk_queue;		/* Queue we were last put on */
+	unsigned wk_state;		/* WORK_* below */
+	struct callout wk_callout;	/* For delayed work */
+	void (*wk_func)(void *);	/* Function to call */
+	void *wk_arg;			/* Argument for wk_func */
+};
+
+#define WORK_IDLE	0		/* Not queued */
+#define WORK_DELAYED	1		/* Callout pending */
+#define WORK_QUEUED	2		/* On the queue */
+
+/*
+ * Per-cpu queue. Lives in struct cpu.
+ */
+struct workq {
+	struct spinlock wq_lock;	/* Protects everything here */
+	struct work *wq_head;		/* Pending work, in order */
+	struct work **wq_tailp;
+	struct wchan *wq_wchan;		/* Worker sleeps here */
+	struct wchan *wq_donewchan;	/* work_drain sleeps here */
+	struct work *wq_running;	/* Work the worker is running */
+	struct thread *wq_worker;	/* The worker thread */
+};
+
+/*
+ * Functions:
+ *
+ * work_init          - Set up a work item that will call FUNC(ARG).
+ * work_queue         - Queue the work to run on the current cpu. Returns
+ *                      false (and does nothing) if it was already
+ *                      queued or delayed.
+ * work_queue_delayed - Queue the work to run on the current cpu after
+ *                      TICKS hardclocks (at least 1). Returns false if
+ *                      it was already queued or delayed.
+ * work_cancel        - Take the work off its queue if it hasn't started.
+ *                      Returns true if it was pending. Does not wait
+ *                      for the function if it's already running.
+ * work_drain         - Cancel the work and wait for it to finish if it's
+ *                      running. Afterwards the work is idle and may be
+ *                      freed (unless something queues it again). May
+ *                      not be called from the work function itself.
+ *
+ * A work item is idle again by the time its function is called, so
+ * the function may requeue it, or free the memory it's in.
+ *
+ * work_queue and work_queue_delayed may be called from interrupt
+ * handlers. work_cancel and work_drain may not; work_drain sleeps.
+ * Operations on any one work item must be serialized by the caller.
+ */
+void work_init(struct work *wk, void (*func)(void *), void *arg);
+bool work_queue(struct work *wk);
+bool work_queue_delayed(struct work *wk, unsigned ticks);
+bool work_cancel(struct work *wk);
+void work_drain(struct work *wk);
+
+/*
+ * Per-cpu setup (from cpu_create), and startup of the worker threads
+ * (from boot, once the other cpus are running). Work queued before
+ * then waits for the workers to start.
+ */
+void workq_init(struct workq *wq);
+void workqueue_bootstrap(void);
+
+
+#endif /* _WORKQUEUE_H_ */
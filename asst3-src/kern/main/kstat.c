@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Kernel statistics.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <counter.h>
+#include <kstat.h>
+
+struct counter kstat_syscalls;
+struct counter kstat_interrupts;
+struct counter kstat_switches;
+struct counter kstat_vmfaults;
+struct counter kstat_forks;
+struct counter kstat_execs;
+struct counter kstat_procs;
+struct counter kstat_readbytes;
+struct counter kstat_writebytes;
+
+static const struct {
+	struct counter *ks_counter;
+	const char *ks_name;
+	bool ks_gauge;		/* Counts things in existence */
+} kstats[] = {
+	{ &kstat_syscalls,	"syscalls",	false },
+	{ &kstat_interrupts,	"interrupts",	false },
+	{ &kstat_switches,	"switches",	false },
+	{ &kstat_vmfaults,	"vmfaults",	false },
+	{ &kstat_forks,		"forks",	false },
+	{ &kstat_execs,		"execs",	false },
+	{ &kstat_procs,		"procs",	true },
+	{ &kstat_readbytes,	"readbytes",	false },
+	{ &kstat_writebytes,	"writebytes",	false },
+};
+
+#define NKSTATS (sizeof(kstats) / sizeof(kstats[0]))
+
+void
+kstat_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<NKSTATS; i++) {
+		counter_init(kstats[i].ks_counter, kstats[i].ks_name);
+	}
+}
+
+void
+kstat_print(bool exact)
+{
+	unsigned i;
+	int64_t val;
+
+	for (i=0; i<NKSTATS; i++) {
+		if (exact) {
+			val = counter_read_exact(kstats[i].ks_counter);
+		}
+		else {
+			val = counter_read(kstats[i].ks_counter);
+		}
+		kprintf("%-12s %lld\n", kstats[i].ks_name, (long long)val);
+	}
+	if (!exact) {
+		kprintf("(approximate: each may be off by up to %u per cpu)\n",
+			COUNTER_BATCH - 1);
+	}
+}
+
+void
+kstat_reset(void)
+{
+	unsigned i;
+
+	for (i=0; i<NKSTATS; i++) {
+		if (!kstats[i].ks_gauge) {
+			counter_reset(kstats[i].ks_counter);
+		}
+	}
+}
@@ -42,6 +42,12 @@
 #include <proc.h>
 #include <current.h>
 #include <synch.h>
+#include <lockstat.h>
+#include <workqueue.h>
+#include <schedtrace.h>
+#include <qsbr.h>
+#include <kstat.h>
+#include <sleepq.h>
 #include <vm.h>
 #include <mainbus.h>
 #include <vfs.h>
@@ -111,6 +117,8 @@ boot(void)
 	ram_bootstrap();
 	proc_bootstrap();
 	thread_bootstrap();
+	kstat_bootstrap();
+	sleepq_bootstrap();
 	pid_bootstrap();
 	hardclock_bootstrap();
 	vfs_bootstrap();
@@ -124,13 +132,18 @@ boot(void)
 	/* Now do pseudo-devices. */
 	pseudoconfig();
 	kprintf("\n");
+	lockstat_bootstrap();
 	kheap_nextgeneration();
 
 	/* Late phase of initialization. */
 	vm_bootstrap();
 	kprintf_bootstrap();
 	exec_bootstrap();
+	futex_bootstrap();
 	thread_start_cpus();
+	workqueue_bootstrap();
+	qsbr_bootstrap();
+	schedtrace_bootstrap();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
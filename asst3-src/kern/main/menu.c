@@ -45,8 +45,13 @@
 #include <pid.h>
 #include <syscall.h>
 #include <test.h>
+#include <kstat.h>
+#include <lockstat.h>
+#include <schedtrace.h>
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-lockstat.h"
+#include "opt-schedtrace.h"
 
 /*
  * In-kernel menu and command dispatcher.
@@ -500,6 +505,64 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_kstat(int nargs, char **args)
+{
+	if (nargs == 1) {
+		kstat_print(false);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "exact")) {
+		kstat_print(true);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		kstat_reset();
+	}
+	else {
+		kprintf("Usage: kstat [exact|reset]\n");
+	}
+
+	return 0;
+}
+
+#if OPT_LOCKSTAT
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+	if (nargs == 1) {
+		lockstat_report(false);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		lockstat_report(true);
+	}
+	else {
+		kprintf("Usage: lockstat [reset]\n");
+	}
+
+	return 0;
+}
+#endif
+
+#if OPT_SCHEDTRACE
+static
+int
+cmd_schedtrace(int nargs, char **args)
+{
+	if (nargs == 1) {
+		schedtrace_dump(false);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "clear")) {
+		schedtrace_dump(true);
+	}
+	else {
+		kprintf("Usage: schedtrace [clear]\n");
+	}
+
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -569,6 +632,10 @@ static const char *testmenu[] = {
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
+	"[cot] Callout test                  ",
+	"[wqt] Workqueue test                ",
+	"[rbt] Ring buffer test              ",
+	"[ctr] Per-cpu counter test          ",
 #if OPT_NET
 	"[net] Network test                  ",
 #endif
@@ -576,7 +643,11 @@ static const char *testmenu[] = {
 	"[sy2] Lock test                     ",
 	"[sy3] CV test                       ",
 	"[sy4] CV test #2                    ",
+	"[sy5] Timed wait test               ",
+	"[sy6] Reader-writer lock test       ",
 	"[semu1-22] Semaphore unit tests     ",
+	"[sbs] Spinlock contention benchmark ",
+	"[sb]  Synchronization benchmarks    ",
 	"[wt]  waitpid test                  ",
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress                ",
@@ -606,6 +677,13 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[kstat] Kernel statistics           ",
+#if OPT_LOCKSTAT
+	"[lockstat] Lock contention stats    ",
+#endif
+#if OPT_SCHEDTRACE
+	"[schedtrace] Dump scheduler trace   ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -657,6 +735,13 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "kstat",	cmd_kstat },
+#if OPT_LOCKSTAT
+	{ "lockstat",	cmd_lockstat },
+#endif
+#if OPT_SCHEDTRACE
+	{ "schedtrace",	cmd_schedtrace },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -673,12 +758,20 @@ static struct {
 	{ "tt1",	threadtest },
 	{ "tt2",	threadtest2 },
 	{ "tt3",	threadtest3 },
+	{ "cot",	callouttest },
+	{ "wqt",	workqtest },
+	{ "rbt",	ringtest },
+	{ "ctr",	countertest },
 	{ "sy1",	semtest },
 
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
 	{ "sy4",	cvtest2 },
+	{ "sy5",	timedtest },
+	{ "sy6",	rwtest },
+	{ "sbs",	spinbench },
+	{ "sb",		synchbench },
 
 	/* semaphore unit tests */
 	{ "semu1",	semu1 },
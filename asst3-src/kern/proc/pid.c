@@ -36,12 +36,12 @@
 #include <kern/wait.h>
 #include <limits.h>
 #include <lib.h>
-#include <array.h>
-#include <clock.h>
+#include <spinlock.h>
 #include <thread.h>
 #include <proc.h>
 #include <current.h>
-#include <synch.h>
+#include <sleepq.h>
+#include <qsbr.h>
 #include <pid.h>
 
 /*
@@ -49,58 +49,91 @@
  *
  * If pi_ppid is INVALID_PID, the parent has gone away and will not be
  * waiting. If pi_ppid is INVALID_PID and pi_exited is true, the
- * structure can be freed.
+ * structure can be freed, once no thread is left in pid_wait for it
+ * (pi_waiters).
+ *
+ * Each process's pidinfo also heads the list of its children's
+ * pidinfos, so exiting and waiting never need to look through the
+ * whole table.
+ *
+ * pi_lock covers the exit/wait handshake (pi_ppid, pi_exited,
+ * pi_exitstatus and pi_waiters) and the list of children; pi_ppid is
+ * only changed holding the parent's pi_lock as well. The waiting
+ * parent sleeps on the sleep queue for the pidinfo's address.
+ * pi_sibling and pi_prevp, which link a pidinfo into its parent's
+ * list, belong to the parent's pi_lock. When two are needed, take the
+ * parent's first.
+ *
+ * The structure is stable (won't be freed) as long as the process is
+ * running, so the process itself can use it without further ado. Its
+ * parent may have several threads, any of which can reap or disown
+ * it, so the parent must look again under its own pi_lock; a thread
+ * that waits for it counts itself in pi_waiters to keep it around.
  */
 struct pidinfo {
 	pid_t pi_pid;			// process id of this thread
-	pid_t pi_ppid;			// process id of parent thread
+	volatile pid_t pi_ppid;		// process id of parent thread
 	volatile bool pi_exited;	// true if thread has exited
 	int pi_exitstatus;		// status (only valid if exited)
-	struct cv *pi_cv;		// use to wait for thread exit
+	unsigned pi_waiters;		// threads in pid_wait for us
+	struct spinlock pi_lock;	// for exit/wait and pi_children
+	struct pidinfo *pi_children;	// our children
+	struct pidinfo *pi_sibling;	// next child of our parent
+	struct pidinfo **pi_prevp;	// link pointing to us
+	struct qsbr_cb pi_qsbr;		// for deferred free
 };
 
 
 /*
  * Global pid and exit data.
  *
- * The process table is an el-cheapo hash table. It's indexed by
- * (pid % PROCS_MAX), and only allows one process per slot. If a
- * new pid allocation would cause a hash collision, we just don't
- * use that pid.
+ * The process table is indexed by (pid % PROCS_MAX), with one process
+ * per slot. Free slots wait their turn in a FIFO queue; allocating a
+ * pid takes the slot at the front and gives it the next pid that
+ * falls in that slot, so allocation is constant time and pids count
+ * upward much as they would if handed out in sequence.
+ *
+ * Changes to the table are made holding pidtable_lock, which is only
+ * ever held for a few instructions. The table can also be searched
+ * without the lock, inside a qsbr read section, with pi_lookup; for
+ * that, entries are published with qsbr_publish and freed via
+ * qsbr_defer after they're taken out.
  */
-static struct lock *pidlock;		// lock for global exit data
+static struct spinlock pidtable_lock = SPINLOCK_INITIALIZER;
 static struct pidinfo *pidinfo[PROCS_MAX]; // actual pid info
-static pid_t nextpid;			// next candidate pid
-static int nprocs;			// number of allocated pids
+static pid_t slotnextpid[PROCS_MAX];	// next pid to use in each slot
+static unsigned freeslots[PROCS_MAX];	// queue of free slots
+static unsigned freehead;		// front of the queue
+static unsigned nfree;			// number of free slots
+
+#define PID_SLOT(pid)	((unsigned)(pid) % PROCS_MAX)
 
 
 
 /*
- * Create a pidinfo structure for the specified pid.
+ * Create a pidinfo structure for the specified parent. The pid is
+ * filled in when a slot is found for it.
  */
 static
 struct pidinfo *
-pidinfo_create(pid_t pid, pid_t ppid)
+pidinfo_create(pid_t ppid)
 {
 	struct pidinfo *pi;
 
-	KASSERT(pid != INVALID_PID);
-
 	pi = kmalloc(sizeof(struct pidinfo));
 	if (pi==NULL) {
 		return NULL;
 	}
 
-	pi->pi_cv = cv_create("pidinfo cv");
-	if (pi->pi_cv == NULL) {
-		kfree(pi);
-		return NULL;
-	}
-
-	pi->pi_pid = pid;
+	pi->pi_pid = INVALID_PID;
 	pi->pi_ppid = ppid;
 	pi->pi_exited = false;
 	pi->pi_exitstatus = 0xbeef;  /* Recognizably invalid value */
+	pi->pi_waiters = 0;
+	spinlock_init(&pi->pi_lock);
+	pi->pi_children = NULL;
+	pi->pi_sibling = NULL;
+	pi->pi_prevp = NULL;
 
 	return pi;
 }
@@ -114,10 +147,59 @@ pidinfo_destroy(struct pidinfo *pi)
 {
 	KASSERT(pi->pi_exited == true);
 	KASSERT(pi->pi_ppid == INVALID_PID);
-	cv_destroy(pi->pi_cv);
+	KASSERT(pi->pi_waiters == 0);
+	KASSERT(pi->pi_children == NULL);
+	KASSERT(pi->pi_prevp == NULL);
+	spinlock_cleanup(&pi->pi_lock);
 	kfree(pi);
 }
 
+/*
+ * Deferred-free callback for pidinfo_destroy.
+ */
+static
+void
+pidinfo_reclaim(void *arg)
+{
+	pidinfo_destroy(arg);
+}
+
+/*
+ * Add a child to a parent's list of children.
+ */
+static
+void
+pidinfo_addchild(struct pidinfo *parent, struct pidinfo *kid)
+{
+	KASSERT(spinlock_do_i_hold(&parent->pi_lock));
+	KASSERT(kid->pi_prevp == NULL);
+
+	kid->pi_sibling = parent->pi_children;
+	if (kid->pi_sibling != NULL) {
+		kid->pi_sibling->pi_prevp = &kid->pi_sibling;
+	}
+	kid->pi_prevp = &parent->pi_children;
+	parent->pi_children = kid;
+}
+
+/*
+ * Take a child off its parent's list of children.
+ */
+static
+void
+pidinfo_removechild(struct pidinfo *parent, struct pidinfo *kid)
+{
+	KASSERT(spinlock_do_i_hold(&parent->pi_lock));
+	KASSERT(kid->pi_prevp != NULL);
+
+	*kid->pi_prevp = kid->pi_sibling;
+	if (kid->pi_sibling != NULL) {
+		kid->pi_sibling->pi_prevp = kid->pi_prevp;
+	}
+	kid->pi_sibling = NULL;
+	kid->pi_prevp = NULL;
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -126,41 +208,60 @@ pidinfo_destroy(struct pidinfo *pi)
 void
 pid_bootstrap(void)
 {
-	int i;
+	struct pidinfo *pi;
+	unsigned i;
 
-	pidlock = lock_create("pidlock");
-	if (pidlock == NULL) {
-		panic("Out of memory creating pid lock\n");
-	}
+	spinlock_setname(&pidtable_lock, "pidtable");
 
 	/* not really necessary - should start zeroed */
 	for (i=0; i<PROCS_MAX; i++) {
 		pidinfo[i] = NULL;
 	}
 
-	pidinfo[KERNEL_PID] = pidinfo_create(KERNEL_PID, INVALID_PID);
-	if (pidinfo[KERNEL_PID]==NULL) {
-		panic("Out of memory creating kernel pid data\n");
+	/*
+	 * Each slot starts at the lowest pid that falls in it and is
+	 * valid for a user process. All the slots except the kernel's
+	 * are free; queue them in pid order.
+	 */
+	freehead = 0;
+	nfree = 0;
+	for (i=0; i<PROCS_MAX; i++) {
+		slotnextpid[i] = i;
+		while (slotnextpid[i] < PID_MIN) {
+			slotnextpid[i] += PROCS_MAX;
+		}
+	}
+	for (i=PID_MIN; i<PID_MIN+PROCS_MAX; i++) {
+		if (PID_SLOT(i) != PID_SLOT(KERNEL_PID)) {
+			freeslots[nfree++] = PID_SLOT(i);
+		}
 	}
 
-	nextpid = PID_MIN;
-	nprocs = 1;
+	pi = pidinfo_create(INVALID_PID);
+	if (pi==NULL) {
+		panic("Out of memory creating kernel pid data\n");
+	}
+	pi->pi_pid = KERNEL_PID;
+	pidinfo[PID_SLOT(KERNEL_PID)] = pi;
 }
 
 /*
- * pi_get: look up a pidinfo in the process table.
+ * pi_lookup: look up a pidinfo in the process table without locking.
+ * Must be inside a qsbr read section, and the result may only be used
+ * until it ends, unless it's stable for other reasons (see above).
+ * The pid and parent fields can be trusted; other fields may be
+ * changing.
  */
 static
 struct pidinfo *
-pi_get(pid_t pid)
+pi_lookup(pid_t pid)
 {
 	struct pidinfo *pi;
 
 	KASSERT(pid>=0);
 	KASSERT(pid != INVALID_PID);
-	KASSERT(lock_do_i_hold(pidlock));
 
-	pi = pidinfo[pid % PROCS_MAX];
+	pi = pidinfo[PID_SLOT(pid)];
 	if (pi==NULL) {
 		return NULL;
 	}
@@ -171,109 +272,170 @@ pi_get(pid_t pid)
 }
 
 /*
- * pi_put: insert a new pidinfo in the process table. The right slot
- * must be empty.
+ * pi_self: get the current process's pidinfo.
  */
 static
-void
-pi_put(pid_t pid, struct pidinfo *pi)
+struct pidinfo *
+pi_self(void)
 {
-	KASSERT(lock_do_i_hold(pidlock));
-
-	KASSERT(pid != INVALID_PID);
+	struct pidinfo *pi;
 
-	KASSERT(pidinfo[pid % PROCS_MAX] == NULL);
-	pidinfo[pid % PROCS_MAX] = pi;
-	nprocs++;
+	KASSERT(curproc->p_pid != INVALID_PID);
+	pi = pi_lookup(curproc->p_pid);
+	KASSERT(pi != NULL);
+	return pi;
 }
 
 /*
- * pi_drop: remove a pidinfo structure from the process table and free
- * it. It should reflect a process that has already exited and been
- * waited for.
+ * pi_child: get the pidinfo of one of the current process's children.
  */
 static
-void
-pi_drop(pid_t pid)
+struct pidinfo *
+pi_child(pid_t pid)
 {
 	struct pidinfo *pi;
 
-	KASSERT(lock_do_i_hold(pidlock));
-
-	pi = pidinfo[pid % PROCS_MAX];
+	pi = pi_lookup(pid);
 	KASSERT(pi != NULL);
-	KASSERT(pi->pi_pid == pid);
-
-	pidinfo_destroy(pi);
-	pidinfo[pid % PROCS_MAX] = NULL;
-	nprocs--;
+	KASSERT(pi->pi_ppid == curproc->p_pid);
+	return pi;
 }
 
-////////////////////////////////////////////////////////////
+/*
+ * pi_done: check if a pidinfo is no longer needed by anyone: the
+ * process has exited, its parent has let go of it, and no thread is
+ * still in pid_wait for it. Whoever makes this true drops it.
+ */
+static
+bool
+pi_done(struct pidinfo *pi)
+{
+	KASSERT(spinlock_do_i_hold(&pi->pi_lock));
+
+	return pi->pi_exited && pi->pi_ppid == INVALID_PID &&
+		pi->pi_waiters == 0;
+}
 
 /*
- * Helper function for pid_alloc.
+ * pi_drop: remove a pidinfo structure from the process table, put its
+ * slot at the back of the free queue, and free it. It should reflect
+ * a process that has already exited and been waited for (or will
+ * never be). The free waits until no pi_lookup can still see it.
  */
 static
 void
-inc_nextpid(void)
+pi_drop(struct pidinfo *pi)
 {
-	KASSERT(lock_do_i_hold(pidlock));
+	unsigned slot;
 
-	nextpid++;
-	if (nextpid > PID_MAX) {
-		nextpid = PID_MIN;
-	}
+	KASSERT(pi->pi_exited == true);
+	KASSERT(pi->pi_ppid == INVALID_PID);
+	KASSERT(pi->pi_waiters == 0);
+	KASSERT(pi->pi_prevp == NULL);
+
+	slot = PID_SLOT(pi->pi_pid);
+
+	spinlock_acquire(&pidtable_lock);
+	KASSERT(pidinfo[slot] == pi);
+	KASSERT(nfree < PROCS_MAX);
+	pidinfo[slot] = NULL;
+	freeslots[(freehead + nfree) % PROCS_MAX] = slot;
+	nfree++;
+	spinlock_release(&pidtable_lock);
+
+	qsbr_defer(&pi->pi_qsbr, pidinfo_reclaim, pi);
 }
 
 /*
- * pid_alloc: allocate a process id.
+ * pi_orphan: detach a child from its parent, who must be the current
+ * process, and free it if it has already exited. The parent's list
+ * of children is updated only if REMOVE is set.
  */
-int
-pid_alloc(pid_t *retval)
+static
+void
+pi_orphan(struct pidinfo *us, struct pidinfo *them, bool remove)
 {
-	struct pidinfo *pi;
-	pid_t pid;
-	int count;
+	bool drop;
 
-	KASSERT(curproc->p_pid != INVALID_PID);
+	KASSERT(spinlock_do_i_hold(&us->pi_lock));
 
-	/* lock the table */
-	lock_acquire(pidlock);
+	if (remove) {
+		pidinfo_removechild(us, them);
+	}
 
-	if (nprocs == PROCS_MAX) {
-		lock_release(pidlock);
-		return EAGAIN;
+	spinlock_acquire(&them->pi_lock);
+	KASSERT(them->pi_ppid == us->pi_pid);
+	them->pi_ppid = INVALID_PID;
+	drop = pi_done(them);
+	if (them->pi_waiters > 0) {
+		/* Other threads of ours waiting for it should give up. */
+		sleepq_wakeall(them, &them->pi_lock);
 	}
+	spinlock_release(&them->pi_lock);
 
 	/*
-	 * The above test guarantees that this loop terminates, unless
-	 * our nprocs count is off. Even so, assert we aren't looping
-	 * forever.
+	 * If it hasn't exited, it'll see that it has no parent when
+	 * it does, and drop itself. If another thread is still in
+	 * pid_wait for it, the last one out drops it. Otherwise it's
+	 * ours to drop.
 	 */
-	count = 0;
-	while (pidinfo[nextpid % PROCS_MAX] != NULL) {
+	if (drop) {
+		pi_drop(them);
+	}
+}
 
-		/* avoid various boundary cases by allowing extra loops */
-		KASSERT(count < PROCS_MAX*2+5);
-		count++;
+////////////////////////////////////////////////////////////
 
-		inc_nextpid();
-	}
+/*
+ * pid_alloc: allocate a process id.
+ */
+int
+pid_alloc(pid_t *retval)
+{
+	struct pidinfo *us, *pi;
+	unsigned slot;
+	pid_t pid;
 
-	pid = nextpid;
+	KASSERT(curproc->p_pid != INVALID_PID);
 
-	pi = pidinfo_create(pid, curproc->p_pid);
+	pi = pidinfo_create(curproc->p_pid);
 	if (pi==NULL) {
-		lock_release(pidlock);
 		return ENOMEM;
 	}
 
-	pi_put(pid, pi);
+	spinlock_acquire(&pidtable_lock);
+	if (nfree == 0) {
+		spinlock_release(&pidtable_lock);
+		pi->pi_exited = true;
+		pi->pi_ppid = INVALID_PID;
+		pidinfo_destroy(pi);
+		return EAGAIN;
+	}
+
+	slot = freeslots[freehead];
+	freehead = (freehead + 1) % PROCS_MAX;
+	nfree--;
+
+	pid = slotnextpid[slot];
+	slotnextpid[slot] += PROCS_MAX;
+	if (slotnextpid[slot] > PID_MAX) {
+		/* wrap around to the slot's first pid */
+		slotnextpid[slot] = slot;
+		while (slotnextpid[slot] < PID_MIN) {
+			slotnextpid[slot] += PROCS_MAX;
+		}
+	}
+	KASSERT(PID_SLOT(pid) == slot);
 
-	inc_nextpid();
+	KASSERT(pidinfo[slot] == NULL);
+	pi->pi_pid = pid;
+	qsbr_publish(&pidinfo[slot], pi);
+	spinlock_release(&pidtable_lock);
 
-	lock_release(pidlock);
+	us = pi_self();
+	spinlock_acquire(&us->pi_lock);
+	pidinfo_addchild(us, pi);
+	spinlock_release(&us->pi_lock);
 
 	*retval = pid;
 	return 0;
@@ -286,25 +448,25 @@ pid_alloc(pid_t *retval)
 void
 pid_unalloc(pid_t theirpid)
 {
-	struct pidinfo *them;
+	struct pidinfo *us, *them;
 
 	KASSERT(theirpid >= PID_MIN && theirpid <= PID_MAX);
 
-	lock_acquire(pidlock);
-
-	them = pi_get(theirpid);
-	KASSERT(them != NULL);
+	us = pi_self();
+	them = pi_child(theirpid);
 	KASSERT(them->pi_exited == false);
-	KASSERT(them->pi_ppid == curproc->p_pid);
+	KASSERT(them->pi_children == NULL);
+
+	spinlock_acquire(&us->pi_lock);
+	pidinfo_removechild(us, them);
+	spinlock_release(&us->pi_lock);
 
 	/* keep pidinfo_destroy from complaining */
 	them->pi_exitstatus = 0xdead;
 	them->pi_exited = true;
 	them->pi_ppid = INVALID_PID;
 
-	pi_drop(theirpid);
-
-	lock_release(pidlock);
+	pi_drop(them);
 }
 
 /*
@@ -314,22 +476,28 @@ pid_unalloc(pid_t theirpid)
 void
 pid_disown(pid_t theirpid)
 {
-	struct pidinfo *them;
+	struct pidinfo *us, *them;
+	int spl;
 
 	KASSERT(theirpid >= PID_MIN && theirpid <= PID_MAX);
 
-	lock_acquire(pidlock);
-
-	them = pi_get(theirpid);
-	KASSERT(them != NULL);
-	KASSERT(them->pi_ppid==curproc->p_pid);
+	us = pi_self();
 
-	them->pi_ppid = INVALID_PID;
-	if (them->pi_exited) {
-		pi_drop(them->pi_pid);
+	/*
+	 * Another thread of ours may have reaped or disowned it
+	 * already; if so there's nothing to do. Holding our pi_lock
+	 * keeps pi_ppid still.
+	 */
+	spl = qsbr_read_enter();
+	them = pi_lookup(theirpid);
+	if (them != NULL) {
+		spinlock_acquire(&us->pi_lock);
+		if (them->pi_ppid == us->pi_pid) {
+			pi_orphan(us, them, true);
+		}
+		spinlock_release(&us->pi_lock);
 	}
-
-	lock_release(pidlock);
+	qsbr_read_exit(spl);
 }
 
 /*
@@ -343,42 +511,37 @@ pid_disown(pid_t theirpid)
 void
 pid_setexitstatus(int status)
 {
-	struct pidinfo *us;
-	int i;
+	struct pidinfo *us, *kid;
+	bool orphan, drop;
 
-	lock_acquire(pidlock);
-	KASSERT(curproc->p_pid != INVALID_PID);
+	us = pi_self();
+
+	spinlock_acquire(&us->pi_lock);
 
 	/* First, disown all children */
-	for (i=0; i<PROCS_MAX; i++) {
-		if (pidinfo[i]==NULL) {
-			continue;
-		}
-		if (pidinfo[i]->pi_ppid == curproc->p_pid) {
-			pidinfo[i]->pi_ppid = INVALID_PID;
-			if (pidinfo[i]->pi_exited) {
-				pi_drop(pidinfo[i]->pi_pid);
-			}
-		}
+	while (us->pi_children != NULL) {
+		kid = us->pi_children;
+		pidinfo_removechild(us, kid);
+		pi_orphan(us, kid, false);
 	}
 
 	/* Now, wake up our parent */
-	us = pi_get(curproc->p_pid);
-	KASSERT(us != NULL);
-
 	us->pi_exitstatus = status;
 	us->pi_exited = true;
-
-	if (us->pi_ppid == INVALID_PID) {
-		/* no parent */
-		pi_drop(curproc->p_pid);
+	orphan = (us->pi_ppid == INVALID_PID);
+	drop = pi_done(us);
+	if (!orphan) {
+		sleepq_wakeall(us, &us->pi_lock);
 	}
-	else {
-		cv_broadcast(us->pi_cv, pidlock);
+
+	spinlock_release(&us->pi_lock);
+
+	if (drop) {
+		/* no parent, and nobody left looking */
+		pi_drop(us);
 	}
 
 	curproc->p_pid = INVALID_PID;
-	lock_release(pidlock);
 }
 
 /*
@@ -387,12 +550,15 @@ pid_setexitstatus(int status)
  * userland and may thus be maliciously invalid.
  *
  * status may be null, in which case the status is thrown away. ret
- * may only be null if WNOHANG is not set.
+ * may only be null if WNOHANG is not set. Returns EINTR if the process
+ * is exiting (see proc_exitall).
  */
 int
 pid_wait(pid_t theirpid, int *status, int flags, pid_t *ret)
 {
-	struct pidinfo *them;
+	struct pidinfo *us, *them;
+	bool ours, exited, drop;
+	int spl, result;
 
 	KASSERT(curproc->p_pid != INVALID_PID);
 
@@ -415,37 +581,86 @@ pid_wait(pid_t theirpid, int *status, int flags, pid_t *ret)
 		return EINVAL;
 	}
 
-	lock_acquire(pidlock);
-
-	them = pi_get(theirpid);
-	if (them==NULL) {
-		lock_release(pidlock);
-		return ESRCH;
+	/*
+	 * Find the process: it must exist and be our child. Other
+	 * threads of ours may be waiting for it too, or disowning it,
+	 * so it can be reaped or disowned whenever we aren't holding
+	 * our pi_lock. Counting ourselves in pi_waiters keeps the
+	 * pidinfo from being freed until we're done with it.
+	 */
+	us = pi_self();
+	result = 0;
+	spl = qsbr_read_enter();
+	them = pi_lookup(theirpid);
+	if (them == NULL) {
+		result = ESRCH;
+	}
+	else {
+		spinlock_acquire(&us->pi_lock);
+		spinlock_acquire(&them->pi_lock);
+		if (them->pi_ppid == us->pi_pid) {
+			them->pi_waiters++;
+		}
+		else {
+			result = EPERM;
+		}
+		spinlock_release(&them->pi_lock);
+		spinlock_release(&us->pi_lock);
+	}
+	qsbr_read_exit(spl);
+	if (result) {
+		return result;
 	}
 
-	KASSERT(them->pi_pid==theirpid);
+	spinlock_acquire(&them->pi_lock);
+	if (flags != WNOHANG) {
+		while (them->pi_exited == false &&
+		       them->pi_ppid == us->pi_pid && result == 0) {
+			result = sleepq_sleep_intr(them, &them->pi_lock);
+		}
+	}
+	spinlock_release(&them->pi_lock);
 
-	/* Only allow waiting for own children. */
-	if (them->pi_ppid != curproc->p_pid) {
-		lock_release(pidlock);
-		return EPERM;
+	/*
+	 * Now see how things stand, holding our pi_lock so nobody
+	 * else can reap or disown it meanwhile.
+	 */
+	spinlock_acquire(&us->pi_lock);
+	spinlock_acquire(&them->pi_lock);
+	KASSERT(them->pi_waiters > 0);
+	them->pi_waiters--;
+	ours = (them->pi_ppid == us->pi_pid);
+	exited = them->pi_exited;
+	if (ours && exited && status != NULL) {
+		*status = them->pi_exitstatus;
 	}
+	drop = pi_done(them);
+	spinlock_release(&them->pi_lock);
+	if (ours && exited) {
+		/* it's exited, so this frees it */
+		pi_orphan(us, them, true);
+	}
+	spinlock_release(&us->pi_lock);
 
-	if (them->pi_exited == false) {
-		if (flags == WNOHANG) {
-			lock_release(pidlock);
-			KASSERT(ret != NULL);
-			*ret = 0;
-			return 0;
+	if (!ours) {
+		/* Another thread of ours got to it first. */
+		if (drop) {
+			pi_drop(them);
 		}
-		/* don't need to loop on this */
-		cv_wait(them->pi_cv, pidlock);
-		KASSERT(them->pi_exited == true);
+		return ESRCH;
 	}
 
-	if (status != NULL) {
-		*status = them->pi_exitstatus;
+	if (!exited) {
+		if (result) {
+			/* interrupted */
+			return result;
+		}
+		KASSERT(flags == WNOHANG);
+		KASSERT(ret != NULL);
+		*ret = 0;
+		return 0;
 	}
+
 	if (ret != NULL) {
 		/*
 		 * In Unix you can wait for any of several possible
@@ -457,9 +672,5 @@ pid_wait(pid_t theirpid, int *status, int flags, pid_t *ret)
 		*ret = theirpid;
 	}
 
-	them->pi_ppid = 0;
-	pi_drop(them->pi_pid);
-
-	lock_release(pidlock);
 	return 0;
 }
@@ -44,6 +44,7 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/wait.h>
 #include <spl.h>
 #include <synch.h>
 #include <proc.h>
@@ -52,6 +53,8 @@
 #include <vnode.h>
 #include <pid.h>
 #include <filetable.h>
+#include <sleepq.h>
+#include <kstat.h>
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
@@ -87,9 +90,13 @@ proc_create(const char *name)
 
 	spinlock_init(&proc->p_lock);
 	proc->p_pid = INVALID_PID;
+	proc->p_exiting = false;
+	proc->p_exitstatus = 0;
 
 	/* VM fields */
 	proc->p_addrspace = NULL;
+	proc->p_vforkparent = NULL;
+	proc->p_vforking = false;
 
 	/* VFS fields */
 	proc->p_cwd = NULL;
@@ -118,6 +125,8 @@ proc_destroy(struct proc *proc)
 	KASSERT(proc != NULL);
 	KASSERT(proc != kproc);
 
+	counter_dec(&kstat_procs);
+
 	/*
 	 * We don't take p_lock in here because we must have the only
 	 * reference to this structure. (Otherwise it would be
@@ -135,6 +144,22 @@ proc_destroy(struct proc *proc)
 	}
 
 	/* VM fields */
+	if (proc->p_vforkparent != NULL) {
+		/*
+		 * A vfork child that never got as far as exec is
+		 * still borrowing its parent's address space. Give
+		 * it back instead of destroying it. (Same rules as
+		 * below for clearing p_addrspace.)
+		 */
+		if (proc == curproc) {
+			proc_setas(NULL);
+			as_deactivate();
+		}
+		else {
+			proc->p_addrspace = NULL;
+		}
+		proc_vforkdone(proc);
+	}
 	if (proc->p_addrspace) {
 		/*
 		 * If p is the current process, remove it safely from
@@ -183,6 +208,7 @@ proc_destroy(struct proc *proc)
 	}
 
 	KASSERT(proc->p_pid == INVALID_PID);
+	KASSERT(proc->p_vforking == false);
 	spinlock_cleanup(&proc->p_lock);
 	threadarray_cleanup(&proc->p_threads);
 	lock_destroy(proc->p_threadslock);
@@ -223,6 +249,7 @@ proc_create_runprogram(const char *name, struct proc **ret)
 	if (newproc == NULL) {
 		return ENOMEM;
 	}
+	counter_inc(&kstat_procs);
 	/* Get a process ID */
 	result = pid_alloc(&newproc->p_pid);
 	if (result) {
@@ -261,9 +288,13 @@ proc_create_runprogram(const char *name, struct proc **ret)
  * However, the new thread always inherits its current working
  * directory from the caller. The new thread is given no address space
  * (the caller decides that).
+ *
+ * For vfork, the new process borrows the caller's address space
+ * instead of getting a copy of it.
  */
+static
 int
-proc_fork(struct proc **ret)
+proc_dofork(bool vfork, struct proc **ret)
 {
 	struct proc *newproc;
 	struct addrspace *as;
@@ -274,6 +305,7 @@ proc_fork(struct proc **ret)
 	if (newproc == NULL) {
 		return ENOMEM;
 	}
+	counter_inc(&kstat_procs);
 	/* Get a process ID */
 	result = pid_alloc(&newproc->p_pid);
 	if (result) {
@@ -293,7 +325,26 @@ proc_fork(struct proc **ret)
 
 	/* VM fields */
 	as = proc_getas();
-	if (as != NULL) {
+	if (vfork) {
+		/*
+		 * The address space can only be lent to one child at a
+		 * time; another thread of ours may be vforking already.
+		 * proc_destroy gives it back if we fail below.
+		 */
+		spinlock_acquire(&curproc->p_lock);
+		if (curproc->p_vforking) {
+			spinlock_release(&curproc->p_lock);
+			pid_unalloc(newproc->p_pid);
+			newproc->p_pid = INVALID_PID;
+			proc_destroy(newproc);
+			return EBUSY;
+		}
+		curproc->p_vforking = true;
+		spinlock_release(&curproc->p_lock);
+		newproc->p_addrspace = as;
+		newproc->p_vforkparent = curproc;
+	}
+	else if (as != NULL) {
 		result = as_copy(as, &newproc->p_addrspace);
 		if (result) {
 			pid_unalloc(newproc->p_pid);
@@ -308,8 +359,10 @@ proc_fork(struct proc **ret)
 	if (tbl != NULL) {
 		result = filetable_copy(tbl, &newproc->p_filetable);
 		if (result) {
-			as_destroy(newproc->p_addrspace);
-			newproc->p_addrspace = NULL;
+			if (!vfork) {
+				as_destroy(newproc->p_addrspace);
+				newproc->p_addrspace = NULL;
+			}
 			pid_unalloc(newproc->p_pid);
 			newproc->p_pid = INVALID_PID;
 			proc_destroy(newproc);
@@ -333,8 +386,56 @@ proc_fork(struct proc **ret)
 	return 0;
 }
 
+int
+proc_fork(struct proc **ret)
+{
+	return proc_dofork(false, ret);
+}
+
+int
+proc_vfork(struct proc **ret)
+{
+	return proc_dofork(true, ret);
+}
+
+/*
+ * Wait for the vfork child to give back our address space.
+ */
+void
+proc_vforkwait(void)
+{
+	spinlock_acquire(&curproc->p_lock);
+	while (curproc->p_vforking) {
+		sleepq_sleep(&curproc->p_vforking, &curproc->p_lock);
+	}
+	spinlock_release(&curproc->p_lock);
+}
+
 /*
- * Undo proc_fork if nothing's run in the new process yet.
+ * Note that a vfork child is done with its parent's address space
+ * (the caller has already stopped using it) and let the parent go.
+ * Does nothing if PROC didn't come from vfork or is already done.
+ */
+void
+proc_vforkdone(struct proc *proc)
+{
+	struct proc *parent;
+
+	parent = proc->p_vforkparent;
+	if (parent == NULL) {
+		return;
+	}
+	proc->p_vforkparent = NULL;
+
+	spinlock_acquire(&parent->p_lock);
+	KASSERT(parent->p_vforking);
+	parent->p_vforking = false;
+	sleepq_wakeall(&parent->p_vforking, &parent->p_lock);
+	spinlock_release(&parent->p_lock);
+}
+
+/*
+ * Undo proc_fork or proc_vfork if nothing's run in the new process yet.
  */
 void
 proc_unfork(struct proc *newproc)
@@ -372,6 +473,108 @@ proc_exit(int status)
 	thread_exit();
 }
 
+/*
+ * Make the current thread leave its process; the last one out takes
+ * the process with it.
+ */
+void
+proc_threadexit(void)
+{
+	struct proc *proc = curproc;
+	struct thread *t = curthread;
+	unsigned num, i;
+	int status;
+	int spl;
+
+	KASSERT(proc != kproc);
+
+	/*
+	 * Decide whether we're last and leave p_threads in one go,
+	 * or two threads leaving together could each think the
+	 * other was going to clean up.
+	 */
+	lock_acquire(proc->p_threadslock);
+	num = threadarray_num(&proc->p_threads);
+	if (num == 1) {
+		lock_release(proc->p_threadslock);
+
+		spinlock_acquire(&proc->p_lock);
+		status = proc->p_exiting ? proc->p_exitstatus
+			: _MKWAIT_EXIT(0);
+		spinlock_release(&proc->p_lock);
+
+		proc_exit(status);
+		/* not reached */
+	}
+	for (i=0; i<num; i++) {
+		if (threadarray_get(&proc->p_threads, i) == t) {
+			threadarray_remove(&proc->p_threads, i);
+			break;
+		}
+	}
+	KASSERT(i < num);
+	lock_release(proc->p_threadslock);
+
+	spl = splhigh();
+	t->t_proc = NULL;
+	splx(spl);
+
+	/* Go away via the kernel process, as proc_exit does. */
+	proc_addthread(kproc, t);
+	thread_exit();
+}
+
+/*
+ * Make the current process exit, taking all its threads along.
+ *
+ * The other threads leave when they next pass through trap (see
+ * proc_checkexit). Those asleep in the kernel might never get there,
+ * so interrupt them; the sleeps that can last indefinitely then fail
+ * with EINTR and the thread goes back out. (A thread added after we
+ * look is interrupted by proc_addthread.)
+ */
+void
+proc_exitall(int status)
+{
+	struct proc *proc = curproc;
+	struct thread *t;
+	unsigned num, i;
+
+	/* The first thread to exit decides the status. */
+	spinlock_acquire(&proc->p_lock);
+	if (!proc->p_exiting) {
+		proc->p_exiting = true;
+		proc->p_exitstatus = status;
+	}
+	spinlock_release(&proc->p_lock);
+
+	lock_acquire(proc->p_threadslock);
+	num = threadarray_num(&proc->p_threads);
+	for (i=0; i<num; i++) {
+		t = threadarray_get(&proc->p_threads, i);
+		if (t != curthread) {
+			thread_interrupt(t);
+		}
+	}
+	lock_release(proc->p_threadslock);
+
+	proc_threadexit();
+}
+
+/*
+ * Leave now if the process is exiting. Reading p_exiting unlocked is
+ * fine: if we miss it we'll see it on the next trap.
+ */
+void
+proc_checkexit(void)
+{
+	struct proc *proc = curproc;
+
+	if (proc != NULL && proc->p_exiting) {
+		proc_threadexit();
+	}
+}
+
 /*
  * Add a thread to a process. Either the thread or the process might
  * or might not be current.
@@ -391,6 +594,10 @@ proc_addthread(struct proc *proc, struct thread *t)
 
 	lock_acquire(proc->p_threadslock);
 	result = threadarray_add(&proc->p_threads, t, NULL);
+	if (result == 0 && proc->p_exiting) {
+		/* Too late; see proc_exitall. */
+		thread_interrupt(t);
+	}
 	lock_release(proc->p_threadslock);
 	if (result) {
 		return result;
@@ -445,10 +652,10 @@ finish:
 /*
  * Fetch the address space of (the current) process.
  *
- * Caution: address spaces aren't refcounted. If you implement
- * multithreaded processes, make sure to set up a refcount scheme or
- * some other method to make this safe. Otherwise the returned address
- * space might disappear under you.
+ * Address spaces aren't refcounted. This is safe with threadfork
+ * because the address space only goes away with the last thread of
+ * the process, and exec (which replaces it) refuses to run while the
+ * process has more than one thread.
  */
 struct addrspace *
 proc_getas(void)
@@ -48,6 +48,7 @@
 #include <openfile.h>
 #include <filetable.h>
 #include <syscall.h>
+#include <kstat.h>
 
 /*
  * open() - get the path with copyinstr, then use openfile_open and
@@ -166,6 +167,8 @@ sys_readwrite(int fd, userptr_t buf, size_t size, enum uio_rw rw,
 	 * minus how much is left in it.
 	 */
 	*retval = size - useruio.uio_resid;
+	counter_add(rw == UIO_READ ? &kstat_readbytes : &kstat_writebytes,
+		    *retval);
 
 	return 0;
 
@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Futexes: user-level synchronization that only enters the kernel
+ * under contention.
+ *
+ * User code keeps its lock or semaphore state in an ordinary word of
+ * memory and manipulates it with atomic instructions (ll/sc). Only
+ * when it must wait does it call futex_wait, which sleeps as long as
+ * the word still holds the value the caller last saw; and only when
+ * it knows there may be sleepers does it call futex_wake.
+ *
+ * Sleepers are kept in a fixed hash table keyed by (address space,
+ * user address), so no per-futex kernel state exists while nobody is
+ * waiting. Each bucket has a sleep lock that serializes the value
+ * check in futex_wait against futex_wake (the check needs copyin and
+ * so can't be done under a spinlock), and a spinlock and wait channel
+ * that the waiters actually sleep on. Since unrelated futexes can
+ * share a bucket, each waiter has a record of its own key on its
+ * stack and futex_wake marks exactly the records it chooses.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <synch.h>
+#include <current.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+/* Number of hash buckets. Should be a power of 2. */
+#define FUTEX_HASHSIZE 64
+
+/*
+ * One sleeping thread. Lives on the sleeper's stack.
+ */
+struct futex_waiter {
+	struct addrspace *fw_as;	/* Key: address space */
+	vaddr_t fw_addr;		/* Key: user address */
+	bool fw_woken;			/* Set by futex_wake */
+	struct futex_waiter *fw_next;	/* Bucket list */
+	struct futex_waiter **fw_prevp;
+};
+
+struct futex_bucket {
+	struct lock *fb_lock;		/* Orders value check vs. wakeup */
+	struct spinlock fb_spinlock;	/* Protects the list and wchan */
+	struct wchan *fb_wchan;
+	struct futex_waiter *fb_waiters;	/* Oldest first */
+	struct futex_waiter **fb_tailp;		/* Where to add the next */
+};
+
+static struct futex_bucket futex_table[FUTEX_HASHSIZE];
+
+/*
+ * Setup function.
+ */
+void
+futex_bootstrap(void)
+{
+	struct futex_bucket *fb;
+	unsigned i;
+
+	for (i=0; i<FUTEX_HASHSIZE; i++) {
+		fb = &futex_table[i];
+		fb->fb_lock = lock_create("futex");
+		fb->fb_wchan = wchan_create("futex");
+		if (fb->fb_lock == NULL || fb->fb_wchan == NULL) {
+			panic("futex_bootstrap: Out of memory\n");
+		}
+		spinlock_init(&fb->fb_spinlock);
+		fb->fb_waiters = NULL;
+		fb->fb_tailp = &fb->fb_waiters;
+	}
+}
+
+/*
+ * Find the bucket for a key. The address is word-aligned, so drop
+ * the low bits; fold in the address space pointer so that the same
+ * address in different processes spreads out.
+ */
+static
+struct futex_bucket *
+futex_hash(struct addrspace *as, vaddr_t addr)
+{
+	uint32_t h;
+
+	h = (uint32_t)(uintptr_t)as ^ (uint32_t)addr;
+	h = (h >> 2) ^ (h >> 12);
+	return &futex_table[h & (FUTEX_HASHSIZE - 1)];
+}
+
+/*
+ * Take a waiter off its bucket's list. The bucket spinlock must be
+ * held.
+ */
+static
+void
+futex_unlink(struct futex_bucket *fb, struct futex_waiter *fw)
+{
+	KASSERT(spinlock_do_i_hold(&fb->fb_spinlock));
+
+	*fw->fw_prevp = fw->fw_next;
+	if (fw->fw_next != NULL) {
+		fw->fw_next->fw_prevp = fw->fw_prevp;
+	}
+	else {
+		fb->fb_tailp = fw->fw_prevp;
+	}
+}
+
+/*
+ * Check the user address and look up the caller's key.
+ */
+static
+int
+futex_key(userptr_t uaddr, struct addrspace **as_ret, vaddr_t *addr_ret)
+{
+	struct addrspace *as;
+
+	if ((vaddr_t)uaddr % sizeof(int32_t) != 0) {
+		return EINVAL;
+	}
+	as = proc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+	*as_ret = as;
+	*addr_ret = (vaddr_t)uaddr;
+	return 0;
+}
+
+/*
+ * futex_wait: sleep if *uaddr still equals val. Returns EINTR if the
+ * process is exiting (see proc_exitall).
+ */
+int
+sys_futex_wait(userptr_t uaddr, int32_t val)
+{
+	struct futex_waiter fw;
+	struct futex_bucket *fb;
+	int32_t cur;
+	int result;
+
+	result = futex_key(uaddr, &fw.fw_as, &fw.fw_addr);
+	if (result) {
+		return result;
+	}
+	fb = futex_hash(fw.fw_as, fw.fw_addr);
+
+	lock_acquire(fb->fb_lock);
+	result = copyin((const_userptr_t)uaddr, &cur, sizeof(cur));
+	if (result) {
+		lock_release(fb->fb_lock);
+		return result;
+	}
+	if (cur != val) {
+		/* It changed already; don't sleep. */
+		lock_release(fb->fb_lock);
+		return EAGAIN;
+	}
+
+	spinlock_acquire(&fb->fb_spinlock);
+	/* Go on the tail, so futex_wake wakes in arrival order. */
+	fw.fw_woken = false;
+	fw.fw_next = NULL;
+	fw.fw_prevp = fb->fb_tailp;
+	*fb->fb_tailp = &fw;
+	fb->fb_tailp = &fw.fw_next;
+
+	/*
+	 * We're on the list now, so a futex_wake that gets the sleep
+	 * lock after this will find us; and it can't mark us before
+	 * we're asleep because it also needs the spinlock.
+	 */
+	lock_release(fb->fb_lock);
+	result = 0;
+	while (!fw.fw_woken && result == 0) {
+		result = wchan_sleep_intr(fb->fb_wchan, &fb->fb_spinlock);
+	}
+	if (fw.fw_woken) {
+		/* futex_wake has already taken us off the list. */
+		result = 0;
+	}
+	else {
+		futex_unlink(fb, &fw);
+	}
+	spinlock_release(&fb->fb_spinlock);
+
+	return result;
+}
+
+/*
+ * futex_wake: wake up to n threads sleeping on uaddr. Returns the
+ * number woken.
+ */
+int
+sys_futex_wake(userptr_t uaddr, int n, int *retval)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter *fw, *next;
+	struct addrspace *as;
+	vaddr_t addr;
+	int count;
+	int result;
+
+	if (n < 0) {
+		return EINVAL;
+	}
+	result = futex_key(uaddr, &as, &addr);
+	if (result) {
+		return result;
+	}
+	fb = futex_hash(as, addr);
+
+	count = 0;
+	lock_acquire(fb->fb_lock);
+	spinlock_acquire(&fb->fb_spinlock);
+	for (fw = fb->fb_waiters; fw != NULL && count < n; fw = next) {
+		next = fw->fw_next;
+		if (fw->fw_as != as || fw->fw_addr != addr) {
+			continue;
+		}
+		futex_unlink(fb, fw);
+		fw->fw_woken = true;
+		count++;
+	}
+	if (count > 0) {
+		/*
+		 * Sleepers on other keys in this bucket wake too, see
+		 * they weren't marked, and go back to sleep. Collisions
+		 * should be rare enough that this beats finer wchans.
+		 */
+		wchan_wakeall(fb->fb_wchan, &fb->fb_spinlock);
+	}
+	spinlock_release(&fb->fb_spinlock);
+	lock_release(fb->fb_lock);
+
+	*retval = count;
+	return 0;
+}
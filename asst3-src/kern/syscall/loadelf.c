@@ -60,6 +60,110 @@
 #include <vnode.h>
 #include <elf.h>
 
+/*
+ * Read LEN bytes of V at OFFSET into the user address VADDR.
+ */
+static
+int
+load_bytes(struct addrspace *as, struct vnode *v,
+	   off_t offset, vaddr_t vaddr, size_t len,
+	   int is_executable)
+{
+	struct iovec iov;
+	struct uio u;
+	int result;
+
+	if (len == 0) {
+		return 0;
+	}
+
+	iov.iov_ubase = (userptr_t)vaddr;
+	iov.iov_len = len;
+	u.uio_iov = &iov;
+	u.uio_iovcnt = 1;
+	u.uio_resid = len;
+	u.uio_offset = offset;
+	u.uio_segflg = is_executable ? UIO_USERISPACE : UIO_USERSPACE;
+	u.uio_rw = UIO_READ;
+	u.uio_space = as;
+
+	result = VOP_READ(v, &u);
+	if (result) {
+		return result;
+	}
+
+	if (u.uio_resid != 0) {
+		kprintf("ELF: short read on segment - file truncated?\n");
+		return ENOEXEC;
+	}
+	return 0;
+}
+
+/*
+ * Load the whole pages of a read-only segment by mapping them from
+ * the VM system's shared copy of the file, so that every process
+ * running the same program uses the same physical text pages, and
+ * read only the partial pages at either end. Sets *DONE if it
+ * loaded the segment; if the VM system can't share pages (or there
+ * are no whole pages to share) it returns 0 without setting *DONE
+ * and load_segment reads the segment in as usual.
+ */
+static
+int
+load_shared_segment(struct addrspace *as, struct vnode *v,
+		    off_t offset, vaddr_t vaddr, size_t filesize,
+		    int is_executable, bool *done)
+{
+	vaddr_t first, last, end;
+	int result;
+
+	*done = false;
+
+	/* File and memory offsets have to agree within a page. */
+	if ((vaddr % PAGE_SIZE) != (offset % PAGE_SIZE)) {
+		return 0;
+	}
+
+	end = vaddr + filesize;
+	if (end < vaddr || end > USERSPACETOP) {
+		/* uiomove would have caught this; we have to */
+		return EFAULT;
+	}
+
+	first = ROUNDUP(vaddr, PAGE_SIZE);
+	last = end & PAGE_FRAME;
+	if (first >= last) {
+		return 0;
+	}
+
+	result = as_map_text(as, v, offset + (first - vaddr), first,
+			     (last - first) / PAGE_SIZE);
+	if (result == ENOSYS) {
+		return 0;
+	}
+	if (result) {
+		return result;
+	}
+
+	DEBUG(DB_EXEC, "ELF: Sharing %lu bytes at 0x%lx\n",
+	      (unsigned long) (last - first), (unsigned long) first);
+
+	result = load_bytes(as, v, offset, vaddr, first - vaddr,
+			    is_executable);
+	if (result) {
+		return result;
+	}
+	result = load_bytes(as, v, offset + (last - vaddr), last, end - last,
+			    is_executable);
+	if (result) {
+		return result;
+	}
+
+	/* The rest of the segment, if any, is zero-fill. */
+	*done = true;
+	return 0;
+}
+
 /*
  * Load a segment at virtual address VADDR. The segment in memory
  * extends from VADDR up to (but not including) VADDR+MEMSIZE. The
@@ -69,6 +173,9 @@
  * FILESIZE may be less than MEMSIZE; if so the remaining portion of
  * the in-memory segment should be zero-filled.
  *
+ * If the segment isn't writable its pages may be shared with other
+ * processes; see load_shared_segment.
+ *
  * Note that uiomove will catch it if someone tries to load an
  * executable whose load address is in kernel space. If you should
  * change this code to not use uiomove, be sure to check for this case
@@ -79,10 +186,11 @@ int
 load_segment(struct addrspace *as, struct vnode *v,
 	     off_t offset, vaddr_t vaddr,
 	     size_t memsize, size_t filesize,
-	     int is_executable)
+	     int is_writable, int is_executable)
 {
 	struct iovec iov;
 	struct uio u;
+	bool done;
 	int result;
 
 	if (filesize > memsize) {
@@ -93,6 +201,14 @@ load_segment(struct addrspace *as, struct vnode *v,
 	DEBUG(DB_EXEC, "ELF: Loading %lu bytes to 0x%lx\n",
 	      (unsigned long) filesize, (unsigned long) vaddr);
 
+	if (!is_writable) {
+		result = load_shared_segment(as, v, offset, vaddr, filesize,
+					     is_executable, &done);
+		if (result || done) {
+			return result;
+		}
+	}
+
 	iov.iov_ubase = (userptr_t)vaddr;
 	iov.iov_len = memsize;		 // length of the memory space
 	u.uio_iov = &iov;
@@ -290,7 +406,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 
 		result = load_segment(as, v, ph.p_offset, ph.p_vaddr,
 				      ph.p_memsz, ph.p_filesz,
-				      ph.p_flags & PF_X);
+				      ph.p_flags & PF_W, ph.p_flags & PF_X);
 		if (result) {
 			return result;
 		}
@@ -43,6 +43,7 @@
 #include <copyinout.h>
 #include <pid.h>
 #include <syscall.h>
+#include <kstat.h>
 
 /* note that sys_execv is in runprogram.c */
 
@@ -62,14 +63,95 @@ sys_getpid(pid_t *retval)
  * sys__exit()
  *
  * The process-level work (exit status, waking up waiters, etc.)
- * happens in proc_exit(). Then call thread_exit() to make our thread
+ * happens in proc_exit(), called from proc_exitall() by whichever of
+ * our threads leaves last. Then call thread_exit() to make our thread
  * go away too.
  */
 __DEAD
 void
 sys__exit(int status)
 {
-	proc_exit(_MKWAIT_EXIT(status));
+	proc_exitall(_MKWAIT_EXIT(status));
+	thread_exit();
+}
+
+/*
+ * sys_threadfork
+ *
+ * start a new thread in this process, which calls FUNC(ARG) on the
+ * stack whose top is STACK. The caller provides (and owns) the stack;
+ * the new thread must end with threadexit.
+ */
+
+struct threadstart {
+	struct trapframe ts_tf;
+	vaddr_t ts_entry;
+	userptr_t ts_arg;
+	vaddr_t ts_stack;
+};
+
+static
+void
+threadfork_newthread(void *vts, unsigned long junk)
+{
+	struct threadstart *ts = vts;
+	struct trapframe mytf;
+	vaddr_t entry, stack;
+	userptr_t arg;
+
+	(void)junk;
+
+	/* As in fork, get our own copy and free the malloced one. */
+	mytf = ts->ts_tf;
+	entry = ts->ts_entry;
+	arg = ts->ts_arg;
+	stack = ts->ts_stack;
+	kfree(ts);
+
+	enter_new_thread(&mytf, entry, arg, stack);
+}
+
+int
+sys_threadfork(struct trapframe *tf, userptr_t func, userptr_t arg,
+	       userptr_t stack)
+{
+	struct threadstart *ts;
+	int result;
+
+	/* The MIPS ABI wants a doubleword-aligned stack. */
+	if ((vaddr_t)func % 4 != 0 || (vaddr_t)stack % 8 != 0) {
+		return EINVAL;
+	}
+
+	ts = kmalloc(sizeof(*ts));
+	if (ts == NULL) {
+		return ENOMEM;
+	}
+	ts->ts_tf = *tf;
+	ts->ts_entry = (vaddr_t)func;
+	ts->ts_arg = arg;
+	ts->ts_stack = (vaddr_t)stack;
+
+	result = thread_fork(curthread->t_name, curproc,
+			     threadfork_newthread, ts, 0);
+	if (result) {
+		kfree(ts);
+		return result;
+	}
+	return 0;
+}
+
+/*
+ * sys_threadexit
+ *
+ * end the calling thread; if it's the last one, the process exits
+ * with status 0.
+ */
+__DEAD
+void
+sys_threadexit(void)
+{
+	proc_threadexit();
 	thread_exit();
 }
 
@@ -134,9 +216,83 @@ sys_fork(struct trapframe *tf, pid_t *retval)
 		return result;
 	}
 
+	counter_inc(&kstat_forks);
 	return 0;
 }
 
+/*
+ * sys_vfork
+ *
+ * create a new process that borrows our address space until it execs
+ * or exits, and wait until it does. This skips copying the address
+ * space, which for the usual fork-then-exec is all thrown away.
+ */
+
+static
+void
+vfork_newthread(void *vtf, unsigned long junk)
+{
+	struct trapframe mytf;
+
+	(void)junk;
+
+	/*
+	 * The parent's trapframe stays put while it waits for us,
+	 * so unlike fork we needn't have copied it to the heap; but
+	 * we need our own copy to go to userspace with.
+	 */
+	mytf = *(struct trapframe *)vtf;
+	enter_forked_process(&mytf);
+}
+
+int
+sys_vfork(struct trapframe *tf, pid_t *retval)
+{
+	int result;
+	struct proc *newproc;
+
+	result = proc_vfork(&newproc);
+	if (result) {
+		return result;
+	}
+	*retval = newproc->p_pid;
+
+	result = thread_fork(curthread->t_name, newproc,
+			     vfork_newthread, tf, 0);
+	if (result) {
+		proc_unfork(newproc);
+		return result;
+	}
+
+	counter_inc(&kstat_forks);
+	proc_vforkwait();
+	return 0;
+}
+
+/*
+ * sys_getaffinity
+ * fetch the mask of cpus the calling thread may run on.
+ */
+int
+sys_getaffinity(userptr_t maskptr)
+{
+	unsigned mask;
+
+	mask = thread_getaffinity();
+	return copyout(&mask, maskptr, sizeof(mask));
+}
+
+/*
+ * sys_setaffinity
+ * restrict the calling thread to the cpus in MASK. Children created
+ * with fork, and threads created with threadfork, inherit the mask.
+ */
+int
+sys_setaffinity(unsigned mask)
+{
+	return thread_setaffinity(mask);
+}
+
 /*
  * sys_waitpid
  * just pass off the work to the pid code.
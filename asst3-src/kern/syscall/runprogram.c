@@ -48,6 +48,7 @@
 #include <openfile.h>
 #include <filetable.h>
 #include <syscall.h>
+#include <kstat.h>
 #include <test.h>
 
 /*
@@ -55,21 +56,45 @@
  *
  * This is an abstraction that holds an argv while it's being shuffled
  * through the kernel during exec.
+ *
+ * The argv is gathered straight into the pages that will be the top
+ * of the new process's stack, laid out the way the process will see
+ * it, and those pages are then handed to the new address space with
+ * as_define_stack_pages instead of being copied out. The layout is
+ *
+ *	USERSTACK  -> +------------------+
+ *	              | argv[] pointers  |  ptrpages
+ *	              +------------------+  (page boundary)
+ *	              | argument strings |  strpages
+ *	stack ptr  -> +------------------+  (page boundary)
+ *
+ * with the strings packed upward from the bottom (crossing pages as
+ * needed) and the pointers starting at the bottom of their own pages,
+ * so both parts can grow a page at a time as the args come in and
+ * nothing ever has to move. Until the end we don't know where the
+ * bottom will be, so the pointers hold offsets from it; argbuf_install
+ * turns them into addresses.
  */
+#define ARGBUF_STRPAGES	DIVROUNDUP(ARG_MAX, PAGE_SIZE)
+#define ARGBUF_PTRPAGES	DIVROUNDUP((ARG_MAX + 1) * sizeof(userptr_t), PAGE_SIZE)
+
 struct argbuf {
-	char *data;
-	size_t len;
-	size_t max;
+	vaddr_t strpages[ARGBUF_STRPAGES];
+	vaddr_t ptrpages[ARGBUF_PTRPAGES];
+	unsigned nstrpages;
+	unsigned nptrpages;
+	size_t len;		/* bytes of strings */
 	int nargs;
 	bool tooksem;
 };
 
 /*
  * Throttle to limit the number of processes in exec at once. Or,
- * rather, the number trying to use large exec buffers at once. See
- * design notes for the rationale.
+ * rather, the number trying to use more than ARGBUF_SMALLPAGES pages
+ * of exec buffer at once. See design notes for the rationale.
  */
 #define EXEC_BIGBUF_THROTTLE	1
+#define ARGBUF_SMALLPAGES	2
 static struct semaphore *execthrottle;
 
 /*
@@ -91,26 +116,32 @@ static
 void
 argbuf_init(struct argbuf *buf)
 {
-	buf->data = NULL;
+	buf->nstrpages = 0;
+	buf->nptrpages = 0;
 	buf->len = 0;
-	buf->max = 0;
 	buf->nargs = 0;
 	buf->tooksem = false;
 }
 
 /*
- * Clean up an argv buffer when done.
+ * Clean up an argv buffer when done. Frees any pages it still has
+ * (that is, ones that haven't been installed in an address space).
  */
 static
 void
 argbuf_cleanup(struct argbuf *buf)
 {
-	if (buf->data != NULL) {
-		kfree(buf->data);
-		buf->data = NULL;
+	unsigned i;
+
+	for (i=0; i<buf->nstrpages; i++) {
+		free_kpages(buf->strpages[i]);
 	}
+	for (i=0; i<buf->nptrpages; i++) {
+		free_kpages(buf->ptrpages[i]);
+	}
+	buf->nstrpages = 0;
+	buf->nptrpages = 0;
 	buf->len = 0;
-	buf->max = 0;
 	buf->nargs = 0;
 	if (buf->tooksem) {
 		V(execthrottle);
@@ -119,79 +150,122 @@ argbuf_cleanup(struct argbuf *buf)
 }
 
 /*
- * Allocate the memory for an argv buffer.
+ * Add a page to one of the page lists of an argv buffer.
  */
 static
 int
-argbuf_allocate(struct argbuf *buf, size_t size)
+argbuf_newpage(struct argbuf *buf, vaddr_t *pages, unsigned *npages,
+	       unsigned maxpages)
 {
-	buf->data = kmalloc(size);
-	if (buf->data == NULL) {
+	vaddr_t page;
+
+	if (*npages >= maxpages) {
+		return E2BIG;
+	}
+
+	/* Wait on the semaphore, to throttle big allocations */
+	if (!buf->tooksem &&
+	    buf->nstrpages + buf->nptrpages >= ARGBUF_SMALLPAGES) {
+		P(execthrottle);
+		buf->tooksem = true;
+	}
+
+	page = alloc_kpages(1);
+	if (page == 0) {
 		return ENOMEM;
 	}
-	buf->max = size;
+	pages[(*npages)++] = page;
 	return 0;
 }
 
 /*
- * Prepare an argv buffer for runprogram, using a kernel pointer.
- *
- * This only accepts a program name (not arbitrary arguments) from the
- * menu, but could easily be extended to support arbitrary arguments.
+ * Get the kernel address of argv slot NUM, adding a page if needed.
  */
 static
 int
-argbuf_fromkernel(struct argbuf *buf, const char *progname)
+argbuf_slot(struct argbuf *buf, int num, vaddr_t **ret)
 {
-	size_t len;
+	size_t pos;
 	int result;
 
-	len = strlen(progname) + 1;
-
-	result = argbuf_allocate(buf, len);
-	if (result) {
-		return result;
+	pos = num * sizeof(userptr_t);
+	if (pos / PAGE_SIZE == buf->nptrpages) {
+		result = argbuf_newpage(buf, buf->ptrpages, &buf->nptrpages,
+					ARGBUF_PTRPAGES);
+		if (result) {
+			return result;
+		}
 	}
-	strcpy(buf->data, progname);
-	buf->len = len;
-	buf->nargs = 1;
-
+	*ret = (vaddr_t *)(buf->ptrpages[pos / PAGE_SIZE] + pos % PAGE_SIZE);
 	return 0;
 }
 
 /*
- * Copy an argv array into kernel space, using an argvdata buffer.
+ * Like copyinstr, but from a kernel string.
  */
 static
 int
-argbuf_copyin(struct argbuf *buf, userptr_t uargv)
+argbuf_kcopystr(const char *src, char *dest, size_t len, size_t *actual)
 {
-	userptr_t thisarg;
-	size_t thisarglen;
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		dest[i] = src[i];
+		if (src[i] == 0) {
+			*actual = i+1;
+			return 0;
+		}
+	}
+	return ENAMETOOLONG;
+}
+
+/*
+ * Add an argument to an argv buffer. ARG is a user pointer if
+ * FROMUSER is set, and a kernel pointer otherwise.
+ */
+static
+int
+argbuf_add(struct argbuf *buf, const char *arg, bool fromuser)
+{
+	vaddr_t *slot;
+	size_t start, room, thisarglen;
+	char *dest;
 	int result;
 
-	/* loop through the argv, grabbing each arg string */
-	buf->nargs = 0;
+	start = buf->len;
 	while (1) {
-		/*
-		 * First, grab the pointer at argv.
-		 * (argv is incremented at the end of the loop)
-		 */
-		result = copyin(uargv, &thisarg, sizeof(userptr_t));
-		if (result) {
-			return result;
+		if (buf->len == ARG_MAX) {
+			return E2BIG;
 		}
-
-		/* If we got NULL, we're at the end of the argv. */
-		if (thisarg == NULL) {
-			break;
+		if (buf->len / PAGE_SIZE == buf->nstrpages) {
+			result = argbuf_newpage(buf, buf->strpages,
+						&buf->nstrpages,
+						ARGBUF_STRPAGES);
+			if (result) {
+				return result;
+			}
 		}
 
-		/* Use the pointer to fetch the argument string. */
-		result = copyinstr(thisarg, buf->data + buf->len,
-				   buf->max - buf->len, &thisarglen);
+		/* copy as much as fits in this page */
+		dest = (char *)buf->strpages[buf->len / PAGE_SIZE] +
+			buf->len % PAGE_SIZE;
+		room = PAGE_SIZE - buf->len % PAGE_SIZE;
+		if (room > ARG_MAX - buf->len) {
+			room = ARG_MAX - buf->len;
+		}
+		if (fromuser) {
+			result = copyinstr((const_userptr_t)arg, dest, room,
+					   &thisarglen);
+		}
+		else {
+			result = argbuf_kcopystr(arg, dest, room,
+						 &thisarglen);
+		}
 		if (result == ENAMETOOLONG) {
-			return E2BIG;
+			/* filled the page; carry on in the next one */
+			buf->len += room;
+			arg += room;
+			continue;
 		}
 		else if (result) {
 			return result;
@@ -199,13 +273,32 @@ argbuf_copyin(struct argbuf *buf, userptr_t uargv)
 
 		/* Move ahead. Note: thisarglen includes the \0. */
 		buf->len += thisarglen;
-		uargv += sizeof(userptr_t);
-		buf->nargs++;
+		break;
 	}
 
+	/* Point the next argv slot at it. */
+	result = argbuf_slot(buf, buf->nargs, &slot);
+	if (result) {
+		return result;
+	}
+	*slot = start;
+	buf->nargs++;
 	return 0;
 }
 
+/*
+ * Prepare an argv buffer for runprogram, using a kernel pointer.
+ *
+ * This only accepts a program name (not arbitrary arguments) from the
+ * menu, but could easily be extended to support arbitrary arguments.
+ */
+static
+int
+argbuf_fromkernel(struct argbuf *buf, const char *progname)
+{
+	return argbuf_add(buf, progname, false);
+}
+
 /*
  * Get an argv from user space.
  */
@@ -213,121 +306,96 @@ static
 int
 argbuf_fromuser(struct argbuf *buf, userptr_t uargv)
 {
+	userptr_t thisarg;
 	int result;
 
-	/* try with a small buffer */
-	result = argbuf_allocate(buf, PAGE_SIZE);
-	if (result) {
-		return result;
-	}
-
-	/* do the copyin */
-	result = argbuf_copyin(buf, uargv);
-	if (result == E2BIG) {
+	/* loop through the argv, grabbing each arg string */
+	while (1) {
 		/*
-		 * Try again with the full-size buffer. Just start
-		 * over instead of trying to keep the page we already
-		 * did; this is a bit inefficient but it's not that
-		 * important.
+		 * First, grab the pointer at argv.
+		 * (argv is incremented at the end of the loop)
 		 */
-		argbuf_cleanup(buf);
-		argbuf_init(buf);
+		result = copyin(uargv, &thisarg, sizeof(userptr_t));
+		if (result) {
+			return result;
+		}
 
-		/* Wait on the semaphore, to throttle this allocation */
-		P(execthrottle);
-		buf->tooksem = true;
+		/* If we got NULL, we're at the end of the argv. */
+		if (thisarg == NULL) {
+			break;
+		}
 
-		result = argbuf_allocate(buf, ARG_MAX);
+		/* Use the pointer to fetch the argument string. */
+		result = argbuf_add(buf, (const char *)thisarg, true);
 		if (result) {
 			return result;
 		}
-
-		result = argbuf_copyin(buf, uargv);
+		uargv += sizeof(userptr_t);
 	}
-	return result;
+
+	return 0;
 }
 
 /*
- * Copy an argv out of kernel space to user space.
- *
- * Note: ustackp is an in/out argument.
+ * Hand the argv over to the (new, current) address space AS as the
+ * top of its stack. On success the pages belong to AS, and the stack
+ * pointer, argc, and argv for the new process are handed back.
  */
 static
 int
-argbuf_copyout(struct argbuf *buf, vaddr_t *ustackp,
+argbuf_install(struct argbuf *buf, struct addrspace *as, vaddr_t *ustackp,
 	       int *argc_ret, userptr_t *uargv_ret)
 {
-	vaddr_t ustack;
-	userptr_t ustringbase, uargvbase, uargv_i;
-	userptr_t thisarg;
-	size_t thisarglen;
-	size_t pos;
+	vaddr_t pages[ARGBUF_STRPAGES + ARGBUF_PTRPAGES];
+	vaddr_t *slot, base;
+	unsigned i, npages;
 	int result;
 
-	/* Begin the stack at the passed in top. */
-	ustack = *ustackp;
-
-	/*
-	 * Allocate space.
-	 *
-	 * buf->pos is the amount of space used by the strings; put that
-	 * first, then align the stack, then make space for the argv
-	 * pointers. Allow an extra slot for the ending NULL.
-	 */
-
-	ustack -= buf->len;
-	ustack -= (ustack & (sizeof(void *) - 1));
-	ustringbase = (userptr_t)ustack;
-
-	ustack -= (buf->nargs + 1) * sizeof(userptr_t);
-	uargvbase = (userptr_t)ustack;
-
-	/* Now copy the data out. */
-	pos = 0;
-	uargv_i = uargvbase;
-	while (pos < buf->len) {
-		/* The user address of the string will be ustringbase + pos. */
-		thisarg = ustringbase + pos;
-
-		/* Place it in the argv array. */
-		result = copyout(&thisarg, uargv_i, sizeof(thisarg));
-		if (result) {
-			return result;
-		}
-
-		/* Push out the string. */
-		result = copyoutstr(buf->data + pos, thisarg,
-				    buf->len - pos, &thisarglen);
-		if (result) {
-			return result;
-		}
-
-		/* thisarglen includes the \0 */
-		pos += thisarglen;
-		uargv_i += sizeof(thisarg);
+	/* Add the NULL. */
+	result = argbuf_slot(buf, buf->nargs, &slot);
+	if (result) {
+		return result;
+	}
+	*slot = 0;
+
+	/* Now we know where everything goes; fix up the pointers. */
+	npages = buf->nstrpages + buf->nptrpages;
+	base = USERSTACK - npages * PAGE_SIZE;
+	for (i=0; i<(unsigned)buf->nargs; i++) {
+		result = argbuf_slot(buf, i, &slot);
+		KASSERT(result == 0);
+		*slot += base;
 	}
-	/* Should have come out even... */
-	KASSERT(pos == buf->len);
 
-	/* Add the NULL. */
-	thisarg = NULL;
-	result = copyout(&thisarg, uargv_i, sizeof(userptr_t));
+	for (i=0; i<buf->nstrpages; i++) {
+		pages[i] = buf->strpages[i];
+	}
+	for (i=0; i<buf->nptrpages; i++) {
+		pages[buf->nstrpages + i] = buf->ptrpages[i];
+	}
+	result = as_define_stack_pages(as, pages, npages, ustackp);
 	if (result) {
 		return result;
 	}
+	KASSERT(*ustackp == base);
 
-	*ustackp = ustack;
 	*argc_ret = buf->nargs;
-	*uargv_ret = uargvbase;
+	*uargv_ret = (userptr_t)(base + buf->nstrpages * PAGE_SIZE);
+
+	/* they're the address space's now */
+	buf->nstrpages = 0;
+	buf->nptrpages = 0;
 	return 0;
 }
 
 /*
- * Common code for execv and runprogram: loading the executable.
+ * Common code for execv and runprogram: loading the executable and
+ * setting up its stack with the argv in ARGS.
  */
 static
 int
-loadexec(char *path, vaddr_t *entrypoint, vaddr_t *stackptr)
+loadexec(char *path, struct argbuf *args, vaddr_t *entrypoint,
+	 vaddr_t *stackptr, int *argc, userptr_t *uargv)
 {
 	struct addrspace *newvm, *oldvm;
 	struct vnode *v;
@@ -375,8 +443,8 @@ loadexec(char *path, vaddr_t *entrypoint, vaddr_t *stackptr)
 
 	vfs_close(v);
 
-	/* Define the user stack in the address space */
-	result = as_define_stack(newvm, stackptr);
+	/* Define the user stack in the address space, argv and all */
+	result = argbuf_install(args, newvm, stackptr, argc, uargv);
 	if (result) {
 		proc_setas(oldvm);
 		as_activate();
@@ -386,12 +454,16 @@ loadexec(char *path, vaddr_t *entrypoint, vaddr_t *stackptr)
         }
 
 	/*
-	 * Wipe out old address space.
+	 * Wipe out old address space, or if it was only borrowed by
+	 * vfork, hand it back to the parent.
 	 *
 	 * Note: once this is done, execv() must not fail, because there's
 	 * nothing left for it to return an error to.
 	 */
-	if (oldvm) {
+	if (curproc->p_vforkparent != NULL) {
+		proc_vforkdone(curproc);
+	}
+	else if (oldvm) {
 		as_destroy(oldvm);
 	}
 
@@ -519,21 +591,15 @@ runprogram(char *progname)
 	}
 
 	/* Load the executable. Note: must not fail after this succeeds. */
-	result = loadexec(progname, &entrypoint, &stackptr);
-	if (result) {
-		argbuf_cleanup(&kargv);
-		return result;
-	}
+	result = loadexec(progname, &kargv, &entrypoint, &stackptr,
+			  &argc, &uargv);
 
-	result = argbuf_copyout(&kargv, &stackptr, &argc, &uargv);
+	/* free the space (the argv itself is now in the process) */
+	argbuf_cleanup(&kargv);
 	if (result) {
-		/* If copyout fails, *we* messed up, so panic */
-		panic("execv: copyout_args failed: %s\n", strerror(result));
+		return result;
 	}
 
-	/* free the space */
-	argbuf_cleanup(&kargv);
-
 	/* Warp to user mode. */
 	enter_new_process(argc, uargv, NULL /*uenv*/, stackptr, entrypoint);
 
@@ -546,10 +612,9 @@ runprogram(char *progname)
  * execv.
  *
  * 1. Copy in the program name.
- * 2. Copy in the argv with copyin_args.
- * 3. Load the executable.
- * 4. Copy the argv out again with copyout_args.
- * 5. Warp to usermode.
+ * 2. Copy in the argv, into what will be the new stack pages.
+ * 3. Load the executable, and give it those pages as its stack.
+ * 4. Warp to usermode.
  */
 int
 sys_execv(userptr_t prog, userptr_t uargv)
@@ -557,9 +622,18 @@ sys_execv(userptr_t prog, userptr_t uargv)
 	char *path;
 	struct argbuf kargv;
 	vaddr_t entrypoint, stackptr;
+	unsigned nthreads;
 	int argc;
 	int result;
 
+	/* Don't pull the address space out from under other threads. */
+	lock_acquire(curproc->p_threadslock);
+	nthreads = threadarray_num(&curproc->p_threads);
+	lock_release(curproc->p_threadslock);
+	if (nthreads > 1) {
+		return EBUSY;
+	}
+
 	path = kmalloc(PATH_MAX);
 	if (!path) {
 		return ENOMEM;
@@ -584,25 +658,17 @@ sys_execv(userptr_t prog, userptr_t uargv)
 	}
 
 	/* Load the executable. Note: must not fail after this succeeds. */
-	result = loadexec(path, &entrypoint, &stackptr);
-	if (result) {
-		argbuf_cleanup(&kargv);
-		kfree(path);
-		return result;
-	}
+	result = loadexec(path, &kargv, &entrypoint, &stackptr,
+			  &argc, &uargv);
 
-	/* don't need this any more */
+	/* don't need these any more (the argv is now in the process) */
+	argbuf_cleanup(&kargv);
 	kfree(path);
-
-	/* Send the argv strings to the process. */
-	result = argbuf_copyout(&kargv, &stackptr, &argc, &uargv);
 	if (result) {
-		/* if copyout fails, *we* messed up, so panic */
-		panic("execv: copyout_args failed: %s\n", strerror(result));
+		return result;
 	}
 
-	/* free the argv buffer space */
-	argbuf_cleanup(&kargv);
+	counter_inc(&kstat_execs);
 
 	/* Warp to user mode. */
 	enter_new_process(argc, uargv, NULL /*uenv*/, stackptr, entrypoint);
@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Callout test code.
+ */
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <clock.h>
+#include <callout.h>
+#include <test.h>
+
+/*
+ * Delays are chosen so that some land directly on level 0 and some
+ * have to be cascaded down from level 1.
+ */
+static const unsigned cot_delays[] = {
+	1, 2, 3, 17, 63, 64, 65, 130, 200, 500,
+};
+#define NCALLOUTS (sizeof(cot_delays) / sizeof(cot_delays[0]))
+
+/* Index of the callout that gets cancelled. */
+#define COT_CANCEL	5
+
+struct cottest {
+	struct callout ct_callout;
+	unsigned ct_index;
+	unsigned ct_order;
+	bool ct_fired;
+	bool ct_ontime;
+};
+
+static struct cottest cot_tests[NCALLOUTS];
+static struct semaphore *cot_sem;
+static struct spinlock cot_lock;
+static unsigned cot_nextorder;
+
+static
+void
+cot_fire(void *arg)
+{
+	struct cottest *ct = arg;
+
+	spinlock_acquire(&cot_lock);
+	ct->ct_fired = true;
+	ct->ct_order = cot_nextorder++;
+	ct->ct_ontime =
+		(ct->ct_callout.co_expire == curcpu->c_callwheel.cw_now);
+	spinlock_release(&cot_lock);
+
+	V(cot_sem);
+}
+
+int
+callouttest(int nargs, char **args)
+{
+	uint32_t oldaffinity;
+	unsigned i, expected;
+	int result, failures;
+	bool cancelled;
+
+	(void)nargs;
+	(void)args;
+
+	cot_sem = sem_create("callouttest", 0);
+	if (cot_sem == NULL) {
+		panic("callouttest: sem_create failed\n");
+	}
+	spinlock_init(&cot_lock);
+	cot_nextorder = 0;
+	failures = 0;
+
+	/*
+	 * Stay on one cpu, so all the callouts go on the same wheel and
+	 * firing order is well defined.
+	 */
+	oldaffinity = thread_getaffinity();
+	result = thread_setaffinity(1U << curcpu->c_number);
+	if (result) {
+		panic("callouttest: thread_setaffinity: %s\n",
+		      strerror(result));
+	}
+
+	kprintf("Starting callout test (about %u seconds)...\n",
+		cot_delays[NCALLOUTS - 1] / HZ + 1);
+
+	/* Schedule them in reverse, so insertion order doesn't help. */
+	for (i=NCALLOUTS; i-- > 0; ) {
+		cot_tests[i].ct_index = i;
+		cot_tests[i].ct_fired = false;
+		cot_tests[i].ct_ontime = false;
+		callout_init(&cot_tests[i].ct_callout, cot_fire,
+			     &cot_tests[i]);
+		callout_schedule(&cot_tests[i].ct_callout, cot_delays[i]);
+	}
+
+	/* Cancel one; it should never fire. */
+	cancelled = callout_stop(&cot_tests[COT_CANCEL].ct_callout);
+	if (!cancelled) {
+		kprintf("callouttest: callout %d was not pending\n",
+			COT_CANCEL);
+		failures++;
+		P(cot_sem);
+	}
+	KASSERT(!callout_pending(&cot_tests[COT_CANCEL].ct_callout));
+
+	for (i=0; i<NCALLOUTS - 1; i++) {
+		P(cot_sem);
+	}
+
+	thread_setaffinity(oldaffinity);
+
+	expected = 0;
+	for (i=0; i<NCALLOUTS; i++) {
+		if (i == COT_CANCEL && cancelled) {
+			if (cot_tests[i].ct_fired) {
+				kprintf("callouttest: cancelled callout %u "
+					"fired\n", i);
+				failures++;
+			}
+			continue;
+		}
+		if (!cot_tests[i].ct_fired) {
+			kprintf("callouttest: callout %u (%u ticks) "
+				"never fired\n", i, cot_delays[i]);
+			failures++;
+			continue;
+		}
+		if (!cot_tests[i].ct_ontime) {
+			kprintf("callouttest: callout %u (%u ticks) "
+				"fired at the wrong tick\n", i, cot_delays[i]);
+			failures++;
+		}
+		if (cot_tests[i].ct_order != expected) {
+			kprintf("callouttest: callout %u (%u ticks) "
+				"fired out of order\n", i, cot_delays[i]);
+			failures++;
+		}
+		expected++;
+	}
+
+	sem_destroy(cot_sem);
+	cot_sem = NULL;
+
+	if (failures) {
+		kprintf("Callout test FAILED\n");
+		return 0;
+	}
+	kprintf("Callout test done.\n");
+	return 0;
+}
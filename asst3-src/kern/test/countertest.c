@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Per-cpu counter test code.
+ */
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <thread.h>
+#include <synch.h>
+#include <counter.h>
+#include <test.h>
+
+#define NCTRTHREADS	8
+#define NCTRLOOPS	20000
+
+static struct counter ctt_counter;
+static struct semaphore *ctt_done;
+
+/*
+ * Each thread adds 3 and takes away 1 NCTRLOOPS times. On two steps
+ * in every 1000 it adds and then takes away something big enough to
+ * fold right away, and on all the other steps it adds N; so thread N
+ * ends up having added 2*NCTRLOOPS + N*(NCTRLOOPS - 2*(NCTRLOOPS/1000)).
+ */
+static
+void
+ctt_thread(void *junk, unsigned long num)
+{
+	unsigned i;
+
+	(void)junk;
+
+	for (i=0; i<NCTRLOOPS; i++) {
+		counter_add(&ctt_counter, 3);
+		counter_dec(&ctt_counter);
+		if (i % 1000 == 0) {
+			counter_add(&ctt_counter, 1000 * num);
+		}
+		else if (i % 1000 == 500) {
+			counter_add(&ctt_counter, -1000 * (int32_t)num);
+		}
+		else if (num > 0) {
+			counter_add(&ctt_counter, num);
+		}
+	}
+	V(ctt_done);
+}
+
+int
+countertest(int nargs, char **args)
+{
+	unsigned i;
+	int64_t expected, exact, approx, slop;
+	int result, failures;
+
+	(void)nargs;
+	(void)args;
+
+	ctt_done = sem_create("countertest", 0);
+	if (ctt_done == NULL) {
+		panic("countertest: sem_create failed\n");
+	}
+	counter_init(&ctt_counter, "countertest");
+	failures = 0;
+
+	kprintf("Starting per-cpu counter test...\n");
+
+	for (i=0; i<NCTRTHREADS; i++) {
+		result = thread_fork("countertest", NULL, ctt_thread, NULL, i);
+		if (result) {
+			panic("countertest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NCTRTHREADS; i++) {
+		P(ctt_done);
+	}
+
+	/*
+	 * Work out what it should be. The 1000*num adds and subtracts
+	 * cancel; all the other steps get +num.
+	 */
+	expected = 0;
+	for (i=0; i<NCTRTHREADS; i++) {
+		expected += 2 * NCTRLOOPS;
+		expected += (int64_t)i * (NCTRLOOPS - 2 * (NCTRLOOPS / 1000));
+	}
+
+	exact = counter_read_exact(&ctt_counter);
+	approx = counter_read(&ctt_counter);
+	slop = (int64_t)cpu_count() * (COUNTER_BATCH - 1);
+	if (exact != expected) {
+		kprintf("countertest: exact value %lld, expected %lld\n",
+			(long long)exact, (long long)expected);
+		failures++;
+	}
+	if (approx < expected - slop || approx > expected + slop) {
+		kprintf("countertest: approximate value %lld too far from "
+			"%lld\n", (long long)approx, (long long)expected);
+		failures++;
+	}
+
+	counter_reset(&ctt_counter);
+	if (counter_read_exact(&ctt_counter) != 0) {
+		kprintf("countertest: counter_reset didn't\n");
+		failures++;
+	}
+
+	counter_cleanup(&ctt_counter);
+	sem_destroy(ctt_done);
+
+	if (failures) {
+		kprintf("Per-cpu counter test FAILED\n");
+		return 0;
+	}
+	kprintf("Per-cpu counter test done.\n");
+	return 0;
+}
@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Ring buffer test code.
+ */
+#include <types.h>
+#include <lib.h>
+#include <thread.h>
+#include <synch.h>
+#include <ringbuf.h>
+#include <test.h>
+
+#define RBT_SIZE	16	/* Ring size, small so it fills up */
+#define NPRODUCERS	4
+#define NCONSUMERS	4
+#define NITEMS		4000	/* Items per producer */
+#define RBT_BATCH	5	/* Batch size for the batching threads */
+
+/* Items are (producer, sequence) pairs, offset so none is NULL. */
+#define RBT_ITEM(p, i)	((void *)(((uintptr_t)(p) << 16 | (i)) + 1))
+#define RBT_PROD(x)	((((uintptr_t)(x) - 1) >> 16) & 0xff)
+#define RBT_SEQ(x)	(((uintptr_t)(x) - 1) & 0xffff)
+
+static struct ringbuf *rbt_ring;
+static struct semaphore *rbt_done;
+static char rbt_sentinel;
+
+struct rbt_consumer {
+	unsigned rc_count;			/* Items received */
+	unsigned long rc_sum;			/* Sum of their sequences */
+	unsigned rc_bad;			/* Out of order or bogus */
+	int rc_last[NPRODUCERS];		/* Last seq from each */
+};
+
+static struct rbt_consumer rbt_consumers[NCONSUMERS];
+
+/*
+ * Producers: odd-numbered ones put in batches, the rest one at a time.
+ */
+static
+void
+rbt_producer(void *junk, unsigned long num)
+{
+	void *items[RBT_BATCH];
+	unsigned i, j, n;
+
+	(void)junk;
+
+	for (i=0; i<NITEMS; i += n) {
+		n = (num % 2) ? RBT_BATCH : 1;
+		if (n > NITEMS - i) {
+			n = NITEMS - i;
+		}
+		for (j=0; j<n; j++) {
+			items[j] = RBT_ITEM(num, i + j);
+		}
+		ringbuf_put_batch(rbt_ring, items, n);
+	}
+	V(rbt_done);
+}
+
+/*
+ * Consumers: same split. Each one stops at the first sentinel; if it
+ * gets more than one in a batch it puts the extras back for the
+ * others. Sentinels are only put after all the producers finish, so
+ * nothing real can come after one.
+ */
+static
+void
+rbt_consumer(void *junk, unsigned long num)
+{
+	struct rbt_consumer *rc = &rbt_consumers[num];
+	void *items[RBT_BATCH];
+	unsigned i, n, p, seq;
+	bool done = false;
+
+	(void)junk;
+
+	while (!done) {
+		n = ringbuf_get_batch(rbt_ring, items,
+				      (num % 2) ? RBT_BATCH : 1);
+		for (i=0; i<n; i++) {
+			if (items[i] == &rbt_sentinel) {
+				if (done) {
+					ringbuf_put(rbt_ring, items[i]);
+				}
+				done = true;
+				continue;
+			}
+			if (done) {
+				rc->rc_bad++;
+				continue;
+			}
+			p = RBT_PROD(items[i]);
+			seq = RBT_SEQ(items[i]);
+			if (p >= NPRODUCERS || (int)seq <= rc->rc_last[p]) {
+				rc->rc_bad++;
+				continue;
+			}
+			rc->rc_last[p] = seq;
+			rc->rc_count++;
+			rc->rc_sum += seq;
+		}
+	}
+	V(rbt_done);
+}
+
+/*
+ * Single-threaded checks: empty and full behavior, batches that only
+ * partly fit, and wrapping around.
+ */
+static
+int
+rbt_basic(void)
+{
+	void *items[RBT_SIZE + 1];
+	unsigned i, n, lap;
+	int failures = 0;
+
+	if (ringbuf_tryget(rbt_ring) != NULL) {
+		kprintf("ringtest: got an item from an empty ring\n");
+		failures++;
+	}
+
+	for (lap=0; lap<3; lap++) {
+		for (i=0; i<RBT_SIZE + 1; i++) {
+			items[i] = RBT_ITEM(0, i);
+		}
+		n = ringbuf_tryput_batch(rbt_ring, items, 3);
+		n += ringbuf_tryput_batch(rbt_ring, items + n,
+					  RBT_SIZE + 1 - n);
+		if (n != RBT_SIZE || ringbuf_count(rbt_ring) != RBT_SIZE) {
+			kprintf("ringtest: filled %u of %u slots\n",
+				n, RBT_SIZE);
+			failures++;
+		}
+		if (ringbuf_tryput(rbt_ring, items[RBT_SIZE])) {
+			kprintf("ringtest: put into a full ring\n");
+			failures++;
+		}
+		for (i=0; i<RBT_SIZE + 1; i++) {
+			items[i] = NULL;
+		}
+		if (ringbuf_tryget(rbt_ring) != RBT_ITEM(0, 0)) {
+			kprintf("ringtest: wrong first item\n");
+			failures++;
+		}
+		n = ringbuf_tryget_batch(rbt_ring, items, RBT_SIZE + 1);
+		if (n != RBT_SIZE - 1) {
+			kprintf("ringtest: emptied %u of %u slots\n",
+				n, RBT_SIZE - 1);
+			failures++;
+		}
+		for (i=0; i<n; i++) {
+			if (items[i] != RBT_ITEM(0, i + 1)) {
+				kprintf("ringtest: item %u out of order\n",
+					i + 1);
+				failures++;
+			}
+		}
+		/* Move the start so the next lap wraps mid-ring. */
+		ringbuf_put(rbt_ring, RBT_ITEM(0, 0));
+		(void)ringbuf_get(rbt_ring);
+	}
+	if (ringbuf_count(rbt_ring) != 0) {
+		kprintf("ringtest: ring not empty\n");
+		failures++;
+	}
+	return failures;
+}
+
+int
+ringtest(int nargs, char **args)
+{
+	unsigned i, total;
+	unsigned long sum;
+	int result, failures;
+
+	(void)nargs;
+	(void)args;
+
+	rbt_ring = ringbuf_create("ringtest", RBT_SIZE);
+	if (rbt_ring == NULL) {
+		panic("ringtest: ringbuf_create failed\n");
+	}
+	rbt_done = sem_create("ringtest", 0);
+	if (rbt_done == NULL) {
+		panic("ringtest: sem_create failed\n");
+	}
+
+	kprintf("Starting ring buffer test...\n");
+
+	failures = rbt_basic();
+
+	for (i=0; i<NCONSUMERS; i++) {
+		bzero(&rbt_consumers[i], sizeof(rbt_consumers[i]));
+		memset(rbt_consumers[i].rc_last, 0xff,
+		       sizeof(rbt_consumers[i].rc_last));
+		result = thread_fork("ringtest-get", NULL,
+				     rbt_consumer, NULL, i);
+		if (result) {
+			panic("ringtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NPRODUCERS; i++) {
+		result = thread_fork("ringtest-put", NULL,
+				     rbt_producer, NULL, i);
+		if (result) {
+			panic("ringtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	for (i=0; i<NPRODUCERS; i++) {
+		P(rbt_done);
+	}
+	for (i=0; i<NCONSUMERS; i++) {
+		ringbuf_put(rbt_ring, &rbt_sentinel);
+	}
+	for (i=0; i<NCONSUMERS; i++) {
+		P(rbt_done);
+	}
+
+	total = 0;
+	sum = 0;
+	for (i=0; i<NCONSUMERS; i++) {
+		total += rbt_consumers[i].rc_count;
+		sum += rbt_consumers[i].rc_sum;
+		if (rbt_consumers[i].rc_bad > 0) {
+			kprintf("ringtest: consumer %u got %u bad items\n",
+				i, rbt_consumers[i].rc_bad);
+			failures++;
+		}
+	}
+	if (total != NPRODUCERS * NITEMS) {
+		kprintf("ringtest: got %u items, expected %u\n",
+			total, NPRODUCERS * NITEMS);
+		failures++;
+	}
+	if (sum != NPRODUCERS * (NITEMS * (unsigned long)(NITEMS - 1) / 2)) {
+		kprintf("ringtest: checksum mismatch\n");
+		failures++;
+	}
+
+	ringbuf_destroy(rbt_ring);
+	sem_destroy(rbt_done);
+
+	if (failures) {
+		kprintf("Ring buffer test FAILED\n");
+		return 0;
+	}
+	kprintf("Ring buffer test done.\n");
+	return 0;
+}
@@ -31,6 +31,7 @@
 #include <lib.h>
 #include <spinlock.h>
 #include <synch.h>
+#include <sleepq.h>
 #include <thread.h>
 #include <current.h>
 #include <clock.h>
@@ -147,7 +148,7 @@ spinlock_not_held(struct spinlock *splk)
  * 1. After a successful sem_create:
  *     - sem_name compares equal to the passed-in name
  *     - sem_name is not the same pointer as the passed-in name
- *     - sem_wchan is not null
+ *     - nothing is asleep on it
  *     - sem_lock is not held and has no owner
  *     - sem_count is the passed-in count
  */
@@ -165,7 +166,7 @@ semu1(int nargs, char **args)
 	}
 	KASSERT(!strcmp(sem->sem_name, name));
 	KASSERT(sem->sem_name != name);
-	KASSERT(sem->sem_wchan != NULL);
+	KASSERT(sleepq_isempty(sem));
 	KASSERT(spinlock_not_held(&sem->sem_lock));
 	KASSERT(sem->sem_count == 56);
 
@@ -309,7 +310,7 @@ semu7(int nargs, char **args)
 /*
  * 8/9. After calling V on a semaphore with no threads waiting:
  *    - sem_name is unchanged
- *    - sem_wchan is unchanged
+ *    - nothing is asleep on it
  *    - sem_lock is (still) unheld and has no owner
  *    - sem_count is increased by one
  *
@@ -320,14 +321,12 @@ void
 do_semu89(bool interrupthandler)
 {
 	struct semaphore *sem;
-	struct wchan *wchan;
 	const char *name;
 
 	sem = makesem(0);
 
 	/* check preconditions */
 	name = sem->sem_name;
-	wchan = sem->sem_wchan;
 	KASSERT(!strcmp(name, NAMESTRING));
 	KASSERT(spinlock_not_held(&sem->sem_lock));
 
@@ -354,7 +353,7 @@ do_semu89(bool interrupthandler)
 	/* check postconditions */
 	KASSERT(name == sem->sem_name);
 	KASSERT(!strcmp(name, NAMESTRING));
-	KASSERT(wchan == sem->sem_wchan);
+	KASSERT(sleepq_isempty(sem));
 	KASSERT(spinlock_not_held(&sem->sem_lock));
 	KASSERT(sem->sem_count == 1);
 
@@ -385,7 +384,7 @@ semu9(int nargs, char **args)
  * 10/11. After calling V on a semaphore with one thread waiting, and giving
  * it time to run:
  *    - sem_name is unchanged
- *    - sem_wchan is unchanged
+ *    - nothing is asleep on it
  *    - sem_lock is (still) unheld and has no owner
  *    - sem_count is still 0
  *    - the other thread does in fact run
@@ -397,7 +396,6 @@ int
 do_semu1011(bool interrupthandler)
 {
 	struct semaphore *sem;
-	struct wchan *wchan;
 	const char *name;
 
 	sem = makesem(0);
@@ -405,7 +403,6 @@ do_semu1011(bool interrupthandler)
 
 	/* check preconditions */
 	name = sem->sem_name;
-	wchan = sem->sem_wchan;
 	KASSERT(!strcmp(name, NAMESTRING));
 	KASSERT(spinlock_not_held(&sem->sem_lock));
 	spinlock_acquire(&waiters_lock);
@@ -431,7 +428,7 @@ do_semu1011(bool interrupthandler)
 	/* check postconditions */
 	KASSERT(name == sem->sem_name);
 	KASSERT(!strcmp(name, NAMESTRING));
-	KASSERT(wchan == sem->sem_wchan);
+	KASSERT(sleepq_isempty(sem));
 	KASSERT(spinlock_not_held(&sem->sem_lock));
 	KASSERT(sem->sem_count == 0);
 	spinlock_acquire(&waiters_lock);
@@ -468,7 +465,7 @@ semu11(int nargs, char **args)
  * 12/13. After calling V on a semaphore with two threads waiting, and
  * giving it time to run:
  *    - sem_name is unchanged
- *    - sem_wchan is unchanged
+ *    - the other one is still asleep on it
  *    - sem_lock is (still) unheld and has no owner
  *    - sem_count is still 0
  *    - one of the other threads does in fact run
@@ -479,7 +476,6 @@ void
 semu1213(bool interrupthandler)
 {
 	struct semaphore *sem;
-	struct wchan *wchan;
 	const char *name;
 
 	sem = makesem(0);
@@ -488,9 +484,7 @@ semu1213(bool interrupthandler)
 
 	/* check preconditions */
 	name = sem->sem_name;
-	wchan = sem->sem_wchan;
 	KASSERT(!strcmp(name, NAMESTRING));
-	wchan = sem->sem_wchan;
 	KASSERT(spinlock_not_held(&sem->sem_lock));
 	spinlock_acquire(&waiters_lock);
 	KASSERT(waiters_running == 2);
@@ -515,7 +509,7 @@ semu1213(bool interrupthandler)
 	/* check postconditions */
 	KASSERT(name == sem->sem_name);
 	KASSERT(!strcmp(name, NAMESTRING));
-	KASSERT(wchan == sem->sem_wchan);
+	KASSERT(!sleepq_isempty(sem));
 	KASSERT(spinlock_not_held(&sem->sem_lock));
 	KASSERT(sem->sem_count == 0);
 	spinlock_acquire(&waiters_lock);
@@ -671,7 +665,7 @@ semu17(int nargs, char **args)
 /*
  * 18. After calling P on a semaphore with count > 0:
  *    - sem_name is unchanged
- *    - sem_wchan is unchanged
+ *    - nothing is asleep on it
  *    - sem_lock is unheld and has no owner
  *    - sem_count is one less
  */
@@ -679,7 +673,6 @@ int
 semu18(int nargs, char **args)
 {
 	struct semaphore *sem;
-	struct wchan *wchan;
 	const char *name;
 
 	(void)nargs; (void)args;
@@ -689,7 +682,6 @@ semu18(int nargs, char **args)
 	/* preconditions */
 	name = sem->sem_name;
 	KASSERT(!strcmp(name, NAMESTRING));
-	wchan = sem->sem_wchan;
 	KASSERT(spinlock_not_held(&sem->sem_lock));
 	KASSERT(sem->sem_count == 1);
 
@@ -698,7 +690,7 @@ semu18(int nargs, char **args)
 	/* postconditions */
 	KASSERT(name == sem->sem_name);
 	KASSERT(!strcmp(name, NAMESTRING));
-	KASSERT(wchan == sem->sem_wchan);
+	KASSERT(sleepq_isempty(sem));
 	KASSERT(spinlock_not_held(&sem->sem_lock));
 	KASSERT(sem->sem_count == 0);
 
@@ -709,7 +701,7 @@ semu18(int nargs, char **args)
  * 19. After calling P on a semaphore with count == 0 and another
  * thread uses V exactly once to cause a wakeup:
  *    - sem_name is unchanged
- *    - sem_wchan is unchanged
+ *    - nothing is asleep on it
  *    - sem_lock is unheld and has no owner
  *    - sem_count is still 0
  */
@@ -736,7 +728,6 @@ int
 semu19(int nargs, char **args)
 {
 	struct semaphore *sem;
-	struct wchan *wchan;
 	const char *name;
 	int result;
 
@@ -751,7 +742,6 @@ semu19(int nargs, char **args)
 	/* preconditions */
 	name = sem->sem_name;
 	KASSERT(!strcmp(name, NAMESTRING));
-	wchan = sem->sem_wchan;
 	KASSERT(spinlock_not_held(&sem->sem_lock));
 	KASSERT(sem->sem_count == 0);
 
@@ -760,7 +750,7 @@ semu19(int nargs, char **args)
 	/* postconditions */
 	KASSERT(name == sem->sem_name);
 	KASSERT(!strcmp(name, NAMESTRING));
-	KASSERT(wchan == sem->sem_wchan);
+	KASSERT(sleepq_isempty(sem));
 	KASSERT(spinlock_not_held(&sem->sem_lock));
 	KASSERT(sem->sem_count == 0);
 
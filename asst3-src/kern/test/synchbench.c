@@ -0,0 +1,695 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Synchronization benchmarks.
+ *
+ * Each benchmark runs one operation in a tight loop in a number of
+ * threads for a fixed time, and reports how many operations per
+ * second got done in total and the average time one operation took
+ * in one thread. Thread N is pinned to cpu N mod ncpus, so runs with
+ * no more threads than cpus have one thread per cpu. It also reports
+ * the fewest and most operations any one thread got done, as a
+ * percentage of the average, which shows how fair the primitive is
+ * when it's contended.
+ *
+ * "sbs" compares the two kinds of spinlock side by side. "sb" runs
+ * any of the benchmarks in the table at the bottom, at 1, 2, 4, ...
+ * threads; the one-thread row is the uncontended cost, and for the
+ * "private" benchmarks, where each thread has its own object, every
+ * row is uncontended and shows how well the primitive scales when
+ * nobody shares.
+ */
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <wchan.h>
+#include <synch.h>
+#include <spinlock.h>
+#include <membar.h>
+#include <atomic.h>
+#include <test.h>
+
+#define SB_SECONDS	1	/* how long each run goes for */
+#define SB_MAXTHREADS	32
+
+/*
+ * The operation under test; num is the thread's number. Returns
+ * false if it didn't get done because the run stopped.
+ */
+typedef bool (*sb_opfn)(unsigned long num);
+
+/* Results of one run. */
+struct sb_result {
+	uint64_t sr_opspersec;	/* total throughput */
+	uint64_t sr_nsperop;	/* time per operation per thread */
+	unsigned sr_minpct;	/* slowest thread, % of average */
+	unsigned sr_maxpct;	/* fastest thread, % of average */
+};
+
+static sb_opfn sb_op;
+static unsigned sb_nthreads;
+static volatile uint32_t sb_ready;
+static volatile bool sb_go;
+static volatile bool sb_stop;
+static uint64_t sb_ops[SB_MAXTHREADS];
+static struct semaphore *sb_done;
+
+/*
+ * Shared counter bumped inside critical sections, so a run can check
+ * afterwards that the lock under test actually excluded anyone.
+ */
+static volatile uint64_t sb_shared;
+
+static
+void
+sb_thread(void *junk, unsigned long num)
+{
+	uint64_t ops;
+	int result;
+
+	(void)junk;
+
+	result = thread_setaffinity(
+		(uint32_t)1 << cpu_get(num % cpu_count())->c_number);
+	KASSERT(result == 0);
+
+	atomic_fetchadd32(&sb_ready, 1);
+	while (!sb_go) {
+		thread_yield();
+	}
+	membar_load_load();
+
+	ops = 0;
+	while (!sb_stop) {
+		if (sb_op(num)) {
+			ops++;
+		}
+	}
+	sb_ops[num] = ops;
+	V(sb_done);
+}
+
+/*
+ * Run OP in NTHREADS threads for SB_SECONDS and fill in RES. If
+ * threads might be asleep waiting for each other when the run stops,
+ * WAKE gets called after sb_stop is set to get them going again.
+ */
+static
+void
+sb_run(sb_opfn op, void (*wake)(void), unsigned nthreads,
+       struct sb_result *res)
+{
+	struct timespec start, end;
+	uint64_t ns, total, mean, min, max;
+	unsigned i;
+	int result;
+
+	KASSERT(nthreads > 0 && nthreads <= SB_MAXTHREADS);
+
+	sb_op = op;
+	sb_nthreads = nthreads;
+	sb_ready = 0;
+	sb_go = false;
+	sb_stop = false;
+	sb_shared = 0;
+	membar_store_store();
+
+	for (i=0; i<nthreads; i++) {
+		sb_ops[i] = 0;
+		result = thread_fork("synchbench", NULL, sb_thread, NULL, i);
+		if (result) {
+			panic("synchbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	while (sb_ready < nthreads) {
+		thread_yield();
+	}
+
+	gettime(&start);
+	sb_go = true;
+	clocksleep(SB_SECONDS);
+	sb_stop = true;
+	membar_store_any();
+	if (wake != NULL) {
+		wake();
+	}
+	for (i=0; i<nthreads; i++) {
+		P(sb_done);
+	}
+	gettime(&end);
+
+	timespec_sub(&end, &start, &end);
+	ns = end.tv_sec * 1000000000ULL + end.tv_nsec;
+	total = 0;
+	min = max = sb_ops[0];
+	for (i=0; i<nthreads; i++) {
+		total += sb_ops[i];
+		if (sb_ops[i] < min) {
+			min = sb_ops[i];
+		}
+		if (sb_ops[i] > max) {
+			max = sb_ops[i];
+		}
+	}
+	mean = total / nthreads;
+	if (mean == 0) {
+		mean = 1;
+	}
+
+	res->sr_opspersec = ns > 0 ? total * 1000000000ULL / ns : 0;
+	res->sr_nsperop = total > 0 ? ns * nthreads / total : 0;
+	res->sr_minpct = min * 100 / mean;
+	res->sr_maxpct = max * 100 / mean;
+}
+
+/*
+ * Check that every operation of the last run made it into sb_shared.
+ */
+static
+bool
+sb_check(unsigned nthreads, const char *what)
+{
+	uint64_t total;
+	unsigned i;
+
+	total = 0;
+	for (i=0; i<nthreads; i++) {
+		total += sb_ops[i];
+	}
+	if (sb_shared != total) {
+		kprintf("synchbench: %s: lost updates: %llu of %llu\n",
+			what, (unsigned long long)(total - sb_shared),
+			(unsigned long long)total);
+		return false;
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////
+// spinlocks
+
+static struct spinlock sb_splk;
+static struct spinlock sb_splks[SB_MAXTHREADS];
+
+static
+bool
+sb_spinlock_op(unsigned long num)
+{
+	(void)num;
+
+	spinlock_acquire(&sb_splk);
+	sb_shared++;
+	spinlock_release(&sb_splk);
+	return true;
+}
+
+static
+bool
+sb_spinlock_private_op(unsigned long num)
+{
+	spinlock_acquire(&sb_splks[num]);
+	spinlock_release(&sb_splks[num]);
+	return true;
+}
+
+static
+void
+sb_tas_setup(unsigned n)
+{
+	unsigned i;
+
+	spinlock_init(&sb_splk);
+	for (i=0; i<n; i++) {
+		spinlock_init(&sb_splks[i]);
+	}
+}
+
+static
+void
+sb_ticket_setup(unsigned n)
+{
+	unsigned i;
+
+	spinlock_init_ticket(&sb_splk);
+	for (i=0; i<n; i++) {
+		spinlock_init_ticket(&sb_splks[i]);
+	}
+}
+
+static
+void
+sb_spinlock_cleanup(unsigned n)
+{
+	unsigned i;
+
+	spinlock_cleanup(&sb_splk);
+	for (i=0; i<n; i++) {
+		spinlock_cleanup(&sb_splks[i]);
+	}
+}
+
+/*
+ * Spinlock contention: every cpu takes the same lock over and over,
+ * with test-and-set and then with ticket locks, for 1 up to all the
+ * cpus.
+ */
+int
+spinbench(int nargs, char **args)
+{
+	struct sb_result tas, ticket;
+	unsigned ncpus, n;
+	bool ok;
+
+	(void)nargs;
+	(void)args;
+
+	sb_done = sem_create("synchbench", 0);
+	if (sb_done == NULL) {
+		panic("spinbench: sem_create failed\n");
+	}
+	ncpus = cpu_count();
+	if (ncpus > SB_MAXTHREADS) {
+		ncpus = SB_MAXTHREADS;
+	}
+	ok = true;
+
+	kprintf("Spinlock contention, %d second(s) per run\n", SB_SECONDS);
+	kprintf("             test-and-set                ticket\n");
+	kprintf("cpus       ops/sec  min%%  max%%       ops/sec  min%%  max%%\n");
+	for (n=1; n<=ncpus; n++) {
+		sb_tas_setup(0);
+		sb_run(sb_spinlock_op, NULL, n, &tas);
+		ok = sb_check(n, "test-and-set") && ok;
+		sb_spinlock_cleanup(0);
+
+		sb_ticket_setup(0);
+		sb_run(sb_spinlock_op, NULL, n, &ticket);
+		ok = sb_check(n, "ticket") && ok;
+		sb_spinlock_cleanup(0);
+
+		kprintf("%4u  %12llu  %4u  %4u  %12llu  %4u  %4u\n", n,
+			(unsigned long long)tas.sr_opspersec,
+			tas.sr_minpct, tas.sr_maxpct,
+			(unsigned long long)ticket.sr_opspersec,
+			ticket.sr_minpct, ticket.sr_maxpct);
+	}
+
+	sem_destroy(sb_done);
+	kprintf("Spinlock benchmark %s.\n", ok ? "done" : "FAILED");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// sleep locks and semaphores
+
+static struct lock *sb_locks[SB_MAXTHREADS];
+static struct semaphore *sb_sems[SB_MAXTHREADS];
+
+static
+bool
+sb_lock_op(unsigned long num)
+{
+	(void)num;
+
+	lock_acquire(sb_locks[0]);
+	sb_shared++;
+	lock_release(sb_locks[0]);
+	return true;
+}
+
+static
+bool
+sb_lock_private_op(unsigned long num)
+{
+	lock_acquire(sb_locks[num]);
+	lock_release(sb_locks[num]);
+	return true;
+}
+
+static
+void
+sb_lock_setup(unsigned n)
+{
+	unsigned i;
+
+	for (i=0; i<n; i++) {
+		sb_locks[i] = lock_create("synchbench");
+		if (sb_locks[i] == NULL) {
+			panic("synchbench: lock_create failed\n");
+		}
+	}
+}
+
+static
+void
+sb_lock_cleanup(unsigned n)
+{
+	unsigned i;
+
+	for (i=0; i<n; i++) {
+		lock_destroy(sb_locks[i]);
+	}
+}
+
+/* Semaphores are used as mutexes: P, touch, V. */
+static
+bool
+sb_sem_op(unsigned long num)
+{
+	(void)num;
+
+	P(sb_sems[0]);
+	sb_shared++;
+	V(sb_sems[0]);
+	return true;
+}
+
+static
+bool
+sb_sem_private_op(unsigned long num)
+{
+	P(sb_sems[num]);
+	V(sb_sems[num]);
+	return true;
+}
+
+static
+void
+sb_sem_setup(unsigned n)
+{
+	unsigned i;
+
+	for (i=0; i<n; i++) {
+		sb_sems[i] = sem_create("synchbench", 1);
+		if (sb_sems[i] == NULL) {
+			panic("synchbench: sem_create failed\n");
+		}
+	}
+}
+
+static
+void
+sb_sem_cleanup(unsigned n)
+{
+	unsigned i;
+
+	for (i=0; i<n; i++) {
+		sem_destroy(sb_sems[i]);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// handoffs
+
+/*
+ * The CV and wchan benchmarks pass a turn around the threads in a
+ * ring: each waits until sb_turn is its number, then hands it to the
+ * next and wakes everyone. One operation is one handoff, so this
+ * measures the sleep and wakeup paths; with one thread it never
+ * sleeps and measures the cost of a wakeup with nobody waiting.
+ */
+static volatile unsigned sb_turn;
+static struct lock *sb_cvlock;
+static struct cv *sb_cv;
+static struct spinlock sb_wclock;
+static struct wchan *sb_wc;
+
+static
+bool
+sb_cv_op(unsigned long num)
+{
+	bool done;
+
+	lock_acquire(sb_cvlock);
+	while (sb_turn != num && !sb_stop) {
+		cv_wait(sb_cv, sb_cvlock);
+	}
+	done = (sb_turn == num);
+	if (done) {
+		sb_turn = (num + 1) % sb_nthreads;
+		sb_shared++;
+	}
+	cv_broadcast(sb_cv, sb_cvlock);
+	lock_release(sb_cvlock);
+	return done;
+}
+
+static
+void
+sb_cv_wake(void)
+{
+	lock_acquire(sb_cvlock);
+	cv_broadcast(sb_cv, sb_cvlock);
+	lock_release(sb_cvlock);
+}
+
+static
+void
+sb_cv_setup(unsigned n)
+{
+	(void)n;
+
+	sb_turn = 0;
+	sb_cvlock = lock_create("synchbench");
+	sb_cv = cv_create("synchbench");
+	if (sb_cvlock == NULL || sb_cv == NULL) {
+		panic("synchbench: out of memory\n");
+	}
+}
+
+static
+void
+sb_cv_cleanup(unsigned n)
+{
+	(void)n;
+
+	cv_destroy(sb_cv);
+	lock_destroy(sb_cvlock);
+}
+
+static
+bool
+sb_wchan_op(unsigned long num)
+{
+	bool done;
+
+	spinlock_acquire(&sb_wclock);
+	while (sb_turn != num && !sb_stop) {
+		wchan_sleep(sb_wc, &sb_wclock);
+	}
+	done = (sb_turn == num);
+	if (done) {
+		sb_turn = (num + 1) % sb_nthreads;
+		sb_shared++;
+	}
+	wchan_wakeall(sb_wc, &sb_wclock);
+	spinlock_release(&sb_wclock);
+	return done;
+}
+
+static
+void
+sb_wchan_wake(void)
+{
+	spinlock_acquire(&sb_wclock);
+	wchan_wakeall(sb_wc, &sb_wclock);
+	spinlock_release(&sb_wclock);
+}
+
+static
+void
+sb_wchan_setup(unsigned n)
+{
+	(void)n;
+
+	sb_turn = 0;
+	spinlock_init(&sb_wclock);
+	sb_wc = wchan_create("synchbench");
+	if (sb_wc == NULL) {
+		panic("synchbench: wchan_create failed\n");
+	}
+}
+
+static
+void
+sb_wchan_cleanup(unsigned n)
+{
+	(void)n;
+
+	wchan_destroy(sb_wc);
+	spinlock_cleanup(&sb_wclock);
+}
+
+////////////////////////////////////////////////////////////
+// benchmark table
+
+static const struct {
+	const char *name;
+	const char *desc;
+	sb_opfn op;
+	void (*wake)(void);
+	void (*setup)(unsigned n);
+	void (*cleanup)(unsigned n);
+	bool check;	/* op updates sb_shared under the lock */
+} sb_benches[] = {
+	{ "tas", "Test-and-set spinlock, shared",
+	  sb_spinlock_op, NULL, sb_tas_setup, sb_spinlock_cleanup, true },
+	{ "tasp", "Test-and-set spinlock, one per thread",
+	  sb_spinlock_private_op, NULL, sb_tas_setup, sb_spinlock_cleanup,
+	  false },
+	{ "ticket", "Ticket spinlock, shared",
+	  sb_spinlock_op, NULL, sb_ticket_setup, sb_spinlock_cleanup, true },
+	{ "ticketp", "Ticket spinlock, one per thread",
+	  sb_spinlock_private_op, NULL, sb_ticket_setup, sb_spinlock_cleanup,
+	  false },
+	{ "lock", "Lock, shared",
+	  sb_lock_op, NULL, sb_lock_setup, sb_lock_cleanup, true },
+	{ "lockp", "Lock, one per thread",
+	  sb_lock_private_op, NULL, sb_lock_setup, sb_lock_cleanup, false },
+	{ "sem", "Semaphore as mutex, shared",
+	  sb_sem_op, NULL, sb_sem_setup, sb_sem_cleanup, true },
+	{ "semp", "Semaphore as mutex, one per thread",
+	  sb_sem_private_op, NULL, sb_sem_setup, sb_sem_cleanup, false },
+	{ "cv", "CV handoff ring",
+	  sb_cv_op, sb_cv_wake, sb_cv_setup, sb_cv_cleanup, true },
+	{ "wchan", "Wait channel handoff ring",
+	  sb_wchan_op, sb_wchan_wake, sb_wchan_setup, sb_wchan_cleanup, true },
+};
+static const unsigned sb_numbenches =
+	sizeof(sb_benches) / sizeof(sb_benches[0]);
+
+/*
+ * Run benchmark number B at 1, 2, 4, ... threads up to MAXTHREADS
+ * (and at MAXTHREADS itself) and print a table.
+ */
+static
+bool
+sb_table(unsigned b, unsigned maxthreads)
+{
+	struct sb_result res;
+	unsigned n, ncpus;
+	bool ok;
+
+	ncpus = cpu_count();
+	ok = true;
+
+	kprintf("%s: %s\n", sb_benches[b].name, sb_benches[b].desc);
+	kprintf("threads  cpus       ops/sec     ns/op  min%%  max%%\n");
+	n = 1;
+	while (1) {
+		sb_benches[b].setup(n);
+		sb_run(sb_benches[b].op, sb_benches[b].wake, n, &res);
+		if (sb_benches[b].check) {
+			ok = sb_check(n, sb_benches[b].name) && ok;
+		}
+		sb_benches[b].cleanup(n);
+
+		kprintf("%7u  %4u  %12llu  %8llu  %4u  %4u\n",
+			n, n < ncpus ? n : ncpus,
+			(unsigned long long)res.sr_opspersec,
+			(unsigned long long)res.sr_nsperop,
+			res.sr_minpct, res.sr_maxpct);
+
+		if (n == maxthreads) {
+			break;
+		}
+		n = n * 2 > maxthreads ? maxthreads : n * 2;
+	}
+	kprintf("\n");
+	return ok;
+}
+
+static
+void
+sb_usage(void)
+{
+	unsigned i;
+
+	kprintf("Usage: sb all|<benchmark> [maxthreads]\n");
+	kprintf("maxthreads defaults to the number of cpus (max %u)\n",
+		SB_MAXTHREADS);
+	for (i=0; i<sb_numbenches; i++) {
+		kprintf("   %-8s %s\n", sb_benches[i].name, sb_benches[i].desc);
+	}
+}
+
+/*
+ * The "sb" menu command.
+ */
+int
+synchbench(int nargs, char **args)
+{
+	unsigned i, maxthreads;
+	bool all, found, ok;
+
+	if (nargs < 2 || nargs > 3) {
+		sb_usage();
+		return 0;
+	}
+	maxthreads = cpu_count();
+	if (nargs == 3) {
+		maxthreads = atoi(args[2]);
+		if (maxthreads == 0) {
+			sb_usage();
+			return 0;
+		}
+	}
+	if (maxthreads > SB_MAXTHREADS) {
+		maxthreads = SB_MAXTHREADS;
+	}
+	all = !strcmp(args[1], "all");
+
+	sb_done = sem_create("synchbench", 0);
+	if (sb_done == NULL) {
+		panic("synchbench: sem_create failed\n");
+	}
+
+	kprintf("%d second(s) per run, %u cpus\n\n", SB_SECONDS,
+		cpu_count());
+	found = false;
+	ok = true;
+	for (i=0; i<sb_numbenches; i++) {
+		if (all || !strcmp(args[1], sb_benches[i].name)) {
+			found = true;
+			ok = sb_table(i, maxthreads) && ok;
+		}
+	}
+
+	sem_destroy(sb_done);
+	if (!found) {
+		sb_usage();
+		return 0;
+	}
+	kprintf("Synchronization benchmarks %s.\n", ok ? "done" : "FAILED");
+	return 0;
+}
@@ -32,6 +32,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <kern/wait.h>
 #include <lib.h>
 #include <clock.h>
@@ -400,3 +401,336 @@ cvtest2(int nargs, char **args)
 	kprintf("cvtest2 done\n");
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Timed waits. Check that each kind of wait gives up after about the
+ * right amount of time when nothing happens, and doesn't when
+ * something does.
+ */
+
+#define TIMEDTICKS 5
+
+static struct semaphore *timedsem;
+static struct lock *timedlock;
+static struct cv *timedcv;
+
+/*
+ * Check that a timed-out wait took at least (roughly) TIMEDTICKS.
+ * The first hardclock may come at any point, so allow one short.
+ */
+static
+bool
+timedcheck(const char *what, int result, const struct timespec *start)
+{
+	struct timespec now, diff;
+	uint64_t nsecs;
+
+	gettime(&now);
+	timespec_sub(&now, start, &diff);
+	nsecs = diff.tv_sec * 1000000000ULL + diff.tv_nsec;
+
+	if (result != ETIMEDOUT) {
+		kprintf("timedtest: %s: expected timeout, got %s\n",
+			what, strerror(result));
+		return false;
+	}
+	if (nsecs < (TIMEDTICKS - 1) * (1000000000ULL / HZ)) {
+		kprintf("timedtest: %s: timed out after only %llu ns\n",
+			what, nsecs);
+		return false;
+	}
+	return true;
+}
+
+static
+void
+timedholder(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	lock_acquire(timedlock);
+	V(donesem);
+	P(timedsem);
+	lock_release(timedlock);
+	V(donesem);
+}
+
+static
+void
+timedwaker(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	V(timedsem);
+}
+
+/*
+ * Signal the cv, then hang onto the lock until well past the
+ * waiter's timeout (there's nothing to V timedsem, so P_timeout
+ * serves as a sleep).
+ */
+static
+void
+timedsignaller(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	lock_acquire(timedlock);
+	cv_signal(timedcv, timedlock);
+	P_timeout(timedsem, TIMEDTICKS * 2);
+	lock_release(timedlock);
+	V(donesem);
+}
+
+int
+timedtest(int nargs, char **args)
+{
+	struct timespec start;
+	int result, failures;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	timedsem = sem_create("timedsem", 0);
+	timedlock = lock_create("timedlock");
+	timedcv = cv_create("timedcv");
+	if (timedsem == NULL || timedlock == NULL || timedcv == NULL) {
+		panic("timedtest: out of memory\n");
+	}
+	failures = 0;
+
+	kprintf("Starting timed wait test...\n");
+
+	/* Semaphore: poll, time out, then get woken. */
+	if (P_timeout(timedsem, 0) != ETIMEDOUT) {
+		kprintf("timedtest: P_timeout poll succeeded on 0\n");
+		failures++;
+	}
+	gettime(&start);
+	result = P_timeout(timedsem, TIMEDTICKS);
+	if (!timedcheck("P_timeout", result, &start)) {
+		failures++;
+	}
+	result = thread_fork("timedtest", NULL, timedwaker, NULL, 0);
+	if (result) {
+		panic("timedtest: thread_fork failed: %s\n", strerror(result));
+	}
+	result = P_timeout(timedsem, HZ * 10);
+	if (result) {
+		kprintf("timedtest: P_timeout with V: %s\n", strerror(result));
+		failures++;
+	}
+
+	/* CV: nobody signals. */
+	lock_acquire(timedlock);
+	gettime(&start);
+	result = cv_wait_timeout(timedcv, timedlock, TIMEDTICKS);
+	if (!timedcheck("cv_wait_timeout", result, &start)) {
+		failures++;
+	}
+	if (!lock_do_i_hold(timedlock)) {
+		kprintf("timedtest: cv_wait_timeout lost the lock\n");
+		failures++;
+	}
+	lock_release(timedlock);
+
+	/*
+	 * CV: signalled before the timeout, and the signaller then holds
+	 * the lock until after it. Whenever the timeout goes off, it's
+	 * too late to count.
+	 */
+	lock_acquire(timedlock);
+	result = thread_fork("timedtest", NULL, timedsignaller, NULL, 0);
+	if (result) {
+		panic("timedtest: thread_fork failed: %s\n", strerror(result));
+	}
+	result = cv_wait_timeout(timedcv, timedlock, TIMEDTICKS);
+	if (result) {
+		kprintf("timedtest: cv_wait_timeout signalled: %s\n",
+			strerror(result));
+		failures++;
+	}
+	lock_release(timedlock);
+	P(donesem);
+
+	/* Lock: held by someone else, then released. */
+	result = thread_fork("timedtest", NULL, timedholder, NULL, 0);
+	if (result) {
+		panic("timedtest: thread_fork failed: %s\n", strerror(result));
+	}
+	P(donesem);
+	gettime(&start);
+	result = lock_acquire_timeout(timedlock, TIMEDTICKS);
+	if (!timedcheck("lock_acquire_timeout", result, &start)) {
+		failures++;
+	}
+	V(timedsem);
+	result = lock_acquire_timeout(timedlock, HZ * 10);
+	if (result) {
+		kprintf("timedtest: lock_acquire_timeout after release: %s\n",
+			strerror(result));
+		failures++;
+	}
+	else {
+		lock_release(timedlock);
+	}
+	P(donesem);
+
+	cv_destroy(timedcv);
+	lock_destroy(timedlock);
+	sem_destroy(timedsem);
+	timedcv = NULL;
+	timedlock = NULL;
+	timedsem = NULL;
+
+	if (failures) {
+		kprintf("Timed wait test FAILED\n");
+		return 0;
+	}
+	kprintf("Timed wait test done.\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Reader-writer lock test.
+ *
+ * Writers scribble consistent values into testval1-3 as in the lock
+ * test; readers check that they see them consistent. Both keep count
+ * of who's inside (under a spinlock) to check that writers are
+ * alone, and we report the most readers seen inside at once.
+ */
+
+#define NRWLOOPS	60
+#define RWWRITERS	4
+
+static struct rwlock *testrw;
+static struct spinlock rwcount_lock;
+static unsigned rw_nreaders, rw_nwriters, rw_maxreaders;
+static volatile bool rw_failed;
+
+static
+void
+rwfail(unsigned long num, const char *msg)
+{
+	kprintf("thread %lu: %s\n", num, msg);
+	rw_failed = true;
+}
+
+static
+void
+rwtestthread(void *junk, unsigned long num)
+{
+	bool writer = (num < RWWRITERS);
+	volatile unsigned j;
+	int i;
+
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		if (writer) {
+			rwlock_acquire_write(testrw);
+		}
+		else {
+			rwlock_acquire_read(testrw);
+		}
+
+		spinlock_acquire(&rwcount_lock);
+		if (writer) {
+			rw_nwriters++;
+			if (rw_nwriters != 1 || rw_nreaders != 0) {
+				rwfail(num, "writer not alone");
+			}
+		}
+		else {
+			rw_nreaders++;
+			if (rw_nwriters != 0) {
+				rwfail(num, "reader inside with writer");
+			}
+			if (rw_nreaders > rw_maxreaders) {
+				rw_maxreaders = rw_nreaders;
+			}
+		}
+		spinlock_release(&rwcount_lock);
+
+		if (writer) {
+			testval1 = num;
+			testval2 = num*num;
+			testval3 = num%3;
+		}
+		/* Linger a bit so readers can overlap. */
+		for (j=0; j<2000; j++);
+		if (testval2 != testval1*testval1 ||
+		    testval3 != testval1%3) {
+			rwfail(num, "inconsistent testvals");
+		}
+
+		spinlock_acquire(&rwcount_lock);
+		if (writer) {
+			rw_nwriters--;
+		}
+		else {
+			rw_nreaders--;
+		}
+		spinlock_release(&rwcount_lock);
+
+		if (writer) {
+			rwlock_release_write(testrw);
+		}
+		else {
+			rwlock_release_read(testrw);
+		}
+	}
+	V(donesem);
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	testrw = rwlock_create("testrw");
+	if (testrw == NULL) {
+		panic("rwtest: rwlock_create failed\n");
+	}
+	spinlock_init(&rwcount_lock);
+	rw_nreaders = rw_nwriters = rw_maxreaders = 0;
+	rw_failed = false;
+	testval1 = testval2 = testval3 = 0;
+
+	kprintf("Starting rwlock test...\n");
+
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("synchtest", NULL, rwtestthread,
+				     NULL, i);
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+
+	rwlock_destroy(testrw);
+	testrw = NULL;
+	spinlock_cleanup(&rwcount_lock);
+
+	kprintf("Most readers at once: %u\n", rw_maxreaders);
+	if (rw_failed) {
+		kprintf("Test failed\n");
+	}
+	kprintf("Rwlock test done.\n");
+	return 0;
+}
@@ -0,0 +1,406 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Workqueue test code.
+ *
+ * This checks what sets work apart from callouts: work queued on a
+ * cpu is run there, in order, by that cpu's own worker thread; work
+ * functions may sleep; and work_cancel and work_drain cope with the
+ * function being in the middle of running.
+ */
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <clock.h>
+#include <workqueue.h>
+#include <test.h>
+
+#define WQT_PERCPU	4	/* Items queued from each cpu */
+#define WQT_DELAY	20	/* Ticks for the delayed item */
+
+struct wqtest {
+	struct work wt_work;
+	struct cpu *wt_cpu;		/* Cpu it was queued from */
+	struct cpu *wt_rancpu;		/* Cpu it ran on */
+	bool wt_byworker;		/* Ran in wt_rancpu's worker */
+	unsigned wt_runs;		/* Times it ran */
+	unsigned wt_seq;		/* Order among wt_rancpu's items */
+	unsigned wt_when;		/* Hardclock it ran at */
+};
+
+static struct wqtest *wqt_percpu;	/* WQT_PERCPU for each cpu */
+static unsigned *wqt_cpuseq;		/* Next wt_seq, for each cpu */
+static struct wqtest wqt_blocker, wqt_slow, wqt_delayed, wqt_cancelled;
+static struct semaphore *wqt_done;	/* Each run of wqt_run */
+static struct semaphore *wqt_started;	/* wqt_block/wqt_sleep begun */
+static struct semaphore *wqt_go;	/* Lets wqt_block finish */
+static struct semaphore *wqt_nap;	/* Never V'd; for P_timeout */
+static struct spinlock wqt_lock;
+
+static
+void
+wqt_setup(struct wqtest *wt, void (*func)(void *))
+{
+	wt->wt_cpu = NULL;
+	wt->wt_rancpu = NULL;
+	wt->wt_byworker = false;
+	wt->wt_runs = 0;
+	wt->wt_seq = 0;
+	wt->wt_when = 0;
+	work_init(&wt->wt_work, func, wt);
+}
+
+/*
+ * Note where and when we're running. The worker is pinned to its cpu,
+ * so curcpu can't change under us here.
+ */
+static
+void
+wqt_record(struct wqtest *wt)
+{
+	struct cpu *c = curcpu->c_self;
+
+	spinlock_acquire(&wqt_lock);
+	wt->wt_rancpu = c;
+	wt->wt_byworker = (curthread == c->c_workq.wq_worker);
+	wt->wt_runs++;
+	wt->wt_seq = wqt_cpuseq[c->c_number]++;
+	wt->wt_when = c->c_hardclocks;
+	spinlock_release(&wqt_lock);
+}
+
+static
+void
+wqt_run(void *arg)
+{
+	wqt_record(arg);
+	V(wqt_done);
+}
+
+/*
+ * Blocks until the test lets it go, so the test can poke at it while
+ * it's running.
+ */
+static
+void
+wqt_block(void *arg)
+{
+	V(wqt_started);
+	P(wqt_go);
+	wqt_record(arg);
+}
+
+/*
+ * Sleeps, which a callout couldn't; work_drain has to wait for it.
+ */
+static
+void
+wqt_sleep(void *arg)
+{
+	V(wqt_started);
+	clocksleep(1);
+	wqt_record(arg);
+}
+
+/*
+ * Queue W from whatever cpu we're on, noting which that is.
+ */
+static
+bool
+wqt_queue(struct wqtest *wt)
+{
+	bool ret;
+	int spl;
+
+	spl = splhigh();
+	wt->wt_cpu = curcpu->c_self;
+	ret = work_queue(&wt->wt_work);
+	splx(spl);
+	return ret;
+}
+
+/*
+ * Get onto cpu C and stay there. Changing the affinity only moves us
+ * when we're next switched out, so nap a hardclock at a time until
+ * we've arrived.
+ */
+static
+void
+wqt_moveto(struct cpu *c)
+{
+	int result;
+
+	result = thread_setaffinity((uint32_t)1 << c->c_number);
+	KASSERT(result == 0);
+	while (curcpu->c_self != c) {
+		P_timeout(wqt_nap, 1);
+	}
+}
+
+/*
+ * One of these runs on each cpu and queues that cpu's items.
+ */
+static
+void
+wqt_queuer(void *junk, unsigned long num)
+{
+	unsigned i;
+
+	(void)junk;
+
+	wqt_moveto(cpu_get(num));
+	for (i=0; i<WQT_PERCPU; i++) {
+		if (!wqt_queue(&wqt_percpu[num * WQT_PERCPU + i])) {
+			panic("workqtest: work_queue refused idle work\n");
+		}
+	}
+}
+
+/*
+ * Each cpu's items should run on that cpu, in its worker, in the
+ * order they were queued.
+ */
+static
+int
+wqt_percpu_test(void)
+{
+	struct wqtest *wt;
+	unsigned ncpus, i, j;
+	int result, failures;
+
+	ncpus = cpu_count();
+	wqt_percpu = kmalloc(ncpus * WQT_PERCPU * sizeof(*wqt_percpu));
+	if (wqt_percpu == NULL) {
+		panic("workqtest: Out of memory\n");
+	}
+	for (i=0; i<ncpus * WQT_PERCPU; i++) {
+		wqt_setup(&wqt_percpu[i], wqt_run);
+	}
+
+	for (i=0; i<ncpus; i++) {
+		result = thread_fork("workqtest", NULL, wqt_queuer, NULL, i);
+		if (result) {
+			panic("workqtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<ncpus * WQT_PERCPU; i++) {
+		P(wqt_done);
+	}
+
+	failures = 0;
+	for (i=0; i<ncpus; i++) {
+		for (j=0; j<WQT_PERCPU; j++) {
+			wt = &wqt_percpu[i * WQT_PERCPU + j];
+			KASSERT(wt->wt_cpu == cpu_get(i));
+			if (wt->wt_runs != 1) {
+				kprintf("workqtest: cpu%u item %u ran %u "
+					"times\n", i, j, wt->wt_runs);
+				failures++;
+				continue;
+			}
+			if (wt->wt_rancpu != wt->wt_cpu) {
+				kprintf("workqtest: cpu%u item %u ran on "
+					"cpu%u\n", i, j,
+					wt->wt_rancpu->c_number);
+				failures++;
+			}
+			if (!wt->wt_byworker) {
+				kprintf("workqtest: cpu%u item %u ran "
+					"outside the worker\n", i, j);
+				failures++;
+			}
+			if (wt->wt_seq != j) {
+				kprintf("workqtest: cpu%u item %u ran out "
+					"of order\n", i, j);
+				failures++;
+			}
+		}
+	}
+
+	kfree(wqt_percpu);
+	wqt_percpu = NULL;
+	return failures;
+}
+
+/*
+ * While work is running it's idle as far as the queue is concerned:
+ * cancelling it finds nothing to cancel (and doesn't wait), and it
+ * can be queued again. Call with the thread pinned, so the requeued
+ * work can't start on some other cpu while the first run is blocked.
+ */
+static
+int
+wqt_cancel_test(void)
+{
+	int failures;
+
+	failures = 0;
+	wqt_setup(&wqt_blocker, wqt_block);
+	wqt_queue(&wqt_blocker);
+	P(wqt_started);
+
+	if (work_cancel(&wqt_blocker.wt_work)) {
+		kprintf("workqtest: cancelled work that was running\n");
+		failures++;
+	}
+	if (!wqt_queue(&wqt_blocker)) {
+		kprintf("workqtest: couldn't requeue running work\n");
+		failures++;
+	}
+	else if (!work_cancel(&wqt_blocker.wt_work)) {
+		kprintf("workqtest: requeued work was not pending\n");
+		failures++;
+		/* let the second run through too */
+		V(wqt_go);
+	}
+
+	V(wqt_go);
+	work_drain(&wqt_blocker.wt_work);
+	if (wqt_blocker.wt_runs != 1) {
+		kprintf("workqtest: blocked work ran %u times by the time "
+			"work_drain returned\n", wqt_blocker.wt_runs);
+		failures++;
+	}
+
+	/* work_drain must wait for work that's asleep, too. */
+	wqt_setup(&wqt_slow, wqt_sleep);
+	wqt_queue(&wqt_slow);
+	P(wqt_started);
+	work_drain(&wqt_slow.wt_work);
+	if (wqt_slow.wt_runs != 1) {
+		kprintf("workqtest: work_drain returned before the work "
+			"finished\n");
+		failures++;
+	}
+
+	return failures;
+}
+
+/*
+ * Delayed work runs on the cpu it was queued from, no sooner than
+ * asked; cancelled delayed work never runs. Also pinned.
+ */
+static
+int
+wqt_delay_test(void)
+{
+	unsigned start;
+	int failures;
+
+	failures = 0;
+	wqt_setup(&wqt_delayed, wqt_run);
+	wqt_setup(&wqt_cancelled, wqt_run);
+	wqt_delayed.wt_cpu = wqt_cancelled.wt_cpu = curcpu->c_self;
+
+	start = curcpu->c_hardclocks;
+	if (!work_queue_delayed(&wqt_delayed.wt_work, WQT_DELAY) ||
+	    !work_queue_delayed(&wqt_cancelled.wt_work, WQT_DELAY)) {
+		kprintf("workqtest: work_queue_delayed failed\n");
+		failures++;
+	}
+	if (work_queue(&wqt_delayed.wt_work)) {
+		kprintf("workqtest: requeued delayed work\n");
+		failures++;
+	}
+	if (!work_cancel(&wqt_cancelled.wt_work)) {
+		kprintf("workqtest: delayed work was not pending\n");
+		failures++;
+		P(wqt_done);
+	}
+	P(wqt_done);
+
+	if (wqt_delayed.wt_rancpu != wqt_delayed.wt_cpu ||
+	    !wqt_delayed.wt_byworker) {
+		kprintf("workqtest: delayed work ran in the wrong place\n");
+		failures++;
+	}
+	if (wqt_delayed.wt_when - start < WQT_DELAY) {
+		kprintf("workqtest: delayed work ran early\n");
+		failures++;
+	}
+	if (wqt_cancelled.wt_runs != 0) {
+		kprintf("workqtest: cancelled work ran\n");
+		failures++;
+	}
+	return failures;
+}
+
+int
+workqtest(int nargs, char **args)
+{
+	uint32_t oldaffinity;
+	int failures;
+
+	(void)nargs;
+	(void)args;
+
+	wqt_done = sem_create("workqtest", 0);
+	wqt_started = sem_create("workqtest", 0);
+	wqt_go = sem_create("workqtest", 0);
+	wqt_nap = sem_create("workqtest", 0);
+	wqt_cpuseq = kmalloc(cpu_count() * sizeof(*wqt_cpuseq));
+	if (wqt_done == NULL || wqt_started == NULL || wqt_go == NULL ||
+	    wqt_nap == NULL || wqt_cpuseq == NULL) {
+		panic("workqtest: Out of memory\n");
+	}
+	bzero(wqt_cpuseq, cpu_count() * sizeof(*wqt_cpuseq));
+	spinlock_init(&wqt_lock);
+
+	kprintf("Starting workqueue test...\n");
+
+	failures = wqt_percpu_test();
+
+	oldaffinity = thread_getaffinity();
+	wqt_moveto(curcpu->c_self);
+	failures += wqt_cancel_test();
+	failures += wqt_delay_test();
+	thread_setaffinity(oldaffinity);
+
+	spinlock_cleanup(&wqt_lock);
+	kfree(wqt_cpuseq);
+	wqt_cpuseq = NULL;
+	sem_destroy(wqt_nap);
+	sem_destroy(wqt_go);
+	sem_destroy(wqt_started);
+	sem_destroy(wqt_done);
+
+	if (failures) {
+		kprintf("Workqueue test FAILED\n");
+		return 0;
+	}
+	kprintf("Workqueue test done.\n");
+	return 0;
+}
@@ -0,0 +1,266 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Callouts, on a hierarchical timer wheel.
+ *
+ * Time on each wheel is counted in ticks (cw_now), which advance by
+ * one on every hardclock of the wheel's cpu. A callout due at tick E
+ * is kept at the lowest level whose span covers E - cw_now, in the
+ * slot selected by E's bits for that level. Level 0 slots therefore
+ * only ever hold callouts due at exactly one tick; a higher-level
+ * slot holds everything due within one lap of the level below, and
+ * when level 0 comes around to slot 0 the next slot up is emptied
+ * ("cascaded") back into the lower levels, where each callout now
+ * falls in a narrower slot.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <current.h>
+#include <callout.h>
+
+#define CALLWHEEL_MASK	(CALLWHEEL_SLOTS - 1)
+
+/*
+ * Return the slot list for a callout due at EXPIRE.
+ */
+static
+struct callout **
+callwheel_slot(struct callwheel *cw, unsigned expire)
+{
+	unsigned delta, level, shift;
+
+	delta = expire - cw->cw_now;
+	for (level = 0; level < CALLWHEEL_LEVELS - 1; level++) {
+		if (delta < (1U << (CALLWHEEL_BITS * (level + 1)))) {
+			break;
+		}
+	}
+	shift = CALLWHEEL_BITS * level;
+	return &cw->cw_slots[level][(expire >> shift) & CALLWHEEL_MASK];
+}
+
+/*
+ * Put a callout on a wheel. Wheel must be locked.
+ */
+static
+void
+callwheel_insert(struct callwheel *cw, struct callout *co)
+{
+	struct callout **slot;
+
+	KASSERT(spinlock_do_i_hold(&cw->cw_lock));
+
+	slot = callwheel_slot(cw, co->co_expire);
+	co->co_next = *slot;
+	if (co->co_next != NULL) {
+		co->co_next->co_prevp = &co->co_next;
+	}
+	co->co_prevp = slot;
+	*slot = co;
+	co->co_wheel = cw;
+}
+
+/*
+ * Take a callout off its wheel. Wheel must be locked.
+ */
+static
+void
+callwheel_remove(struct callwheel *cw, struct callout *co)
+{
+	KASSERT(spinlock_do_i_hold(&cw->cw_lock));
+	KASSERT(co->co_wheel == cw);
+
+	*co->co_prevp = co->co_next;
+	if (co->co_next != NULL) {
+		co->co_next->co_prevp = co->co_prevp;
+	}
+	co->co_next = NULL;
+	co->co_prevp = NULL;
+	co->co_wheel = NULL;
+}
+
+/*
+ * Lock the wheel CO is on and return it, or return NULL if CO isn't
+ * on any wheel. Because CO may fire (and so come off its wheel) on
+ * another cpu while we're getting the lock, check again once we
+ * have it.
+ */
+static
+struct callwheel *
+callout_lockwheel(struct callout *co)
+{
+	struct callwheel *cw;
+
+	while (1) {
+		cw = co->co_wheel;
+		if (cw == NULL) {
+			return NULL;
+		}
+		spinlock_acquire(&cw->cw_lock);
+		if (co->co_wheel == cw) {
+			return cw;
+		}
+		spinlock_release(&cw->cw_lock);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// public
+
+void
+callwheel_init(struct callwheel *cw)
+{
+	unsigned i, j;
+
+	spinlock_init(&cw->cw_lock);
+	spinlock_setname(&cw->cw_lock, "callwheel");
+	cw->cw_now = 0;
+	for (i=0; i<CALLWHEEL_LEVELS; i++) {
+		for (j=0; j<CALLWHEEL_SLOTS; j++) {
+			cw->cw_slots[i][j] = NULL;
+		}
+	}
+}
+
+void
+callout_init(struct callout *co, void (*func)(void *), void *arg)
+{
+	co->co_next = NULL;
+	co->co_prevp = NULL;
+	co->co_wheel = NULL;
+	co->co_expire = 0;
+	co->co_func = func;
+	co->co_arg = arg;
+}
+
+void
+callout_schedule(struct callout *co, unsigned ticks)
+{
+	struct callwheel *cw;
+
+	if (ticks == 0) {
+		ticks = 1;
+	}
+	if (ticks > CALLOUT_MAXTICKS) {
+		ticks = CALLOUT_MAXTICKS;
+	}
+
+	/* If it's already pending, pull it off first. */
+	cw = callout_lockwheel(co);
+	if (cw != NULL) {
+		callwheel_remove(cw, co);
+		spinlock_release(&cw->cw_lock);
+	}
+
+	cw = &curcpu->c_callwheel;
+	spinlock_acquire(&cw->cw_lock);
+	co->co_expire = cw->cw_now + ticks;
+	callwheel_insert(cw, co);
+	spinlock_release(&cw->cw_lock);
+}
+
+bool
+callout_stop(struct callout *co)
+{
+	struct callwheel *cw;
+
+	cw = callout_lockwheel(co);
+	if (cw == NULL) {
+		return false;
+	}
+	callwheel_remove(cw, co);
+	spinlock_release(&cw->cw_lock);
+	return true;
+}
+
+bool
+callout_pending(struct callout *co)
+{
+	return co->co_wheel != NULL;
+}
+
+/*
+ * Advance the current cpu's wheel by one tick, cascade if needed, and
+ * run whatever is due.
+ */
+void
+callout_hardclock(void)
+{
+	struct callwheel *cw;
+	struct callout *co, *next, **slot;
+	unsigned level, shift;
+
+	cw = &curcpu->c_callwheel;
+
+	spinlock_acquire(&cw->cw_lock);
+	cw->cw_now++;
+
+	/*
+	 * Cascade. Each time the bits below a level all wrap to zero,
+	 * the current slot of that level is now within reach of the
+	 * levels below it; reinsert its contents there.
+	 */
+	for (level = 1; level < CALLWHEEL_LEVELS; level++) {
+		shift = CALLWHEEL_BITS * level;
+		if ((cw->cw_now & ((1U << shift) - 1)) != 0) {
+			break;
+		}
+		slot = &cw->cw_slots[level][(cw->cw_now >> shift) &
+					    CALLWHEEL_MASK];
+		co = *slot;
+		*slot = NULL;
+		for (; co != NULL; co = next) {
+			next = co->co_next;
+			callwheel_insert(cw, co);
+		}
+	}
+
+	/*
+	 * Run everything in the current level 0 slot. Take them off
+	 * one at a time, and drop the lock to call each one, so the
+	 * functions can use the callout interface (including on
+	 * themselves). Nothing newly scheduled can land in this slot,
+	 * because callout_schedule always asks for at least one tick.
+	 */
+	slot = &cw->cw_slots[0][cw->cw_now & CALLWHEEL_MASK];
+	while ((co = *slot) != NULL) {
+		KASSERT(co->co_expire == cw->cw_now);
+		callwheel_remove(cw, co);
+		spinlock_release(&cw->cw_lock);
+
+		co->co_func(co->co_arg);
+
+		spinlock_acquire(&cw->cw_lock);
+	}
+	spinlock_release(&cw->cw_lock);
+}
@@ -34,13 +34,15 @@
 #include <clock.h>
 #include <thread.h>
 #include <current.h>
+#include <callout.h>
+#include <qsbr.h>
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution than one second.
+ * This is pretty primitive. Callbacks at specific points in the
+ * future are provided by callouts (see callout.c), which run from
+ * hardclock and so have a resolution of one tick (1/HZ seconds).
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -50,7 +52,7 @@
  * Timing constants. These should be tuned along with any work done on
  * the scheduler.
  */
-#define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
+#define SCHEDULE_HARDCLOCKS	50	/* Priority boost every 50 hardclocks. */
 #define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
 
 /*
@@ -59,6 +61,13 @@
 static struct wchan *lbolt;
 static struct spinlock lbolt_lock;
 
+/*
+ * Timed sleeps wait here. Nothing ever wakes this channel; sleepers
+ * are woken by their timeouts.
+ */
+static struct wchan *naptime;
+static struct spinlock naptime_lock;
+
 /*
  * Setup.
  */
@@ -66,10 +75,17 @@ void
 hardclock_bootstrap(void)
 {
 	spinlock_init(&lbolt_lock);
+	spinlock_setname(&lbolt_lock, "lbolt");
 	lbolt = wchan_create("lbolt");
 	if (lbolt == NULL) {
 		panic("Couldn't create lbolt\n");
 	}
+	spinlock_init(&naptime_lock);
+	spinlock_setname(&naptime_lock, "naptime");
+	naptime = wchan_create("naptime");
+	if (naptime == NULL) {
+		panic("Couldn't create naptime\n");
+	}
 }
 
 /*
@@ -103,7 +119,9 @@ hardclock(void)
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
-	thread_yield();
+	qsbr_hardclock();
+	callout_hardclock();
+	thread_timeslice();
 }
 
 /*
@@ -119,3 +137,62 @@ clocksleep(int num_secs)
 	}
 	spinlock_release(&lbolt_lock);
 }
+
+/*
+ * Convert a duration to hardclocks, rounding up.
+ */
+unsigned
+timespec_to_ticks(const struct timespec *ts)
+{
+	const unsigned long nsecs_per_tick = 1000000000UL / HZ;
+	unsigned ticks;
+
+	if (ts->tv_sec < 0) {
+		return 0;
+	}
+	if (ts->tv_sec >= CALLOUT_MAXTICKS / HZ) {
+		return CALLOUT_MAXTICKS;
+	}
+	ticks = ts->tv_sec * HZ;
+	ticks += (ts->tv_nsec + nsecs_per_tick - 1) / nsecs_per_tick;
+	return ticks;
+}
+
+/*
+ * Suspend execution for at least the duration TS, unless interrupted.
+ *
+ * The callout wheel only counts whole hardclocks, and the first one
+ * may come at any point, so check the time of day on waking and go
+ * back to sleep for whatever's left.
+ */
+int
+clocksleep_timespec(const struct timespec *ts)
+{
+	struct timespec now, deadline, left;
+	struct wchan_timeout wt;
+	int result;
+
+	gettime(&now);
+	timespec_add(&now, ts, &deadline);
+
+	result = 0;
+	spinlock_acquire(&naptime_lock);
+	while (result == 0) {
+		gettime(&now);
+		if (now.tv_sec > deadline.tv_sec ||
+		    (now.tv_sec == deadline.tv_sec &&
+		     now.tv_nsec >= deadline.tv_nsec)) {
+			break;
+		}
+		timespec_sub(&deadline, &now, &left);
+
+		wchan_timeout_arm(&wt, naptime, &naptime_lock,
+				  timespec_to_ticks(&left));
+		while (!wchan_timeout_expired(&wt) && result == 0) {
+			result = wchan_sleep_intr(naptime, &naptime_lock);
+		}
+		wchan_timeout_disarm(&wt);
+	}
+	spinlock_release(&naptime_lock);
+	return result;
+}
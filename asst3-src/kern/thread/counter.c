@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Per-cpu counters. See counter.h.
+ *
+ * A cpu's slot for a counter is only changed by that cpu, with
+ * interrupts off, except by counter_init and counter_reset (and by
+ * nobody while the slot is free). Folding a slot into the total
+ * happens under the counter's lock, with interrupts still off, so a
+ * reader holding the lock never sees an amount in both places or in
+ * neither. Slots are 32 bits, so other cpus can read them without
+ * seeing half an update.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <counter.h>
+
+/* Slots in use, one bit each. */
+static struct spinlock counter_slotlock = SPINLOCK_INITIALIZER;
+static uint32_t counter_slots;
+
+void
+counter_init(struct counter *ctr, const char *name)
+{
+	unsigned i, slot;
+
+	COMPILE_ASSERT(COUNTER_MAX <= 32);
+
+	spinlock_acquire(&counter_slotlock);
+	for (slot=0; slot<COUNTER_MAX; slot++) {
+		if ((counter_slots & ((uint32_t)1 << slot)) == 0) {
+			break;
+		}
+	}
+	if (slot == COUNTER_MAX) {
+		panic("counter_init: Out of counter slots for %s\n", name);
+	}
+	counter_slots |= (uint32_t)1 << slot;
+	spinlock_release(&counter_slotlock);
+
+	/* Clear out whatever the last user of the slot left behind. */
+	for (i=0; i<cpu_count(); i++) {
+		cpu_get(i)->c_counters[slot] = 0;
+	}
+
+	ctr->ctr_name = name;
+	ctr->ctr_slot = slot;
+	spinlock_init(&ctr->ctr_lock);
+	spinlock_setname(&ctr->ctr_lock, name);
+	ctr->ctr_total = 0;
+}
+
+void
+counter_cleanup(struct counter *ctr)
+{
+	KASSERT(ctr->ctr_slot < COUNTER_MAX);
+
+	spinlock_cleanup(&ctr->ctr_lock);
+
+	spinlock_acquire(&counter_slotlock);
+	KASSERT(counter_slots & ((uint32_t)1 << ctr->ctr_slot));
+	counter_slots &= ~((uint32_t)1 << ctr->ctr_slot);
+	spinlock_release(&counter_slotlock);
+
+	ctr->ctr_slot = COUNTER_MAX;
+}
+
+void
+counter_add(struct counter *ctr, int32_t amt)
+{
+	volatile int32_t *slot;
+	int64_t val;
+	int spl;
+
+	KASSERT(ctr->ctr_slot < COUNTER_MAX);
+
+	/* Stay on this cpu while we have its slot in hand. */
+	spl = splhigh();
+	slot = &curcpu->c_counters[ctr->ctr_slot];
+	val = (int64_t)*slot + amt;
+	if (val >= COUNTER_BATCH || val <= -COUNTER_BATCH) {
+		spinlock_acquire(&ctr->ctr_lock);
+		ctr->ctr_total += val;
+		*slot = 0;
+		spinlock_release(&ctr->ctr_lock);
+	}
+	else {
+		*slot = val;
+	}
+	splx(spl);
+}
+
+int64_t
+counter_read(struct counter *ctr)
+{
+	int64_t val;
+
+	/* The lock is only so we don't see half of the 64-bit value. */
+	spinlock_acquire(&ctr->ctr_lock);
+	val = ctr->ctr_total;
+	spinlock_release(&ctr->ctr_lock);
+	return val;
+}
+
+int64_t
+counter_read_exact(struct counter *ctr)
+{
+	unsigned i;
+	int64_t val;
+
+	spinlock_acquire(&ctr->ctr_lock);
+	val = ctr->ctr_total;
+	for (i=0; i<cpu_count(); i++) {
+		val += cpu_get(i)->c_counters[ctr->ctr_slot];
+	}
+	spinlock_release(&ctr->ctr_lock);
+	return val;
+}
+
+void
+counter_reset(struct counter *ctr)
+{
+	unsigned i;
+
+	spinlock_acquire(&ctr->ctr_lock);
+	ctr->ctr_total = 0;
+	for (i=0; i<cpu_count(); i++) {
+		cpu_get(i)->c_counters[ctr->ctr_slot] = 0;
+	}
+	spinlock_release(&ctr->ctr_lock);
+}
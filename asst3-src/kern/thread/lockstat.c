@@ -0,0 +1,361 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Lock contention statistics.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <lockstat.h>
+
+/*
+ * All registered locks. The lock protecting the list is never
+ * registered itself (lockstat doesn't count locks that aren't), so
+ * taking it from inside spinlock_init/cleanup doesn't recurse.
+ */
+static struct spinlock lockstat_lock = SPINLOCK_INITIALIZER;
+static struct lockstat *lockstat_list;
+
+/* Set once the clock can be read. */
+static volatile bool lockstat_timing;
+
+/*
+ * Current time in nanoseconds, or 0 if we can't tell yet.
+ */
+static
+uint64_t
+lockstat_now(void)
+{
+	struct timespec ts;
+
+	if (!lockstat_timing) {
+		return 0;
+	}
+	gettime(&ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Start collecting times. Called once devices are up.
+ */
+void
+lockstat_bootstrap(void)
+{
+	lockstat_timing = true;
+}
+
+void
+lockstat_register(struct lockstat *ls, const char *name, bool sleeplock)
+{
+	KASSERT(ls->ls_prevp == NULL);
+
+	ls->ls_name = name;
+	ls->ls_sleeplock = sleeplock;
+	ls->ls_acquires = 0;
+	ls->ls_contended = 0;
+	ls->ls_waitns = 0;
+	ls->ls_maxwaitns = 0;
+	ls->ls_holdns = 0;
+	ls->ls_maxholdns = 0;
+	ls->ls_holdstart = 0;
+
+	spinlock_acquire(&lockstat_lock);
+	ls->ls_next = lockstat_list;
+	if (ls->ls_next != NULL) {
+		ls->ls_next->ls_prevp = &ls->ls_next;
+	}
+	ls->ls_prevp = &lockstat_list;
+	lockstat_list = ls;
+	spinlock_release(&lockstat_lock);
+}
+
+/*
+ * Take a lock off the list when it's destroyed. It's fine to call
+ * this for a lock that was never registered.
+ */
+void
+lockstat_unregister(struct lockstat *ls)
+{
+	if (ls->ls_prevp == NULL) {
+		return;
+	}
+
+	spinlock_acquire(&lockstat_lock);
+	*ls->ls_prevp = ls->ls_next;
+	if (ls->ls_next != NULL) {
+		ls->ls_next->ls_prevp = ls->ls_prevp;
+	}
+	ls->ls_next = NULL;
+	ls->ls_prevp = NULL;
+	spinlock_release(&lockstat_lock);
+}
+
+/*
+ * Note that an acquire found the lock busy. Only the first call for
+ * a given acquire counts.
+ */
+void
+lockstat_contended(struct lockstat_wait *lw)
+{
+	if (!lw->lw_contended) {
+		lw->lw_contended = true;
+		lw->lw_start = lockstat_now();
+	}
+}
+
+/*
+ * Count an acquire. The caller holds the lock.
+ */
+void
+lockstat_acquired(struct lockstat *ls, struct lockstat_wait *lw)
+{
+	uint64_t now, wait;
+
+	if (ls->ls_prevp == NULL) {
+		return;
+	}
+
+	now = lockstat_now();
+	ls->ls_acquires++;
+	if (lw->lw_contended) {
+		ls->ls_contended++;
+		if (now != 0 && lw->lw_start != 0) {
+			wait = now - lw->lw_start;
+			ls->ls_waitns += wait;
+			if (wait > ls->ls_maxwaitns) {
+				ls->ls_maxwaitns = wait;
+			}
+		}
+	}
+	ls->ls_holdstart = now;
+}
+
+/*
+ * Count the hold time. The caller still holds the lock.
+ */
+void
+lockstat_release(struct lockstat *ls)
+{
+	uint64_t now, hold;
+
+	if (ls->ls_prevp == NULL || ls->ls_holdstart == 0) {
+		return;
+	}
+
+	now = lockstat_now();
+	hold = now - ls->ls_holdstart;
+	ls->ls_holdns += hold;
+	if (hold > ls->ls_maxholdns) {
+		ls->ls_maxholdns = hold;
+	}
+	ls->ls_holdstart = 0;
+}
+
+////////////////////////////////////////////////////////////
+// report
+
+/* Longest lock name shown; longer ones are truncated. */
+#define LOCKSTAT_NAMELEN	24
+
+/*
+ * Counters for one lock, and after merging, summed over all the
+ * locks of one name and kind.
+ */
+struct lockstat_row {
+	char lr_name[LOCKSTAT_NAMELEN + 1];
+	bool lr_sleeplock;
+	unsigned lr_nlocks;
+	uint64_t lr_acquires;
+	uint64_t lr_contended;
+	uint64_t lr_waitns;
+	uint64_t lr_maxwaitns;
+	uint64_t lr_holdns;
+	uint64_t lr_maxholdns;
+};
+
+/*
+ * Copy one lock's counters into a row. The name has to be copied
+ * too, since it belongs to the lock and may go away with it.
+ */
+static
+void
+lockstat_copy(struct lockstat_row *r, const struct lockstat *ls)
+{
+	unsigned i;
+
+	for (i=0; i<LOCKSTAT_NAMELEN && ls->ls_name[i] != 0; i++) {
+		r->lr_name[i] = ls->ls_name[i];
+	}
+	r->lr_name[i] = 0;
+	r->lr_sleeplock = ls->ls_sleeplock;
+	r->lr_nlocks = 1;
+	r->lr_acquires = ls->ls_acquires;
+	r->lr_contended = ls->ls_contended;
+	r->lr_waitns = ls->ls_waitns;
+	r->lr_maxwaitns = ls->ls_maxwaitns;
+	r->lr_holdns = ls->ls_holdns;
+	r->lr_maxholdns = ls->ls_maxholdns;
+}
+
+/*
+ * Fold row B into row A.
+ */
+static
+void
+lockstat_fold(struct lockstat_row *a, const struct lockstat_row *b)
+{
+	a->lr_nlocks += b->lr_nlocks;
+	a->lr_acquires += b->lr_acquires;
+	a->lr_contended += b->lr_contended;
+	a->lr_waitns += b->lr_waitns;
+	if (b->lr_maxwaitns > a->lr_maxwaitns) {
+		a->lr_maxwaitns = b->lr_maxwaitns;
+	}
+	a->lr_holdns += b->lr_holdns;
+	if (b->lr_maxholdns > a->lr_maxholdns) {
+		a->lr_maxholdns = b->lr_maxholdns;
+	}
+}
+
+/*
+ * Order rows by total wait time, then by contended acquires, then
+ * by acquires.
+ */
+static
+bool
+lockstat_before(const struct lockstat_row *a, const struct lockstat_row *b)
+{
+	if (a->lr_waitns != b->lr_waitns) {
+		return a->lr_waitns > b->lr_waitns;
+	}
+	if (a->lr_contended != b->lr_contended) {
+		return a->lr_contended > b->lr_contended;
+	}
+	return a->lr_acquires > b->lr_acquires;
+}
+
+void
+lockstat_report(bool reset)
+{
+	struct lockstat *ls;
+	struct lockstat_row *rows, tmp;
+	unsigned num, nrows, i, j;
+
+	/*
+	 * Count the locks, allocate, and copy the counters out, so we
+	 * don't hold lockstat_lock for long. If more locks turn up in
+	 * between, they just miss this report.
+	 */
+	spinlock_acquire(&lockstat_lock);
+	num = 0;
+	for (ls = lockstat_list; ls != NULL; ls = ls->ls_next) {
+		num++;
+	}
+	spinlock_release(&lockstat_lock);
+
+	if (num == 0) {
+		kprintf("lockstat: no locks registered\n");
+		return;
+	}
+
+	rows = kmalloc(num * sizeof(*rows));
+	if (rows == NULL) {
+		kprintf("lockstat: out of memory\n");
+		return;
+	}
+
+	spinlock_acquire(&lockstat_lock);
+	nrows = 0;
+	for (ls = lockstat_list; ls != NULL && nrows < num;
+	     ls = ls->ls_next) {
+		lockstat_copy(&rows[nrows++], ls);
+		if (reset) {
+			ls->ls_acquires = 0;
+			ls->ls_contended = 0;
+			ls->ls_waitns = 0;
+			ls->ls_maxwaitns = 0;
+			ls->ls_holdns = 0;
+			ls->ls_maxholdns = 0;
+		}
+	}
+	spinlock_release(&lockstat_lock);
+
+	/* Merge rows with the same name and kind. */
+	num = nrows;
+	nrows = 0;
+	for (i=0; i<num; i++) {
+		for (j=0; j<nrows; j++) {
+			if (rows[j].lr_sleeplock == rows[i].lr_sleeplock &&
+			    !strcmp(rows[j].lr_name, rows[i].lr_name)) {
+				break;
+			}
+		}
+		if (j < nrows) {
+			lockstat_fold(&rows[j], &rows[i]);
+		}
+		else {
+			rows[nrows++] = rows[i];
+		}
+	}
+
+	/* Insertion sort; there aren't that many. */
+	for (i=1; i<nrows; i++) {
+		tmp = rows[i];
+		for (j=i; j>0 && lockstat_before(&tmp, &rows[j-1]); j--) {
+			rows[j] = rows[j-1];
+		}
+		rows[j] = tmp;
+	}
+
+	/* The name column is LOCKSTAT_NAMELEN wide; kprintf has no %*s. */
+	kprintf("%-24s %5s %5s %10s %10s %10s %8s %10s %8s\n",
+		"name", "kind", "locks", "acquires",
+		"contended", "wait(us)", "max", "hold(us)", "max");
+	for (i=0; i<nrows; i++) {
+		kprintf("%-24s %5s %5u %10llu %10llu %10llu %8llu %10llu "
+			"%8llu\n",
+			rows[i].lr_name,
+			rows[i].lr_sleeplock ? "sleep" : "spin",
+			rows[i].lr_nlocks,
+			rows[i].lr_acquires,
+			rows[i].lr_contended,
+			rows[i].lr_waitns / 1000,
+			rows[i].lr_maxwaitns / 1000,
+			rows[i].lr_holdns / 1000,
+			rows[i].lr_maxholdns / 1000);
+	}
+	if (reset) {
+		kprintf("lockstat: counters reset\n");
+	}
+
+	kfree(rows);
+}
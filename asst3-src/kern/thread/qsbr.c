@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Quiescent-state-based reclamation.
+ *
+ * Each cpu counts its quiescent states in c_qsbr_count. Deferred
+ * calls collect on qsbr_next. When some are waiting and no grace
+ * period is running, the next hardclock on any cpu starts one: it
+ * moves the waiting calls to qsbr_current and snapshots every cpu's
+ * count. Later hardclocks check the counts. The grace period is over
+ * once every cpu has either counted a quiescent state since the
+ * snapshot or is idle. The calls then move to qsbr_done, and a work
+ * item runs them in thread context.
+ *
+ * Lock order: qsbr_lock, then the workqueue lock.
+ */
+
+/* Make sure to build out-of-line versions of inline functions */
+#define QSBR_INLINE	/* empty */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <workqueue.h>
+#include <qsbr.h>
+
+static struct spinlock qsbr_lock = SPINLOCK_INITIALIZER;
+static struct qsbr_cb *qsbr_next;	/* Waiting for a grace period */
+static struct qsbr_cb *qsbr_current;	/* Waiting for this grace period */
+static struct qsbr_cb *qsbr_done;	/* Ready to call */
+static bool qsbr_active;		/* Grace period in progress */
+static unsigned *qsbr_snap;		/* Counts when it started, by cpu */
+static unsigned qsbr_numcpus;
+static struct work qsbr_work;		/* Runs qsbr_done */
+static volatile bool qsbr_started;
+
+/*
+ * Push a chain of calls onto a list.
+ */
+static
+void
+qsbr_splice(struct qsbr_cb **list, struct qsbr_cb *chain)
+{
+	struct qsbr_cb *qc, *next;
+
+	for (qc = chain; qc != NULL; qc = next) {
+		next = qc->qc_next;
+		qc->qc_next = *list;
+		*list = qc;
+	}
+}
+
+/*
+ * Work function: make the calls whose grace period is over.
+ */
+static
+void
+qsbr_run(void *arg)
+{
+	struct qsbr_cb *qc, *next;
+
+	(void)arg;
+
+	spinlock_acquire(&qsbr_lock);
+	qc = qsbr_done;
+	qsbr_done = NULL;
+	spinlock_release(&qsbr_lock);
+
+	for (; qc != NULL; qc = next) {
+		/* The call may free qc. */
+		next = qc->qc_next;
+		qc->qc_func(qc->qc_arg);
+	}
+}
+
+/*
+ * Set up. Called from boot() once the other cpus and the workqueue
+ * threads are running.
+ */
+void
+qsbr_bootstrap(void)
+{
+	qsbr_numcpus = cpu_count();
+	qsbr_snap = kmalloc(qsbr_numcpus * sizeof(qsbr_snap[0]));
+	if (qsbr_snap == NULL) {
+		panic("qsbr_bootstrap: Out of memory\n");
+	}
+	work_init(&qsbr_work, qsbr_run, NULL);
+	membar_store_store();
+	qsbr_started = true;
+}
+
+/*
+ * Defer a call until all current readers are done.
+ */
+void
+qsbr_defer(struct qsbr_cb *qc, void (*func)(void *), void *arg)
+{
+	qc->qc_func = func;
+	qc->qc_arg = arg;
+
+	if (!qsbr_started) {
+		/* Only one cpu is running, and we aren't reading. */
+		func(arg);
+		return;
+	}
+
+	spinlock_acquire(&qsbr_lock);
+	qc->qc_next = qsbr_next;
+	qsbr_next = qc;
+	spinlock_release(&qsbr_lock);
+}
+
+/*
+ * Note a quiescent state on this cpu. Make sure our loads from any
+ * read section we were in are done before the count goes up.
+ */
+void
+qsbr_quiescent(void)
+{
+	membar_any_store();
+	curcpu->c_qsbr_count++;
+}
+
+/*
+ * Advance grace periods: finish the current one if every cpu has
+ * passed a quiescent state, and start another if calls are waiting.
+ */
+static
+void
+qsbr_advance(void)
+{
+	struct cpu *c;
+	unsigned i;
+
+	spinlock_acquire(&qsbr_lock);
+	if (qsbr_active) {
+		for (i=0; i<qsbr_numcpus; i++) {
+			c = cpu_get(i);
+			if (c->c_qsbr_count == qsbr_snap[i] && !c->c_isidle) {
+				spinlock_release(&qsbr_lock);
+				return;
+			}
+		}
+		qsbr_splice(&qsbr_done, qsbr_current);
+		qsbr_current = NULL;
+		qsbr_active = false;
+		/*
+		 * If it's already queued it will pick these up too.
+		 * (Do this under the lock: it serializes the calls to
+		 * work_queue on qsbr_work from different cpus.)
+		 */
+		work_queue(&qsbr_work);
+	}
+	if (qsbr_next != NULL) {
+		qsbr_current = qsbr_next;
+		qsbr_next = NULL;
+		for (i=0; i<qsbr_numcpus; i++) {
+			qsbr_snap[i] = cpu_get(i)->c_qsbr_count;
+		}
+		qsbr_active = true;
+	}
+	spinlock_release(&qsbr_lock);
+}
+
+/*
+ * Per-tick hook. Read sections run with interrupts off, so being in
+ * hardclock means this cpu isn't in one.
+ */
+void
+qsbr_hardclock(void)
+{
+	qsbr_quiescent();
+	if (!qsbr_started) {
+		return;
+	}
+	/* Unlocked peek; it's only a hint. */
+	if (qsbr_active || qsbr_next != NULL) {
+		qsbr_advance();
+	}
+}
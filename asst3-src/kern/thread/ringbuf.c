@@ -0,0 +1,435 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Lock-free bounded ring buffer. The interface is described in
+ * ringbuf.h.
+ *
+ * This is the array-based multi-producer multi-consumer queue with
+ * per-slot sequence numbers. Slot I (counting from the start, not
+ * modulo the size) starts out with sequence number I. A producer that
+ * finds the tail at I and sees sequence number I in the slot knows
+ * the slot is empty for this trip around the ring; it advances the
+ * tail with compare-and-swap to claim it, stores the item, and then
+ * sets the sequence number to I+1 to hand it to consumers. A consumer
+ * that finds the head at I and sees I+1 likewise claims the slot by
+ * advancing the head, takes the item, and sets the sequence number to
+ * I+size, which is what the producer on the next trip around expects.
+ *
+ * A sequence number behind what we expect means the slot hasn't been
+ * released yet from the last trip, so the ring is full (or empty);
+ * one ahead means someone else already claimed the slot and our copy
+ * of the tail (or head) is stale. The counters are free-running and
+ * wrap; differences are taken as signed 32-bit values, which is fine
+ * as long as the ring is much smaller than 2^31 slots.
+ *
+ * Batches claim a run of consecutive ready slots with one
+ * compare-and-swap.
+ *
+ * Sleeping: a thread that has to wait bumps the waiter count under
+ * rb_lock, issues a memory barrier, and tries again before sleeping.
+ * The other side issues a memory barrier after each successful
+ * operation and only takes the lock to wake people if the count is
+ * nonzero. Either the waiter's retry sees the other side's update, or
+ * the other side sees the count; and since the waiter holds the lock
+ * until wchan_sleep releases it, the wakeup can't slip in between the
+ * retry and the sleep.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <membar.h>
+#include <atomic.h>
+#include <wchan.h>
+#include <thread.h>
+#include <current.h>
+#include <ringbuf.h>
+
+struct ringbuf *
+ringbuf_create(const char *name, unsigned size)
+{
+	struct ringbuf *rb;
+	unsigned i, nslots;
+
+	KASSERT(size > 0);
+	KASSERT(size <= 0x40000000);
+
+	nslots = 1;
+	while (nslots < size) {
+		nslots *= 2;
+	}
+
+	rb = kmalloc(sizeof(*rb));
+	if (rb == NULL) {
+		return NULL;
+	}
+
+	rb->rb_name = kstrdup(name);
+	if (rb->rb_name == NULL) {
+		kfree(rb);
+		return NULL;
+	}
+
+	rb->rb_slots = kmalloc(nslots * sizeof(rb->rb_slots[0]));
+	if (rb->rb_slots == NULL) {
+		kfree(rb->rb_name);
+		kfree(rb);
+		return NULL;
+	}
+	for (i=0; i<nslots; i++) {
+		rb->rb_slots[i].rs_seq = i;
+		rb->rb_slots[i].rs_data = NULL;
+	}
+
+	rb->rb_notfull = wchan_create(rb->rb_name);
+	if (rb->rb_notfull == NULL) {
+		kfree(rb->rb_slots);
+		kfree(rb->rb_name);
+		kfree(rb);
+		return NULL;
+	}
+	rb->rb_notempty = wchan_create(rb->rb_name);
+	if (rb->rb_notempty == NULL) {
+		wchan_destroy(rb->rb_notfull);
+		kfree(rb->rb_slots);
+		kfree(rb->rb_name);
+		kfree(rb);
+		return NULL;
+	}
+
+	rb->rb_mask = nslots - 1;
+	rb->rb_head = 0;
+	rb->rb_tail = 0;
+	spinlock_init(&rb->rb_lock);
+	spinlock_setname(&rb->rb_lock, rb->rb_name);
+	rb->rb_putwaiters = 0;
+	rb->rb_getwaiters = 0;
+
+	return rb;
+}
+
+void
+ringbuf_destroy(struct ringbuf *rb)
+{
+	KASSERT(rb != NULL);
+	KASSERT(rb->rb_head == rb->rb_tail);
+	KASSERT(rb->rb_putwaiters == 0);
+	KASSERT(rb->rb_getwaiters == 0);
+
+	spinlock_cleanup(&rb->rb_lock);
+	wchan_destroy(rb->rb_notempty);
+	wchan_destroy(rb->rb_notfull);
+	kfree(rb->rb_slots);
+	kfree(rb->rb_name);
+	kfree(rb);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Lock-free part
+
+/*
+ * Claim up to N consecutive slots whose sequence numbers are BIAS
+ * past their index, starting at *INDEX (the head or the tail).
+ * Returns the first slot number claimed and sets *COUNT to how many;
+ * *COUNT is 0 if the first slot wasn't ready (ring full or empty).
+ */
+static
+uint32_t
+ringbuf_claim(struct ringbuf *rb, volatile uint32_t *index, uint32_t bias,
+	      unsigned n, unsigned *count)
+{
+	struct ringbuf_slot *slot;
+	uint32_t pos;
+	int32_t dif;
+	unsigned k;
+
+	pos = *index;
+	while (1) {
+		dif = 0;
+		for (k=0; k<n; k++) {
+			slot = &rb->rb_slots[(pos + k) & rb->rb_mask];
+			dif = (int32_t)(slot->rs_seq - (pos + k + bias));
+			if (dif != 0) {
+				break;
+			}
+		}
+		if (k == 0) {
+			if (dif < 0) {
+				/* Not released from the last trip around */
+				*count = 0;
+				return pos;
+			}
+			/* Somebody beat us to it */
+			pos = *index;
+			continue;
+		}
+		if (atomic_cas32(index, pos, pos + k)) {
+			*count = k;
+			return pos;
+		}
+		pos = *index;
+	}
+}
+
+/*
+ * Add up to N items without sleeping or waking anyone.
+ */
+static
+unsigned
+ringbuf_put_some(struct ringbuf *rb, void *const *items, unsigned n)
+{
+	uint32_t pos;
+	unsigned i, k;
+
+	if (n == 0) {
+		return 0;
+	}
+
+	pos = ringbuf_claim(rb, &rb->rb_tail, 0, n, &k);
+	if (k == 0) {
+		return 0;
+	}
+
+	/* Don't store until we've seen the consumer release the slots. */
+	membar_any_store();
+	for (i=0; i<k; i++) {
+		KASSERT(items[i] != NULL);
+		rb->rb_slots[(pos + i) & rb->rb_mask].rs_data = items[i];
+	}
+	/* Publish the items before handing the slots over. */
+	membar_store_store();
+	for (i=0; i<k; i++) {
+		rb->rb_slots[(pos + i) & rb->rb_mask].rs_seq = pos + i + 1;
+	}
+	return k;
+}
+
+/*
+ * Remove up to N items without sleeping or waking anyone.
+ */
+static
+unsigned
+ringbuf_get_some(struct ringbuf *rb, void **items, unsigned n)
+{
+	struct ringbuf_slot *slot;
+	uint32_t pos;
+	unsigned i, k;
+
+	if (n == 0) {
+		return 0;
+	}
+
+	pos = ringbuf_claim(rb, &rb->rb_head, 1, n, &k);
+	if (k == 0) {
+		return 0;
+	}
+
+	/* Don't load the items before we've seen them published. */
+	membar_load_load();
+	for (i=0; i<k; i++) {
+		slot = &rb->rb_slots[(pos + i) & rb->rb_mask];
+		items[i] = slot->rs_data;
+		slot->rs_data = NULL;
+	}
+	/* Finish with the slots before handing them back. */
+	membar_any_store();
+	for (i=0; i<k; i++) {
+		slot = &rb->rb_slots[(pos + i) & rb->rb_mask];
+		slot->rs_seq = pos + i + rb->rb_mask + 1;
+	}
+	return k;
+}
+
+/*
+ * Wake anyone waiting for the ring to become nonempty (or nonfull).
+ * Called after a successful put (or get).
+ */
+static
+void
+ringbuf_wakegetters(struct ringbuf *rb)
+{
+	membar_any_any();
+	if (rb->rb_getwaiters > 0) {
+		spinlock_acquire(&rb->rb_lock);
+		wchan_wakeall(rb->rb_notempty, &rb->rb_lock);
+		spinlock_release(&rb->rb_lock);
+	}
+}
+
+static
+void
+ringbuf_wakeputters(struct ringbuf *rb)
+{
+	membar_any_any();
+	if (rb->rb_putwaiters > 0) {
+		spinlock_acquire(&rb->rb_lock);
+		wchan_wakeall(rb->rb_notfull, &rb->rb_lock);
+		spinlock_release(&rb->rb_lock);
+	}
+}
+
+unsigned
+ringbuf_tryput_batch(struct ringbuf *rb, void *const *items, unsigned n)
+{
+	unsigned done;
+
+	done = ringbuf_put_some(rb, items, n);
+	if (done > 0) {
+		ringbuf_wakegetters(rb);
+	}
+	return done;
+}
+
+unsigned
+ringbuf_tryget_batch(struct ringbuf *rb, void **items, unsigned n)
+{
+	unsigned done;
+
+	done = ringbuf_get_some(rb, items, n);
+	if (done > 0) {
+		ringbuf_wakeputters(rb);
+	}
+	return done;
+}
+
+bool
+ringbuf_tryput(struct ringbuf *rb, void *item)
+{
+	return ringbuf_tryput_batch(rb, &item, 1) == 1;
+}
+
+void *
+ringbuf_tryget(struct ringbuf *rb)
+{
+	void *item;
+
+	if (ringbuf_tryget_batch(rb, &item, 1) == 0) {
+		return NULL;
+	}
+	return item;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Blocking wrappers
+
+void
+ringbuf_put_batch(struct ringbuf *rb, void *const *items, unsigned n)
+{
+	unsigned done;
+
+	KASSERT(curthread->t_in_interrupt == false);
+
+	done = ringbuf_put_some(rb, items, n);
+	if (done < n) {
+		spinlock_acquire(&rb->rb_lock);
+		rb->rb_putwaiters++;
+		membar_any_any();
+		while (1) {
+			done += ringbuf_put_some(rb, items + done, n - done);
+			if (done == n) {
+				break;
+			}
+			/*
+			 * Consumers may be asleep on what we've put so
+			 * far; they can't be woken by anyone else until
+			 * we're done.
+			 */
+			if (done > 0) {
+				wchan_wakeall(rb->rb_notempty, &rb->rb_lock);
+			}
+			wchan_sleep(rb->rb_notfull, &rb->rb_lock);
+		}
+		rb->rb_putwaiters--;
+		spinlock_release(&rb->rb_lock);
+	}
+	if (n > 0) {
+		ringbuf_wakegetters(rb);
+	}
+}
+
+unsigned
+ringbuf_get_batch(struct ringbuf *rb, void **items, unsigned n)
+{
+	unsigned done;
+
+	KASSERT(curthread->t_in_interrupt == false);
+
+	if (n == 0) {
+		return 0;
+	}
+
+	done = ringbuf_get_some(rb, items, n);
+	if (done == 0) {
+		spinlock_acquire(&rb->rb_lock);
+		rb->rb_getwaiters++;
+		membar_any_any();
+		while ((done = ringbuf_get_some(rb, items, n)) == 0) {
+			wchan_sleep(rb->rb_notempty, &rb->rb_lock);
+		}
+		rb->rb_getwaiters--;
+		spinlock_release(&rb->rb_lock);
+	}
+	ringbuf_wakeputters(rb);
+	return done;
+}
+
+void
+ringbuf_put(struct ringbuf *rb, void *item)
+{
+	ringbuf_put_batch(rb, &item, 1);
+}
+
+void *
+ringbuf_get(struct ringbuf *rb)
+{
+	void *item;
+
+	ringbuf_get_batch(rb, &item, 1);
+	return item;
+}
+
+unsigned
+ringbuf_count(struct ringbuf *rb)
+{
+	uint32_t head, tail;
+
+	head = rb->rb_head;
+	membar_load_load();
+	tail = rb->rb_tail;
+	if ((int32_t)(tail - head) < 0) {
+		return 0;
+	}
+	if (tail - head > rb->rb_mask + 1) {
+		return rb->rb_mask + 1;
+	}
+	return tail - head;
+}
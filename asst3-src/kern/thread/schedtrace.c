@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Scheduler event tracing.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <membar.h>
+#include <spl.h>
+#include <clock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <schedtrace.h>
+
+/* Events kept per cpu. */
+#define SCHEDTRACE_SIZE		512
+
+/* Thread name bytes kept per event, including the terminating null. */
+#define SCHEDTRACE_NAMELEN	16
+
+struct schedtrace_event {
+	uint32_t se_seq;		/* Index in ring + 1; 0 while writing */
+	uint32_t se_sec;		/* Timestamp */
+	uint32_t se_nsec;
+	uint16_t se_type;		/* SCHEDTRACE_* */
+	uint16_t se_arg;
+	uint32_t se_thread;		/* Thread id (its address) */
+	uint32_t se_other;
+	char se_name[SCHEDTRACE_NAMELEN]; /* Thread name, blanks as _ */
+};
+
+/*
+ * Per-cpu ring. Only sr_next is written by the recording cpu;
+ * sr_start is only written by the dump code, to forget old events.
+ */
+struct schedtrace_ring {
+	volatile uint32_t sr_next;	/* Index of next event */
+	uint32_t sr_start;		/* Oldest index not cleared */
+	struct schedtrace_event sr_events[SCHEDTRACE_SIZE];
+};
+
+static struct schedtrace_ring **schedtrace_rings;
+static unsigned schedtrace_numcpus;
+static volatile bool schedtrace_enabled;
+
+static const char *const schedtrace_names[] = {
+	"?", "switch", "wakeup", "migrate", "idle", "unidle",
+};
+#define SCHEDTRACE_NTYPES \
+	(sizeof(schedtrace_names) / sizeof(schedtrace_names[0]))
+
+/*
+ * Allocate the rings and start recording. Called from boot() once
+ * all the cpus are running.
+ */
+void
+schedtrace_bootstrap(void)
+{
+	unsigned i;
+
+	schedtrace_numcpus = cpu_count();
+	schedtrace_rings = kmalloc(schedtrace_numcpus *
+				   sizeof(schedtrace_rings[0]));
+	if (schedtrace_rings == NULL) {
+		panic("schedtrace_bootstrap: Out of memory\n");
+	}
+	for (i=0; i<schedtrace_numcpus; i++) {
+		schedtrace_rings[i] = kmalloc(sizeof(struct schedtrace_ring));
+		if (schedtrace_rings[i] == NULL) {
+			panic("schedtrace_bootstrap: Out of memory\n");
+		}
+		bzero(schedtrace_rings[i], sizeof(struct schedtrace_ring));
+	}
+	membar_store_store();
+	schedtrace_enabled = true;
+}
+
+/*
+ * Record an event on the current cpu's ring.
+ */
+void
+schedtrace_record(unsigned type, struct thread *t, unsigned arg,
+		  uint32_t other)
+{
+	struct schedtrace_ring *sr;
+	struct schedtrace_event *se;
+	struct timespec ts;
+	uint32_t seq;
+	unsigned i;
+	int spl;
+
+	if (!schedtrace_enabled) {
+		return;
+	}
+
+	/* Stay on this cpu and keep interrupts from recording over us. */
+	spl = splhigh();
+
+	sr = schedtrace_rings[curcpu->c_number];
+	seq = sr->sr_next;
+	sr->sr_next = seq + 1;
+	se = &sr->sr_events[seq % SCHEDTRACE_SIZE];
+
+	se->se_seq = 0;
+	membar_store_store();
+
+	gettime(&ts);
+	se->se_sec = ts.tv_sec;
+	se->se_nsec = ts.tv_nsec;
+	se->se_type = type;
+	se->se_arg = arg;
+	se->se_thread = (uint32_t)(uintptr_t)t;
+	se->se_other = other;
+	if (t == NULL) {
+		strcpy(se->se_name, "-");
+	}
+	else {
+		for (i=0; i<SCHEDTRACE_NAMELEN-1 && t->t_name[i]; i++) {
+			se->se_name[i] =
+				t->t_name[i] == ' ' ? '_' : t->t_name[i];
+		}
+		se->se_name[i] = 0;
+	}
+
+	membar_store_store();
+	se->se_seq = seq + 1;
+
+	splx(spl);
+}
+
+/*
+ * Advance a cursor past events that were overwritten (or are being
+ * written) and return the event it's on, or NULL if it reached END.
+ */
+static
+struct schedtrace_event *
+schedtrace_peek(struct schedtrace_ring *sr, uint32_t *pos, uint32_t end,
+		unsigned *lost)
+{
+	struct schedtrace_event *se;
+
+	while (*pos != end) {
+		se = &sr->sr_events[*pos % SCHEDTRACE_SIZE];
+		if (se->se_seq == *pos + 1) {
+			return se;
+		}
+		(*lost)++;
+		(*pos)++;
+	}
+	return NULL;
+}
+
+static
+bool
+schedtrace_before(const struct schedtrace_event *a,
+		  const struct schedtrace_event *b)
+{
+	if (a->se_sec != b->se_sec) {
+		return a->se_sec < b->se_sec;
+	}
+	return a->se_nsec < b->se_nsec;
+}
+
+/*
+ * Print every cpu's events, merged into time order. Recording is
+ * paused meanwhile so that the console output we generate doesn't
+ * overwrite the events we're printing.
+ */
+void
+schedtrace_dump(bool clear)
+{
+	struct schedtrace_ring *sr;
+	struct schedtrace_event *se, *best;
+	uint32_t *pos, *end;
+	unsigned i, bestcpu, count, lost;
+
+	if (schedtrace_rings == NULL) {
+		kprintf("schedtrace: not started\n");
+		return;
+	}
+
+	pos = kmalloc(2 * schedtrace_numcpus * sizeof(uint32_t));
+	if (pos == NULL) {
+		kprintf("schedtrace: out of memory\n");
+		return;
+	}
+	end = pos + schedtrace_numcpus;
+
+	schedtrace_enabled = false;
+	membar_any_any();
+
+	count = lost = 0;
+	for (i=0; i<schedtrace_numcpus; i++) {
+		sr = schedtrace_rings[i];
+		end[i] = sr->sr_next;
+		pos[i] = sr->sr_start;
+		if (end[i] - pos[i] > SCHEDTRACE_SIZE) {
+			/* The ring wrapped; the oldest are gone. */
+			lost += end[i] - pos[i] - SCHEDTRACE_SIZE;
+			pos[i] = end[i] - SCHEDTRACE_SIZE;
+		}
+	}
+
+	while (1) {
+		best = NULL;
+		bestcpu = 0;
+		for (i=0; i<schedtrace_numcpus; i++) {
+			se = schedtrace_peek(schedtrace_rings[i], &pos[i],
+					     end[i], &lost);
+			if (se != NULL &&
+			    (best == NULL || schedtrace_before(se, best))) {
+				best = se;
+				bestcpu = i;
+			}
+		}
+		if (best == NULL) {
+			break;
+		}
+		kprintf("st %u.%09u %u %s %08x %s %u %08x\n",
+			best->se_sec, best->se_nsec, bestcpu,
+			best->se_type < SCHEDTRACE_NTYPES ?
+			schedtrace_names[best->se_type] : "?",
+			best->se_thread, best->se_name,
+			best->se_arg, best->se_other);
+		pos[bestcpu]++;
+		count++;
+	}
+	kprintf("schedtrace: %u events, %u lost\n", count, lost);
+
+	if (clear) {
+		for (i=0; i<schedtrace_numcpus; i++) {
+			schedtrace_rings[i]->sr_start = end[i];
+		}
+	}
+
+	membar_store_store();
+	schedtrace_enabled = true;
+
+	kfree(pos);
+}
@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Hashed sleep queues. See sleepq.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <sleepq.h>
+
+/* Size of the hash table; a power of 2. */
+#define SLEEPQ_HASHBITS		7
+#define SLEEPQ_HASHSIZE		(1 << SLEEPQ_HASHBITS)
+
+struct sleepq_chain {
+	struct spinlock sc_lock;
+	struct wchan *sc_wchan;
+};
+
+static struct sleepq_chain sleepq_chains[SLEEPQ_HASHSIZE];
+
+/*
+ * Pick the chain for KEY. Objects are mostly kmalloc'd, so the low
+ * bits of the address don't vary much; multiplicative (Fibonacci)
+ * hashing takes the high bits of the product, which mix in all of
+ * the address.
+ */
+static
+unsigned
+sleepq_hash(const void *key)
+{
+	uint32_t k = (uint32_t)(uintptr_t)key;
+
+	return (k * 0x9e3779b1U) >> (32 - SLEEPQ_HASHBITS);
+}
+
+static
+struct sleepq_chain *
+sleepq_chain(const void *key)
+{
+	KASSERT(key != NULL);
+	return &sleepq_chains[sleepq_hash(key)];
+}
+
+void
+sleepq_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<SLEEPQ_HASHSIZE; i++) {
+		spinlock_init(&sleepq_chains[i].sc_lock);
+		spinlock_setname(&sleepq_chains[i].sc_lock, "sleepq");
+		sleepq_chains[i].sc_wchan = wchan_create("sleepq");
+		if (sleepq_chains[i].sc_wchan == NULL) {
+			panic("sleepq_bootstrap: Out of memory\n");
+		}
+	}
+}
+
+void
+sleepq_sleep(const void *key, struct spinlock *lk)
+{
+	struct sleepq_chain *sc = sleepq_chain(key);
+
+	KASSERT(spinlock_do_i_hold(lk));
+
+	spinlock_acquire(&sc->sc_lock);
+	spinlock_release(lk);
+	wchan_sleepkey(sc->sc_wchan, &sc->sc_lock, key);
+	spinlock_release(&sc->sc_lock);
+	spinlock_acquire(lk);
+}
+
+int
+sleepq_sleep_intr(const void *key, struct spinlock *lk)
+{
+	struct sleepq_chain *sc = sleepq_chain(key);
+	int result;
+
+	KASSERT(spinlock_do_i_hold(lk));
+
+	spinlock_acquire(&sc->sc_lock);
+	spinlock_release(lk);
+	result = wchan_sleepkey_intr(sc->sc_wchan, &sc->sc_lock, key);
+	spinlock_release(&sc->sc_lock);
+	spinlock_acquire(lk);
+	return result;
+}
+
+void
+sleepq_wakeone(const void *key, struct spinlock *lk)
+{
+	struct sleepq_chain *sc = sleepq_chain(key);
+
+	KASSERT(spinlock_do_i_hold(lk));
+
+	spinlock_acquire(&sc->sc_lock);
+	wchan_wakekey(sc->sc_wchan, &sc->sc_lock, key, false);
+	spinlock_release(&sc->sc_lock);
+}
+
+void
+sleepq_wakeall(const void *key, struct spinlock *lk)
+{
+	struct sleepq_chain *sc = sleepq_chain(key);
+
+	KASSERT(spinlock_do_i_hold(lk));
+
+	spinlock_acquire(&sc->sc_lock);
+	wchan_wakekey(sc->sc_wchan, &sc->sc_lock, key, true);
+	spinlock_release(&sc->sc_lock);
+}
+
+unsigned
+sleepq_transfer(const void *from, struct spinlock *fromlk,
+		const void *to, struct spinlock *tolk, bool all,
+		void (*moved)(struct thread *, void *), void *data)
+{
+	struct sleepq_chain *fromsc = sleepq_chain(from);
+	struct sleepq_chain *tosc = sleepq_chain(to);
+	unsigned count;
+
+	KASSERT(spinlock_do_i_hold(fromlk));
+	KASSERT(spinlock_do_i_hold(tolk));
+
+	/* Take two chain locks in table order. */
+	if (fromsc == tosc) {
+		spinlock_acquire(&fromsc->sc_lock);
+	}
+	else if (fromsc < tosc) {
+		spinlock_acquire(&fromsc->sc_lock);
+		spinlock_acquire(&tosc->sc_lock);
+	}
+	else {
+		spinlock_acquire(&tosc->sc_lock);
+		spinlock_acquire(&fromsc->sc_lock);
+	}
+
+	count = wchan_transferkey(fromsc->sc_wchan, &fromsc->sc_lock, from,
+				  tosc->sc_wchan, &tosc->sc_lock, to, all,
+				  moved, data);
+
+	if (fromsc != tosc) {
+		spinlock_release(&tosc->sc_lock);
+	}
+	spinlock_release(&fromsc->sc_lock);
+	return count;
+}
+
+bool
+sleepq_isempty(const void *key)
+{
+	struct sleepq_chain *sc = sleepq_chain(key);
+	bool ret;
+
+	spinlock_acquire(&sc->sc_lock);
+	ret = !wchan_haskey(sc->sc_wchan, &sc->sc_lock, key);
+	spinlock_release(&sc->sc_lock);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Timeouts
+//
+// The wchan_timeout is armed on the chain's channel and lock, so
+// it's the chain lock that protects its state; the interlock alone
+// isn't enough. In particular, the check for expiry before sleeping
+// has to be made under the chain lock, or a timeout that fires after
+// the check but before we're on the channel would be lost.
+
+void
+sleepq_timeout_arm(struct wchan_timeout *wt, const void *key, unsigned ticks)
+{
+	struct sleepq_chain *sc = sleepq_chain(key);
+
+	spinlock_acquire(&sc->sc_lock);
+	wchan_timeout_armkey(wt, sc->sc_wchan, &sc->sc_lock, key, ticks);
+	spinlock_release(&sc->sc_lock);
+}
+
+bool
+sleepq_timeout_expired(struct wchan_timeout *wt)
+{
+	bool ret;
+
+	spinlock_acquire(wt->wt_lock);
+	ret = wchan_timeout_expired(wt);
+	spinlock_release(wt->wt_lock);
+	return ret;
+}
+
+bool
+sleepq_timeout_timedout(struct wchan_timeout *wt)
+{
+	bool ret;
+
+	spinlock_acquire(wt->wt_lock);
+	ret = wchan_timeout_timedout(wt);
+	spinlock_release(wt->wt_lock);
+	return ret;
+}
+
+void
+sleepq_timeout_disarm(struct wchan_timeout *wt)
+{
+	spinlock_acquire(wt->wt_lock);
+	wchan_timeout_disarm(wt);
+	spinlock_release(wt->wt_lock);
+}
+
+void
+sleepq_sleep_timeout(const void *key, struct spinlock *lk,
+		     struct wchan_timeout *wt)
+{
+	struct sleepq_chain *sc = sleepq_chain(key);
+
+	KASSERT(spinlock_do_i_hold(lk));
+	KASSERT(wt->wt_lock == &sc->sc_lock);
+
+	spinlock_acquire(&sc->sc_lock);
+	spinlock_release(lk);
+	wchan_sleepkey_timeout(sc->sc_wchan, &sc->sc_lock, key, wt);
+	spinlock_release(&sc->sc_lock);
+	spinlock_acquire(lk);
+}
@@ -30,6 +30,7 @@
 /* Make sure to build out-of-line versions of inline functions */
 #define SPINLOCK_INLINE   /* empty */
 #define MEMBAR_INLINE     /* empty */
+#define ATOMIC_INLINE     /* empty */
 
 #include <types.h>
 #include <lib.h>
@@ -37,12 +38,20 @@
 #include <spl.h>
 #include <spinlock.h>
 #include <membar.h>
+#include <atomic.h>
 #include <current.h>	/* for curcpu */
 
 /*
  * Spinlocks.
  */
 
+/*
+ * How long a ticket lock waiter pauses between looks at splk_serving,
+ * per waiter ahead of it in line. Long enough that the holder's
+ * release usually isn't fought over by every waiter at once, short
+ * enough that the next in line doesn't sit idle after it happens.
+ */
+#define TICKET_BACKOFF	16
 
 /*
  * Initialize spinlock.
@@ -52,7 +61,20 @@ spinlock_init(struct spinlock *splk)
 {
 	spinlock_data_set(&splk->splk_lock, 0);
 	splk->splk_holder = NULL;
+	spinlock_data_set(&splk->splk_serving, 0);
+	splk->splk_ticket = false;
 	HANGMAN_LOCKABLEINIT(&splk->splk_hangman, "spinlock");
+	LOCKSTAT_INIT(&splk->splk_stat);
+}
+
+/*
+ * Initialize spinlock as a ticket lock.
+ */
+void
+spinlock_init_ticket(struct spinlock *splk)
+{
+	spinlock_init(splk);
+	splk->splk_ticket = true;
 }
 
 /*
@@ -62,7 +84,15 @@ void
 spinlock_cleanup(struct spinlock *splk)
 {
 	KASSERT(splk->splk_holder == NULL);
-	KASSERT(spinlock_data_get(&splk->splk_lock) == 0);
+	if (splk->splk_ticket) {
+		/* every ticket handed out must have been served */
+		KASSERT(spinlock_data_get(&splk->splk_lock) ==
+			spinlock_data_get(&splk->splk_serving));
+	}
+	else {
+		KASSERT(spinlock_data_get(&splk->splk_lock) == 0);
+	}
+	LOCKSTAT_UNREGISTER(&splk->splk_stat);
 }
 
 /*
@@ -76,6 +106,7 @@ void
 spinlock_acquire(struct spinlock *splk)
 {
 	struct cpu *mycpu;
+	LOCKSTAT_WAIT(wait);
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -93,7 +124,32 @@ spinlock_acquire(struct spinlock *splk)
 		mycpu = NULL;
 	}
 
-	while (1) {
+	if (splk->splk_ticket) {
+		spinlock_data_t mine, now;
+		volatile unsigned i;
+
+		/*
+		 * Take a ticket, then watch splk_serving until it
+		 * reaches our number. Everyone ahead of us in line
+		 * holds the lock for a while, so the further back we
+		 * are the longer we pause between looks; this keeps
+		 * the waiters off the lock's cache line while the
+		 * holder is using it. (Unsigned arithmetic copes with
+		 * the counters wrapping.)
+		 */
+		mine = atomic_fetchadd32(&splk->splk_lock, 1);
+		while (1) {
+			now = spinlock_data_get(&splk->splk_serving);
+			if (now == mine) {
+				break;
+			}
+			LOCKSTAT_CONTENDED(&wait);
+			for (i = (mine - now) * TICKET_BACKOFF; i > 0; i--) {
+				/* nothing */
+			}
+		}
+	}
+	else while (1) {
 		/*
 		 * Do test-test-and-set, that is, read first before
 		 * doing test-and-set, to reduce bus contention.
@@ -105,9 +161,11 @@ spinlock_acquire(struct spinlock *splk)
 		 * we don't.
 		 */
 		if (spinlock_data_get(&splk->splk_lock) != 0) {
+			LOCKSTAT_CONTENDED(&wait);
 			continue;
 		}
 		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
+			LOCKSTAT_CONTENDED(&wait);
 			continue;
 		}
 		break;
@@ -115,12 +173,72 @@ spinlock_acquire(struct spinlock *splk)
 
 	membar_store_any();
 	splk->splk_holder = mycpu;
+	LOCKSTAT_ACQUIRED(&splk->splk_stat, &wait);
 
 	if (CURCPU_EXISTS()) {
 		HANGMAN_ACQUIRE(&curcpu->c_hangman, &splk->splk_hangman);
 	}
 }
 
+/*
+ * Get the lock only if nobody holds it.
+ *
+ * Since this never waits, it can't take part in a deadlock; this
+ * makes it safe for taking a second lock of the same class, such as
+ * another cpu's run queue lock, in either order.
+ */
+bool
+spinlock_tryacquire(struct spinlock *splk)
+{
+	struct cpu *mycpu;
+	LOCKSTAT_WAIT(wait);
+
+	splraise(IPL_NONE, IPL_HIGH);
+
+	/* this must work before curcpu initialization */
+	if (CURCPU_EXISTS()) {
+		mycpu = curcpu->c_self;
+		if (splk->splk_holder == mycpu) {
+			panic("Deadlock on spinlock %p\n", splk);
+		}
+	}
+	else {
+		mycpu = NULL;
+	}
+
+	if (splk->splk_ticket) {
+		spinlock_data_t next;
+
+		/*
+		 * The lock is free exactly when nobody has a ticket
+		 * that hasn't been served yet. If so, take the next
+		 * ticket, unless someone else took it first.
+		 */
+		next = spinlock_data_get(&splk->splk_lock);
+		if (next != spinlock_data_get(&splk->splk_serving) ||
+		    !atomic_cas32(&splk->splk_lock, next, next + 1)) {
+			spllower(IPL_HIGH, IPL_NONE);
+			return false;
+		}
+	}
+	else if (spinlock_data_get(&splk->splk_lock) != 0 ||
+	    spinlock_data_testandset(&splk->splk_lock) != 0) {
+		spllower(IPL_HIGH, IPL_NONE);
+		return false;
+	}
+
+	membar_store_any();
+	splk->splk_holder = mycpu;
+	LOCKSTAT_ACQUIRED(&splk->splk_stat, &wait);
+
+	if (CURCPU_EXISTS()) {
+		mycpu->c_spinlocks++;
+		HANGMAN_WAIT(&curcpu->c_hangman, &splk->splk_hangman);
+		HANGMAN_ACQUIRE(&curcpu->c_hangman, &splk->splk_hangman);
+	}
+	return true;
+}
+
 /*
  * Release the lock.
  */
@@ -135,9 +253,17 @@ spinlock_release(struct spinlock *splk)
 		HANGMAN_RELEASE(&curcpu->c_hangman, &splk->splk_hangman);
 	}
 
+	LOCKSTAT_RELEASE(&splk->splk_stat);
 	splk->splk_holder = NULL;
 	membar_any_store();
-	spinlock_data_set(&splk->splk_lock, 0);
+	if (splk->splk_ticket) {
+		/* only the holder writes this, so no atomic op is needed */
+		spinlock_data_set(&splk->splk_serving,
+				  spinlock_data_get(&splk->splk_serving) + 1);
+	}
+	else {
+		spinlock_data_set(&splk->splk_lock, 0);
+	}
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
@@ -154,3 +280,14 @@ spinlock_do_i_hold(struct spinlock *splk)
 	/* Assume we can read splk_holder atomically enough for this to work */
 	return (splk->splk_holder == curcpu->c_self);
 }
+
+/*
+ * Name the lock for lockstat, and start counting it.
+ */
+void
+spinlock_setname(struct spinlock *splk, const char *name)
+{
+	LOCKSTAT_REGISTER(&splk->splk_stat, name, false);
+	(void)splk;
+	(void)name;
+}
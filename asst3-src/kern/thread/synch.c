@@ -33,9 +33,12 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <spinlock.h>
 #include <wchan.h>
+#include <sleepq.h>
+#include <cpu.h>
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
@@ -60,14 +63,8 @@ sem_create(const char *name, unsigned initial_count)
 		return NULL;
 	}
 
-	sem->sem_wchan = wchan_create(sem->sem_name);
-	if (sem->sem_wchan == NULL) {
-		kfree(sem->sem_name);
-		kfree(sem);
-		return NULL;
-	}
-
 	spinlock_init(&sem->sem_lock);
+	spinlock_setname(&sem->sem_lock, sem->sem_name);
 	sem->sem_count = initial_count;
 
 	return sem;
@@ -78,9 +75,8 @@ sem_destroy(struct semaphore *sem)
 {
 	KASSERT(sem != NULL);
 
-	/* wchan_cleanup will assert if anyone's waiting on it */
+	KASSERT(sleepq_isempty(sem));
 	spinlock_cleanup(&sem->sem_lock);
-	wchan_destroy(sem->sem_wchan);
 	kfree(sem->sem_name);
 	kfree(sem);
 }
@@ -98,7 +94,7 @@ P(struct semaphore *sem)
 	 */
 	KASSERT(curthread->t_in_interrupt == false);
 
-	/* Use the semaphore spinlock to protect the wchan as well. */
+	/* The semaphore spinlock is the interlock for the sleep queue. */
 	spinlock_acquire(&sem->sem_lock);
 	while (sem->sem_count == 0) {
 		/*
@@ -113,13 +109,64 @@ P(struct semaphore *sem)
 		 * Exercise: how would you implement strict FIFO
 		 * ordering?
 		 */
-		wchan_sleep(sem->sem_wchan, &sem->sem_lock);
+		sleepq_sleep(sem, &sem->sem_lock);
 	}
 	KASSERT(sem->sem_count > 0);
 	sem->sem_count--;
 	spinlock_release(&sem->sem_lock);
 }
 
+int
+P_timeout(struct semaphore *sem, unsigned ticks)
+{
+	struct wchan_timeout wt;
+	int result;
+
+	KASSERT(sem != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&sem->sem_lock);
+	sleepq_timeout_arm(&wt, sem, ticks);
+	while (sem->sem_count == 0 && !sleepq_timeout_expired(&wt)) {
+		sleepq_sleep_timeout(sem, &sem->sem_lock, &wt);
+	}
+	sleepq_timeout_disarm(&wt);
+	if (sem->sem_count > 0) {
+		sem->sem_count--;
+		result = 0;
+	}
+	else {
+		result = ETIMEDOUT;
+	}
+	spinlock_release(&sem->sem_lock);
+	return result;
+}
+
+int
+P_intr(struct semaphore *sem)
+{
+	int result;
+
+	KASSERT(sem != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	/*
+	 * If a V got in, take it even if we were interrupted as well,
+	 * so it isn't lost.
+	 */
+	spinlock_acquire(&sem->sem_lock);
+	result = 0;
+	while (sem->sem_count == 0 && result == 0) {
+		result = sleepq_sleep_intr(sem, &sem->sem_lock);
+	}
+	if (sem->sem_count > 0) {
+		sem->sem_count--;
+		result = 0;
+	}
+	spinlock_release(&sem->sem_lock);
+	return result;
+}
+
 void
 V(struct semaphore *sem)
 {
@@ -129,7 +176,7 @@ V(struct semaphore *sem)
 
 	sem->sem_count++;
 	KASSERT(sem->sem_count > 0);
-	wchan_wakeone(sem->sem_wchan, &sem->sem_lock);
+	sleepq_wakeone(sem, &sem->sem_lock);
 
 	spinlock_release(&sem->sem_lock);
 }
@@ -138,10 +185,206 @@ V(struct semaphore *sem)
 //
 // Lock.
 
+/*
+ * Locks are adaptive: if the holder is running on another cpu, it is
+ * probably about to let go, and spinning for a bit is much cheaper
+ * than two context switches. If the holder isn't running (it's
+ * asleep, or waiting for a cpu) we go to sleep right away.
+ *
+ * LOCK_SPIN_MAX bounds the spin in case the holder has a long
+ * critical section.
+ */
+#define LOCK_SPIN_MAX	2000
+
+/*
+ * Priority inheritance.
+ *
+ * A thread that goes to sleep waiting for a lock is counted in the
+ * lock's lk_waitcount[] at its scheduling level, and the holder's
+ * t_inheritcount[] mirrors the sum of those counts over every lock
+ * it holds. The holder is scheduled at the best level with a nonzero
+ * count, if that's better than its own (see thread_level in
+ * thread.c), until it releases the locks concerned.
+ *
+ * If the holder is itself asleep waiting for another lock, its new
+ * level is passed on to that lock's holder, and so on down the chain.
+ *
+ * Waiters that cv_signal or cv_broadcast move straight onto the lock's
+ * sleep queue (see cv_morph) are counted as they're moved, just as if
+ * they had gone to sleep in lock_acquire themselves.
+ *
+ * All of this is protected by pi_lock, which comes after the locks'
+ * lk_lock and the sleep queue locks, and before the run queue locks.
+ * A lock with no sleeping waiters (lk_nwaiters, which only changes
+ * under lk_lock) has nothing to hand on, so the uncontended paths
+ * don't touch pi_lock at all.
+ */
+static struct spinlock pi_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Recompute T's inherited level and propagate any change along the
+ * chain of locks it's waiting for.
+ */
+static
+void
+pi_update(struct thread *t)
+{
+	struct lock *lock;
+	unsigned level, oldlevel;
+
+	KASSERT(spinlock_do_i_hold(&pi_lock));
+
+	while (t != NULL) {
+		for (level=0; level<NPRIORITIES; level++) {
+			if (t->t_inheritcount[level] > 0) {
+				break;
+			}
+		}
+		if (level == t->t_inherited) {
+			return;
+		}
+		thread_setinherited(t, level);
+
+		lock = t->t_blockedon;
+		if (lock == NULL) {
+			return;
+		}
+		oldlevel = t->t_blockedlevel;
+		level = thread_priority(t);
+		if (level == oldlevel) {
+			return;
+		}
+		lock->lk_waitcount[oldlevel]--;
+		lock->lk_waitcount[level]++;
+		t->t_blockedlevel = level;
+
+		t = lock->lk_holder;
+		if (t != NULL) {
+			t->t_inheritcount[oldlevel]--;
+			t->t_inheritcount[level]++;
+		}
+	}
+}
+
+/*
+ * Thread T (usually the current thread) is about to sleep waiting for
+ * LOCK. Call with lk_lock held.
+ */
+static
+void
+pi_block(struct lock *lock, struct thread *t)
+{
+	struct thread *holder;
+	unsigned level;
+
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+	KASSERT(t->t_blockedon == NULL);
+
+	spinlock_acquire(&pi_lock);
+	level = thread_priority(t);
+	lock->lk_nwaiters++;
+	lock->lk_waitcount[level]++;
+	t->t_blockedon = lock;
+	t->t_blockedlevel = level;
+
+	holder = lock->lk_holder;
+	if (holder != NULL) {
+		holder->t_inheritcount[level]++;
+		pi_update(holder);
+	}
+	spinlock_release(&pi_lock);
+}
+
+/*
+ * The current thread has stopped waiting for LOCK, either because
+ * it's about to take it or because it gave up.
+ */
+static
+void
+pi_unblock(struct lock *lock)
+{
+	struct thread *holder;
+	unsigned level;
+
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+	KASSERT(curthread->t_blockedon == lock);
+
+	spinlock_acquire(&pi_lock);
+	level = curthread->t_blockedlevel;
+	KASSERT(lock->lk_nwaiters > 0);
+	KASSERT(lock->lk_waitcount[level] > 0);
+	lock->lk_nwaiters--;
+	lock->lk_waitcount[level]--;
+	curthread->t_blockedon = NULL;
+
+	holder = lock->lk_holder;
+	if (holder != NULL) {
+		holder->t_inheritcount[level]--;
+		pi_update(holder);
+	}
+	spinlock_release(&pi_lock);
+}
+
+/*
+ * Make the current thread the holder of LOCK, inheriting from any
+ * threads still asleep waiting for it.
+ */
+static
+void
+pi_take(struct lock *lock)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+	KASSERT(lock->lk_holder == NULL);
+
+	if (lock->lk_nwaiters == 0) {
+		lock->lk_holder = curthread;
+		return;
+	}
+
+	spinlock_acquire(&pi_lock);
+	lock->lk_holder = curthread;
+	for (i=0; i<NPRIORITIES; i++) {
+		curthread->t_inheritcount[i] += lock->lk_waitcount[i];
+	}
+	pi_update(curthread);
+	spinlock_release(&pi_lock);
+}
+
+/*
+ * Give up LOCK, and whatever the current thread inherited through it.
+ */
+static
+void
+pi_give(struct lock *lock)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+	KASSERT(lock->lk_holder == curthread);
+
+	if (lock->lk_nwaiters == 0) {
+		lock->lk_holder = NULL;
+		return;
+	}
+
+	spinlock_acquire(&pi_lock);
+	lock->lk_holder = NULL;
+	for (i=0; i<NPRIORITIES; i++) {
+		KASSERT(curthread->t_inheritcount[i] >=
+			lock->lk_waitcount[i]);
+		curthread->t_inheritcount[i] -= lock->lk_waitcount[i];
+	}
+	pi_update(curthread);
+	spinlock_release(&pi_lock);
+}
+
 struct lock *
 lock_create(const char *name)
 {
 	struct lock *lock;
+	unsigned i;
 
 	lock = kmalloc(sizeof(*lock));
 	if (lock == NULL) {
@@ -156,14 +399,15 @@ lock_create(const char *name)
 
 	HANGMAN_LOCKABLEINIT(&lock->lk_hangman, lock->lk_name);
 
-	lock->lk_wchan = wchan_create(lock->lk_name);
-	if (lock->lk_wchan == NULL) {
-		kfree(lock->lk_name);
-		kfree(lock);
-		return NULL;
-	}
 	spinlock_init(&lock->lk_lock);
+	spinlock_setname(&lock->lk_lock, lock->lk_name);
 	lock->lk_holder = NULL;
+	lock->lk_nwaiters = 0;
+	for (i=0; i<NPRIORITIES; i++) {
+		lock->lk_waitcount[i] = 0;
+	}
+	LOCKSTAT_INIT(&lock->lk_stat);
+	LOCKSTAT_REGISTER(&lock->lk_stat, lock->lk_name, true);
 
 	return lock;
 }
@@ -174,30 +418,90 @@ lock_destroy(struct lock *lock)
 	KASSERT(lock != NULL);
 
 	KASSERT(lock->lk_holder == NULL);
+	KASSERT(lock->lk_nwaiters == 0);
+	KASSERT(sleepq_isempty(lock));
+	LOCKSTAT_UNREGISTER(&lock->lk_stat);
 	spinlock_cleanup(&lock->lk_lock);
-	wchan_destroy(lock->lk_wchan);
 
 	kfree(lock->lk_name);
 	kfree(lock);
 }
 
+/*
+ * Spin while the holder of LOCK is running on another cpu. Call with
+ * lk_lock held; returns with it held, and the caller rechecks the
+ * holder.
+ *
+ * Returns true if we spun (so the caller should look again before
+ * sleeping) or false if the holder isn't running.
+ *
+ * While spinning we don't hold lk_lock, so the holder may release
+ * the lock and exit; we must not touch it after that. Only compare
+ * against it, and look at its cpu, which we fetch while it's still
+ * guaranteed to be around. A holder that migrates stops matching
+ * that cpu's c_curthread, which ends the spin.
+ */
+static
+bool
+lock_spin(struct lock *lock)
+{
+	struct thread *holder;
+	struct cpu *c;
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+
+	holder = lock->lk_holder;
+	c = holder->t_cpu;
+	if (c == curcpu->c_self || c->c_curthread != holder) {
+		return false;
+	}
+
+	spinlock_release(&lock->lk_lock);
+	for (i=0; i<LOCK_SPIN_MAX; i++) {
+		if (lock->lk_holder != holder || c->c_curthread != holder) {
+			break;
+		}
+	}
+	spinlock_acquire(&lock->lk_lock);
+	return i < LOCK_SPIN_MAX;
+}
+
 void
 lock_acquire(struct lock *lock)
 {
+	bool blocked;
+	LOCKSTAT_WAIT(wait);
+
 	DEBUGASSERT(lock != NULL);
 	KASSERT(curthread->t_in_interrupt == false);
 
 	spinlock_acquire(&lock->lk_lock);
 
+	/* If cv_morph moved us here, we're already counted as waiting. */
+	blocked = (curthread->t_blockedon == lock);
+
 	/* Call this (atomically) before waiting for a lock */
 	HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
 
 	KASSERT(lock->lk_holder != curthread);
 	while (lock->lk_holder != NULL) {
+		LOCKSTAT_CONTENDED(&wait);
+		if (lock_spin(lock)) {
+			continue;
+		}
+		if (!blocked) {
+			pi_block(lock, curthread);
+			blocked = true;
+		}
 		/* As in the semaphore. */
-		wchan_sleep(lock->lk_wchan, &lock->lk_lock);
+		sleepq_sleep(lock, &lock->lk_lock);
 	}
-	lock->lk_holder = curthread;
+	if (blocked) {
+		pi_unblock(lock);
+	}
+	pi_take(lock);
+	LOCKSTAT_ACQUIRED(&lock->lk_stat, &wait);
 
 	/* Call this (atomically) once the lock is acquired */
 	HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
@@ -205,6 +509,56 @@ lock_acquire(struct lock *lock)
 	spinlock_release(&lock->lk_lock);
 }
 
+int
+lock_acquire_timeout(struct lock *lock, unsigned ticks)
+{
+	struct wchan_timeout wt;
+	bool blocked = false;
+	int result;
+	LOCKSTAT_WAIT(wait);
+
+	DEBUGASSERT(lock != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&lock->lk_lock);
+
+	KASSERT(lock->lk_holder != curthread);
+	sleepq_timeout_arm(&wt, lock, ticks);
+	while (lock->lk_holder != NULL && !sleepq_timeout_expired(&wt)) {
+		LOCKSTAT_CONTENDED(&wait);
+		if (lock_spin(lock)) {
+			continue;
+		}
+		if (!blocked) {
+			pi_block(lock, curthread);
+			blocked = true;
+		}
+		sleepq_sleep_timeout(lock, &lock->lk_lock, &wt);
+	}
+	sleepq_timeout_disarm(&wt);
+	if (blocked) {
+		pi_unblock(lock);
+	}
+
+	/*
+	 * Don't tell hangman we're waiting until we actually have the
+	 * lock: a wait that times out can't be part of a deadlock.
+	 */
+	if (lock->lk_holder == NULL) {
+		pi_take(lock);
+		LOCKSTAT_ACQUIRED(&lock->lk_stat, &wait);
+		HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
+		HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
+		result = 0;
+	}
+	else {
+		result = ETIMEDOUT;
+	}
+
+	spinlock_release(&lock->lk_lock);
+	return result;
+}
+
 void
 lock_release(struct lock *lock)
 {
@@ -213,8 +567,9 @@ lock_release(struct lock *lock)
 	spinlock_acquire(&lock->lk_lock);
 
 	KASSERT(lock->lk_holder == curthread);
-	lock->lk_holder = NULL;
-	wchan_wakeone(lock->lk_wchan, &lock->lk_lock);
+	LOCKSTAT_RELEASE(&lock->lk_stat);
+	pi_give(lock);
+	sleepq_wakeone(lock, &lock->lk_lock);
 
 	/* Call this (atomically) when the lock is released */
 	HANGMAN_RELEASE(&curthread->t_hangman, &lock->lk_hangman);
@@ -257,14 +612,8 @@ cv_create(const char *name)
 		return NULL;
 	}
 
-	cv->cv_wchan = wchan_create(cv->cv_name);
-	if (cv->cv_wchan == NULL) {
-		kfree(cv->cv_name);
-		kfree(cv);
-		return NULL;
-	}
-
 	spinlock_init(&cv->cv_wchanlock);
+	spinlock_setname(&cv->cv_wchanlock, cv->cv_name);
 	return cv;
 }
 
@@ -273,8 +622,8 @@ cv_destroy(struct cv *cv)
 {
 	KASSERT(cv != NULL);
 
+	KASSERT(sleepq_isempty(cv));
 	spinlock_cleanup(&cv->cv_wchanlock);
-	wchan_destroy(cv->cv_wchan);
 
 	kfree(cv->cv_name);
 	kfree(cv);
@@ -285,33 +634,238 @@ cv_wait(struct cv *cv, struct lock *lock)
 {
 	spinlock_acquire(&cv->cv_wchanlock);
 	lock_release(lock);
-	wchan_sleep(cv->cv_wchan, &cv->cv_wchanlock);
+	sleepq_sleep(cv, &cv->cv_wchanlock);
 	/*
-	 * It is kind of silly to acquire this spinlock in wchan_sleep
+	 * It is kind of silly to acquire this spinlock in sleepq_sleep
 	 * and then release it right away. If we were going for
 	 * performance we might pass a flag to avoid that in this
-	 * case. Or we might use lock->lk_lock to protect the wchan
+	 * case. Or we might use lock->lk_lock as the interlock
 	 * and separate out enough of the lock_acquire/lock_release
 	 * logic to make that work cleanly.
+	 *
+	 * Note that by the time we wake up we may have been moved
+	 * over to the lock's sleep queue by cv_signal/cv_broadcast (see
+	 * below) and woken by lock_release, in which case the lock
+	 * is most likely free.
 	 */
 	spinlock_release(&cv->cv_wchanlock);
 	lock_acquire(lock);
 }
 
-void
-cv_signal(struct cv *cv, struct lock *lock)
+/*
+ * Same as cv_wait, but give up after TICKS. Only report ETIMEDOUT if
+ * it was the timeout that woke us: if cv_signal got there first we've
+ * been signalled, even if the timeout expires before we get going.
+ */
+int
+cv_wait_timeout(struct cv *cv, struct lock *lock, unsigned ticks)
 {
-	(void)lock;
+	struct wchan_timeout wt;
+	int result;
+
 	spinlock_acquire(&cv->cv_wchanlock);
-	wchan_wakeone(cv->cv_wchan, &cv->cv_wchanlock);
+	lock_release(lock);
+	sleepq_timeout_arm(&wt, cv, ticks);
+	sleepq_sleep_timeout(cv, &cv->cv_wchanlock, &wt);
+	sleepq_timeout_disarm(&wt);
+	result = sleepq_timeout_timedout(&wt) ? ETIMEDOUT : 0;
 	spinlock_release(&cv->cv_wchanlock);
+	lock_acquire(lock);
+	return result;
 }
 
+/*
+ * Wait morphing.
+ *
+ * A thread woken from cv_wait has to get the lock before it can do
+ * anything, and the signaller normally still holds it. Waking
+ * waiters up only for them to go straight back to sleep in
+ * lock_acquire costs two context switches each, and with
+ * cv_broadcast they all pile onto the lock at once.
+ *
+ * Instead, move the waiters directly onto the lock's sleep queue. Then
+ * lock_release wakes them one at a time, as the lock becomes free.
+ * If the lock isn't held at all, wake one of them now (it will wake
+ * the next when it releases the lock).
+ *
+ * The moved waiters are now waiting for the lock, so the holder has
+ * to inherit their priority; cv_morphed does the same accounting as
+ * lock_acquire would before sleeping, and lock_acquire picks it up
+ * from there when they wake.
+ */
+static
 void
-cv_broadcast(struct cv *cv, struct lock *lock)
+cv_morphed(struct thread *t, void *data)
+{
+	pi_block(data, t);
+}
+
+static
+void
+cv_morph(struct cv *cv, struct lock *lock, bool all)
 {
-	(void)lock;
 	spinlock_acquire(&cv->cv_wchanlock);
-	wchan_wakeall(cv->cv_wchan, &cv->cv_wchanlock);
+	spinlock_acquire(&lock->lk_lock);
+	if (sleepq_transfer(cv, &cv->cv_wchanlock,
+			    lock, &lock->lk_lock, all,
+			    cv_morphed, lock) > 0 &&
+	    lock->lk_holder == NULL) {
+		sleepq_wakeone(lock, &lock->lk_lock);
+	}
+	spinlock_release(&lock->lk_lock);
 	spinlock_release(&cv->cv_wchanlock);
 }
+
+void
+cv_signal(struct cv *cv, struct lock *lock)
+{
+	cv_morph(cv, lock, false);
+}
+
+void
+cv_broadcast(struct cv *cv, struct lock *lock)
+{
+	cv_morph(cv, lock, true);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+/* Readers and writers wait in separate sleep queues. */
+#define RW_READKEY(rw)		((const void *)&(rw)->rw_readwaiters)
+#define RW_WRITEKEY(rw)		((const void *)&(rw)->rw_writewaiters)
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	struct rwlock *rw;
+
+	rw = kmalloc(sizeof(*rw));
+	if (rw == NULL) {
+		return NULL;
+	}
+
+	rw->rwlock_name = kstrdup(name);
+	if (rw->rwlock_name == NULL) {
+		kfree(rw);
+		return NULL;
+	}
+
+	spinlock_init(&rw->rw_lock);
+	spinlock_setname(&rw->rw_lock, rw->rwlock_name);
+	rw->rw_readers = 0;
+	rw->rw_readwaiters = 0;
+	rw->rw_readpasses = 0;
+	rw->rw_writewaiters = 0;
+	rw->rw_writer = NULL;
+
+	return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	KASSERT(rw->rw_readers == 0);
+	KASSERT(rw->rw_writer == NULL);
+	KASSERT(rw->rw_readwaiters == 0);
+	KASSERT(rw->rw_writewaiters == 0);
+
+	spinlock_cleanup(&rw->rw_lock);
+
+	kfree(rw->rwlock_name);
+	kfree(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer != curthread);
+
+	/*
+	 * Wait while there's a writer, or while writers are waiting,
+	 * unless the last writer to leave let us past them.
+	 */
+	while (rw->rw_writer != NULL ||
+	       (rw->rw_writewaiters > 0 && rw->rw_readpasses == 0)) {
+		rw->rw_readwaiters++;
+		sleepq_sleep(RW_READKEY(rw), &rw->rw_lock);
+		rw->rw_readwaiters--;
+	}
+	if (rw->rw_readpasses > 0) {
+		rw->rw_readpasses--;
+	}
+	rw->rw_readers++;
+
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+
+	KASSERT(rw->rw_readers > 0);
+	KASSERT(rw->rw_writer == NULL);
+	rw->rw_readers--;
+	if (rw->rw_readers == 0 && rw->rw_readpasses == 0) {
+		sleepq_wakeone(RW_WRITEKEY(rw), &rw->rw_lock);
+	}
+
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer != curthread);
+
+	/* Readers that were let past us still get to go first. */
+	rw->rw_writewaiters++;
+	while (rw->rw_writer != NULL || rw->rw_readers > 0 ||
+	       rw->rw_readpasses > 0) {
+		sleepq_sleep(RW_WRITEKEY(rw), &rw->rw_lock);
+	}
+	rw->rw_writewaiters--;
+	rw->rw_writer = curthread;
+
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+
+	KASSERT(rw->rw_writer == curthread);
+	KASSERT(rw->rw_readers == 0);
+	rw->rw_writer = NULL;
+
+	/*
+	 * If readers are waiting, let all of them in, even if other
+	 * writers are waiting too; otherwise hand off to a writer.
+	 */
+	if (rw->rw_readwaiters > 0) {
+		rw->rw_readpasses = rw->rw_readwaiters;
+		sleepq_wakeall(RW_READKEY(rw), &rw->rw_lock);
+	}
+	else {
+		sleepq_wakeone(RW_WRITEKEY(rw), &rw->rw_lock);
+	}
+
+	spinlock_release(&rw->rw_lock);
+}
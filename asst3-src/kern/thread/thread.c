@@ -42,6 +42,7 @@
 #include <cpu.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <membar.h>
 #include <wchan.h>
 #include <thread.h>
 #include <threadlist.h>
@@ -53,6 +54,9 @@
 #include <mainbus.h>
 #include <vnode.h>
 #include <pid.h>
+#include <schedtrace.h>
+#include <qsbr.h>
+#include <kstat.h>
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
@@ -79,14 +83,21 @@ static struct semaphore *cpu_startup_sem;
  * (sometimes) catch kernel stack overflows. Use thread_checkstack()
  * to test this.
  */
+static
+void
+thread_stack_setmagic(void *stack)
+{
+	((uint32_t *)stack)[0] = THREAD_STACK_MAGIC;
+	((uint32_t *)stack)[1] = THREAD_STACK_MAGIC;
+	((uint32_t *)stack)[2] = THREAD_STACK_MAGIC;
+	((uint32_t *)stack)[3] = THREAD_STACK_MAGIC;
+}
+
 static
 void
 thread_checkstack_init(struct thread *thread)
 {
-	((uint32_t *)thread->t_stack)[0] = THREAD_STACK_MAGIC;
-	((uint32_t *)thread->t_stack)[1] = THREAD_STACK_MAGIC;
-	((uint32_t *)thread->t_stack)[2] = THREAD_STACK_MAGIC;
-	((uint32_t *)thread->t_stack)[3] = THREAD_STACK_MAGIC;
+	thread_stack_setmagic(thread->t_stack);
 }
 
 /*
@@ -111,6 +122,100 @@ thread_checkstack(struct thread *thread)
 	}
 }
 
+/*
+ * Stack cache.
+ *
+ * Each cpu keeps up to STACK_CACHE_SIZE free thread stacks, so
+ * thread_fork doesn't have to go to kmalloc for a fresh stack (and
+ * thread_destroy back to kfree) every time. Stacks are cached with
+ * their guard words intact; thread_checkstack verifies that before a
+ * stack goes in, so a stack that comes out needs no initialization.
+ *
+ * The cache is accessed only by its own cpu, with interrupts off so
+ * we can't be preempted and moved to another cpu halfway through.
+ * When kmalloc runs out of memory it empties the cache of the cpu
+ * it's running on (thread_stack_drain) before giving up.
+ */
+
+/*
+ * Get a stack for a new thread, from the cache if possible.
+ */
+static
+int
+thread_stack_alloc(struct thread *thread)
+{
+	int spl;
+
+	KASSERT(thread->t_stack == NULL);
+
+	spl = splhigh();
+	if (curcpu->c_stackcache_count > 0) {
+		thread->t_stack =
+			curcpu->c_stackcache[--curcpu->c_stackcache_count];
+	}
+	splx(spl);
+
+	if (thread->t_stack == NULL) {
+		thread->t_stack = kmalloc(STACK_SIZE);
+		if (thread->t_stack == NULL) {
+			return ENOMEM;
+		}
+		thread_checkstack_init(thread);
+	}
+	thread_checkstack(thread);
+	return 0;
+}
+
+/*
+ * Release a dead thread's stack, to the cache if there's room.
+ */
+static
+void
+thread_stack_free(struct thread *thread)
+{
+	int spl;
+
+	if (thread->t_stack == NULL) {
+		return;
+	}
+	thread_checkstack(thread);
+
+	spl = splhigh();
+	if (curcpu->c_stackcache_count < STACK_CACHE_SIZE) {
+		curcpu->c_stackcache[curcpu->c_stackcache_count++] =
+			thread->t_stack;
+		thread->t_stack = NULL;
+	}
+	splx(spl);
+
+	if (thread->t_stack != NULL) {
+		kfree(thread->t_stack);
+		thread->t_stack = NULL;
+	}
+}
+
+/*
+ * Free all the stacks in this cpu's cache.
+ */
+bool
+thread_stack_drain(void)
+{
+	bool freed = false;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		return false;
+	}
+
+	spl = splhigh();
+	while (curcpu->c_stackcache_count > 0) {
+		kfree(curcpu->c_stackcache[--curcpu->c_stackcache_count]);
+		freed = true;
+	}
+	splx(spl);
+	return freed;
+}
+
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
@@ -120,6 +225,7 @@ struct thread *
 thread_create(const char *name)
 {
 	struct thread *thread;
+	unsigned i;
 
 	DEBUGASSERT(name != NULL);
 
@@ -134,6 +240,7 @@ thread_create(const char *name)
 		return NULL;
 	}
 	thread->t_wchan_name = "NEW";
+	thread->t_sleepkey = NULL;
 	thread->t_state = S_READY;
 
 	/* Thread subsystem fields */
@@ -145,6 +252,25 @@ thread_create(const char *name)
 	thread->t_proc = NULL;
 	HANGMAN_ACTORINIT(&thread->t_hangman, thread->t_name);
 
+	/* Scheduler fields; new threads start at the top level */
+	thread->t_priority = 0;
+	thread->t_ticks = 0;
+	thread->t_affinity = THREAD_AFFINITY_ALL;
+	thread->t_lastrun = 0;
+	thread->t_inherited = NPRIORITIES;
+
+	/* Priority inheritance fields */
+	for (i=0; i<NPRIORITIES; i++) {
+		thread->t_inheritcount[i] = 0;
+	}
+	thread->t_blockedon = NULL;
+	thread->t_blockedlevel = 0;
+
+	/* Interruptible sleep fields */
+	thread->t_intrwchan = NULL;
+	thread->t_intrlock = NULL;
+	thread->t_interrupted = false;
+
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
 	thread->t_curspl = IPL_HIGH;
@@ -169,6 +295,7 @@ cpu_create(unsigned hardware_number)
 	struct cpu *c;
 	int result;
 	char namebuf[16];
+	unsigned i;
 
 	c = kmalloc(sizeof(*c));
 	if (c == NULL) {
@@ -182,19 +309,44 @@ cpu_create(unsigned hardware_number)
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
+	c->c_stackcache_count = 0;
+	c->c_qsbr_count = 0;
+	for (i=0; i<COUNTER_MAX; i++) {
+		c->c_counters[i] = 0;
+	}
+	for (i=0; i<STACK_CACHE_PREFILL; i++) {
+		c->c_stackcache[i] = kmalloc(STACK_SIZE);
+		if (c->c_stackcache[i] == NULL) {
+			panic("cpu_create: Out of memory\n");
+		}
+		thread_stack_setmagic(c->c_stackcache[i]);
+		c->c_stackcache_count++;
+	}
 
 	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
-	spinlock_init(&c->c_runqueue_lock);
+	for (i=0; i<NPRIORITIES; i++) {
+		threadlist_init(&c->c_runqueue[i]);
+	}
+	c->c_runqueue_mask = 0;
+	c->c_runqueue_count = 0;
+	/* remote wakeups and idle stealing contend for this; be fair */
+	spinlock_init_ticket(&c->c_runqueue_lock);
+	spinlock_setname(&c->c_runqueue_lock, "runqueue");
+
+	callwheel_init(&c->c_callwheel);
+	workq_init(&c->c_workq);
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
 	spinlock_init(&c->c_ipi_lock);
+	spinlock_setname(&c->c_ipi_lock, "ipi");
 
 	result = cpuarray_add(&allcpus, c, &c->c_number);
 	if (result != 0) {
 		panic("cpu_create: array_add: %s\n", strerror(result));
 	}
+	/* Affinity masks have one bit per cpu (System/161 has at most 32) */
+	KASSERT(c->c_number < 32);
 
 	snprintf(namebuf, sizeof(namebuf), "<boot #%d>", c->c_number);
 	c->c_curthread = thread_create(namebuf);
@@ -277,9 +429,9 @@ thread_destroy(struct thread *thread)
 
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
-	if (thread->t_stack != NULL) {
-		kfree(thread->t_stack);
-	}
+	KASSERT(thread->t_blockedon == NULL);
+	KASSERT(thread->t_inherited == NPRIORITIES);
+	thread_stack_free(thread);
 	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
 
@@ -317,6 +469,8 @@ exorcise(void)
 void
 thread_panic(void)
 {
+	unsigned i;
+
 	/*
 	 * Kill off other CPUs.
 	 *
@@ -331,9 +485,15 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = &curcpu->c_runqueue.tl_tail;
-	curcpu->c_runqueue.tl_tail.tln_prev = &curcpu->c_runqueue.tl_head;
+	for (i=0; i<NPRIORITIES; i++) {
+		curcpu->c_runqueue[i].tl_count = 0;
+		curcpu->c_runqueue[i].tl_head.tln_next =
+			&curcpu->c_runqueue[i].tl_tail;
+		curcpu->c_runqueue[i].tl_tail.tln_prev =
+			&curcpu->c_runqueue[i].tl_head;
+	}
+	curcpu->c_runqueue_mask = 0;
+	curcpu->c_runqueue_count = 0;
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -423,6 +583,22 @@ cpu_hatch(unsigned software_number)
 	thread_exit();
 }
 
+/*
+ * Return the number of cpus, and a cpu by its c_number.
+ */
+unsigned
+cpu_count(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
+struct cpu *
+cpu_get(unsigned num)
+{
+	KASSERT(num < cpuarray_num(&allcpus));
+	return cpuarray_get(&allcpus, num);
+}
+
 /*
  * Start up secondary cpus. Called from boot().
  */
@@ -446,152 +622,626 @@ thread_start_cpus(void)
 }
 
 /*
- * Make a thread runnable.
+ * Run queue operations.
  *
- * targetcpu might be curcpu; it might not be, too.
+ * Each cpu has one run queue per priority level. Threads are added at
+ * the tail of the queue for their current level and taken from the
+ * head of the highest-priority nonempty level. The caller must hold
+ * the cpu's run queue lock.
+ */
+
+/*
+ * Return the level a thread is queued and scheduled at. This is its
+ * own MLFQ level unless it has been lent a better one by threads
+ * waiting for a lock it holds.
  */
 static
-void
-thread_make_runnable(struct thread *target, bool already_have_lock)
+unsigned
+thread_level(const struct thread *t)
 {
-	struct cpu *targetcpu;
+	return t->t_priority < t->t_inherited ?
+		t->t_priority : t->t_inherited;
+}
 
-	/* Lock the run queue of the target thread's cpu. */
-	targetcpu = target->t_cpu;
+/*
+ * The nonempty levels are tracked in c_runqueue_mask, so finding the
+ * top one is a find-first-set rather than a scan of the lists. There's
+ * no ffs instruction on MIPS-I and we don't link libgcc, so look up
+ * the lowest set bit four bits at a time.
+ */
+#if NPRIORITIES > 32
+#error "c_runqueue_mask is too small for NPRIORITIES"
+#endif
 
-	if (already_have_lock) {
-		/* The target thread's cpu should be already locked. */
-		KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
+static const uint8_t cpu_runqueue_lowbit[16] = {
+	0, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+};
+
+/*
+ * Return the highest-priority (lowest-numbered) nonempty level, or
+ * NPRIORITIES if there's nothing runnable.
+ */
+static
+unsigned
+cpu_runqueue_toplevel(struct cpu *c)
+{
+	uint32_t mask;
+	unsigned base;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	mask = c->c_runqueue_mask;
+	if (mask == 0) {
+		return NPRIORITIES;
 	}
-	else {
-		spinlock_acquire(&targetcpu->c_runqueue_lock);
+	base = 0;
+	while ((mask & 0xf) == 0) {
+		mask >>= 4;
+		base += 4;
 	}
+	return base + cpu_runqueue_lowbit[mask & 0xf];
+}
 
-	/* Target thread is now ready to run; put it on the run queue. */
-	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+static
+void
+cpu_runqueue_add(struct cpu *c, struct thread *t)
+{
+	unsigned level;
 
-	if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
-		/*
-		 * Other processor is idle; send interrupt to make
-		 * sure it unidles.
-		 */
-		ipi_send(targetcpu, IPI_UNIDLE);
-	}
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+	level = thread_level(t);
+	KASSERT(level < NPRIORITIES);
 
-	if (!already_have_lock) {
-		spinlock_release(&targetcpu->c_runqueue_lock);
-	}
+	threadlist_addtail(&c->c_runqueue[level], t);
+	c->c_runqueue_mask |= (uint32_t)1 << level;
+	c->c_runqueue_count++;
 }
 
 /*
- * Create a new thread based on an existing one.
- *
- * The new thread has name NAME, and starts executing in function
- * ENTRYPOINT. DATA1 and DATA2 are passed to ENTRYPOINT.
- *
- * The new thread is created in the process P. If P is null, the
- * process is inherited from the caller. It will start on the same CPU
- * as the caller, unless the scheduler intervenes first.
+ * Clear a level's bit in the mask if it just became empty.
  */
-int
-thread_fork(const char *name,
-	    struct proc *proc,
-	    void (*entrypoint)(void *data1, unsigned long data2),
-	    void *data1, unsigned long data2)
+static
+void
+cpu_runqueue_checkempty(struct cpu *c, unsigned level)
 {
-	struct thread *newthread;
-	int result;
-
-	newthread = thread_create(name);
-	if (newthread == NULL) {
-		return ENOMEM;
-	}
-
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+	if (threadlist_isempty(&c->c_runqueue[level])) {
+		c->c_runqueue_mask &= ~((uint32_t)1 << level);
 	}
-	thread_checkstack_init(newthread);
-
-	/*
-	 * Now we clone various fields from the parent thread.
-	 */
+}
 
-	/* Thread subsystem fields */
-	newthread->t_cpu = curthread->t_cpu;
+/*
+ * Take the next thread to run: the head of the highest-priority
+ * nonempty level.
+ */
+static
+struct thread *
+cpu_runqueue_remhead(struct cpu *c)
+{
+	struct thread *t;
+	unsigned level;
 
-	/* Attach the new thread to its process */
-	if (proc == NULL) {
-		proc = curthread->t_proc;
-	}
-	result = proc_addthread(proc, newthread);
-	if (result) {
-		/* thread_destroy will clean up the stack */
-		thread_destroy(newthread);
-		return result;
+	level = cpu_runqueue_toplevel(c);
+	if (level == NPRIORITIES) {
+		return NULL;
 	}
+	KASSERT(c->c_runqueue_count > 0);
+	c->c_runqueue_count--;
+	t = threadlist_remhead(&c->c_runqueue[level]);
+	KASSERT(t != NULL);
+	cpu_runqueue_checkempty(c, level);
+	return t;
+}
 
-	/*
-	 * Because new threads come out holding the cpu runqueue lock
-	 * (see notes at bottom of thread_switch), we need to account
-	 * for the spllower() that will be done releasing it.
-	 */
-	newthread->t_iplhigh_count++;
-
-	/* Set up the switchframe so entrypoint() gets called */
-	switchframe_init(newthread, entrypoint, data1, data2);
+/*
+ * Take a particular thread off the run queue.
+ */
+static
+void
+cpu_runqueue_remove(struct cpu *c, struct thread *t)
+{
+	unsigned level;
 
-	/* Lock the current cpu's run queue and make the new thread runnable */
-	thread_make_runnable(newthread, false);
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+	level = thread_level(t);
+	KASSERT(level < NPRIORITIES);
+	KASSERT(c->c_runqueue_count > 0);
 
-	return 0;
+	threadlist_remove(&c->c_runqueue[level], t);
+	cpu_runqueue_checkempty(c, level);
+	c->c_runqueue_count--;
 }
 
 /*
- * High level, machine-independent context switch code.
+ * Thread migration.
  *
- * The current thread is queued appropriately and its state is changed
- * to NEWSTATE; another thread to run is selected and switched to.
+ * Load balancing is pull-based: a cpu that runs out of work steals
+ * from the busiest other cpu (see thread_switch), and every cpu also
+ * periodically checks whether it is carrying much less than the
+ * busiest cpu and, if so, pulls some of the difference across. Busy
+ * cpus never have to stop to push work elsewhere.
  *
- * If NEWSTATE is S_SLEEP, the thread is queued on the wait channel
- * WC, protected by the spinlock LK. Otherwise WC and Lk should be
- * NULL.
+ * Other cpus' run queue counts are read without locking, so they're
+ * only hints; and other cpus' run queue locks are only ever
+ * try-locked, never spun on. This keeps a thief from stalling the
+ * cpu it's stealing from, and it means two cpus stealing from each
+ * other at once can't deadlock on each other's run queue locks.
+ *
+ * Migrating threads isn't free because of cache affinity; a thread's
+ * working cache set will end up having to be moved to the other CPU,
+ * which is fairly slow. The tradeoff between this performance loss
+ * and the performance loss due to underutilization of some CPUs is
+ * something that needs to be tuned and probably is workload-specific.
+ *
+ * So as not to throw away a warm cache, a thread that ran on its cpu
+ * within the last CACHE_HOT_HARDCLOCKS hardclocks is left where it
+ * is, unless the thief is idle and there's nothing else it can take.
+ * Threads that were just migrated count as having just run on their
+ * new cpu; this also keeps them from bouncing straight back.
+ *
+ * Threads also have an affinity mask (t_affinity, one bit per cpu
+ * number) and are never moved to a cpu outside it.
+ */
+#define CACHE_HOT_HARDCLOCKS	2
+
+/*
+ * Check if T may run on C. (cpu_create makes sure c_number fits.)
  */
 static
-void
-thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
+bool
+thread_allowed(const struct thread *t, const struct cpu *c)
 {
-	struct thread *cur, *next;
-	int spl;
-
-	DEBUGASSERT(curcpu->c_curthread == curthread);
-	DEBUGASSERT(curthread->t_cpu == curcpu->c_self);
+	return (t->t_affinity & ((uint32_t)1 << c->c_number)) != 0;
+}
 
-	/* Explicitly disable interrupts on this processor */
-	spl = splhigh();
+/*
+ * Check if T ran on C recently enough that its cache is still warm.
+ */
+static
+bool
+thread_cachehot(const struct thread *t, const struct cpu *c)
+{
+	return c->c_hardclocks - t->t_lastrun < CACHE_HOT_HARDCLOCKS;
+}
 
-	cur = curthread;
+/*
+ * Find the least busy cpu that T may run on. As elsewhere the counts
+ * are only hints. Returns NULL if no cpu is allowed.
+ */
+static
+struct cpu *
+thread_pick_cpu(const struct thread *t)
+{
+	struct cpu *c, *best;
+	unsigned i, numcpus;
 
-	/*
-	 * If we're idle, return without doing anything. This happens
-	 * when the timer interrupt interrupts the idle loop.
-	 */
-	if (curcpu->c_isidle) {
-		splx(spl);
-		return;
+	best = NULL;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (!thread_allowed(t, c)) {
+			continue;
+		}
+		if (best == NULL || c->c_runqueue_count < best->c_runqueue_count) {
+			best = c;
+		}
 	}
+	return best;
+}
 
-	/* Check the stack guard band. */
-	thread_checkstack(cur);
+/*
+ * Find the cpu other than the current one with the most threads
+ * waiting to run. Returns NULL if no other cpu has anything queued.
+ */
+static
+struct cpu *
+thread_find_busiest(unsigned *count_ret)
+{
+	struct cpu *c, *busiest;
+	unsigned i, numcpus, count, max;
 
-	/* Lock the run queue. */
-	spinlock_acquire(&curcpu->c_runqueue_lock);
+	busiest = NULL;
+	max = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self) {
+			continue;
+		}
+		count = c->c_runqueue_count;
+		if (count > max) {
+			busiest = c;
+			max = count;
+		}
+	}
+	*count_ret = max;
+	return busiest;
+}
+
+/*
+ * Choose a thread on VICTIM's run queue for the current cpu to take.
+ * Look first at the tail of the victim's lowest-priority level, i.e.,
+ * at the threads that would have waited longest there. Skip threads
+ * that aren't allowed on the current cpu, and, unless ALLOW_HOT is
+ * set, cache-hot threads.
+ */
+static
+struct thread *
+thread_steal_candidate(struct cpu *victim, bool allow_hot)
+{
+	struct thread *t;
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&victim->c_runqueue_lock));
+
+	for (i=NPRIORITIES; i-- > 0; ) {
+		if ((victim->c_runqueue_mask & ((uint32_t)1 << i)) == 0) {
+			continue;
+		}
+		THREADLIST_FORALL_REV(t, victim->c_runqueue[i]) {
+			/*
+			 * Ordinarily, the victim's curthread will not
+			 * appear on its run queue. However, it can
+			 * under the following circumstances:
+			 *   - it went to sleep;
+			 *   - the processor became idle, so it
+			 *     remained curthread;
+			 *   - it was reawakened, so it was put on the
+			 *     run queue;
+			 *   - and the processor hasn't fully unidled
+			 *     yet, so all these things are still true.
+			 *
+			 * Its context hasn't been saved, so migrating
+			 * it can cause bad things to happen.
+			 * (Exercise: what?) Leave it alone.
+			 */
+			if (t == victim->c_curthread) {
+				continue;
+			}
+			if (!thread_allowed(t, curcpu->c_self)) {
+				continue;
+			}
+			if (!allow_hot && thread_cachehot(t, victim)) {
+				continue;
+			}
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Move up to MAX threads from VICTIM's run queue to the current
+ * cpu's. The caller must hold the current cpu's run queue lock. If
+ * IDLE is set, the current cpu has nothing else to do, so cache-hot
+ * threads may be taken if there's nothing better.
+ *
+ * Returns the number of threads moved, which may be 0 if the
+ * victim's run queue was locked or had nothing suitable.
+ */
+static
+unsigned
+thread_steal(struct cpu *victim, unsigned max, bool idle)
+{
+	struct thread *t;
+	unsigned n;
+
+	KASSERT(victim != curcpu->c_self);
+	KASSERT(spinlock_do_i_hold(&curcpu->c_runqueue_lock));
+
+	if (!spinlock_tryacquire(&victim->c_runqueue_lock)) {
+		return 0;
+	}
+
+	for (n=0; n<max; n++) {
+		t = thread_steal_candidate(victim, false);
+		if (t == NULL && idle) {
+			t = thread_steal_candidate(victim, true);
+		}
+		if (t == NULL) {
+			break;
+		}
+
+		cpu_runqueue_remove(victim, t);
+		SCHEDTRACE(SCHEDTRACE_MIGRATE, t, victim->c_number,
+			   curcpu->c_number);
+		t->t_cpu = curcpu->c_self;
+		t->t_lastrun = curcpu->c_hardclocks;
+		cpu_runqueue_add(curcpu->c_self, t);
+		DEBUG(DB_THREADS,
+		      "Migrated thread %s: cpu %u -> %u",
+		      t->t_name, victim->c_number, curcpu->c_number);
+	}
+
+	spinlock_release(&victim->c_runqueue_lock);
+	return n;
+}
+
+/*
+ * Move T, which is on the current cpu's run queue but not allowed to
+ * run here, to a cpu where it is allowed. The caller must hold the
+ * current cpu's run queue lock and must already have taken T off it.
+ * As with stealing, the other cpu's lock is only try-locked; returns
+ * false if T couldn't be moved.
+ */
+static
+bool
+thread_push(struct thread *t)
+{
+	struct cpu *target;
+
+	KASSERT(spinlock_do_i_hold(&curcpu->c_runqueue_lock));
+	KASSERT(t != curthread);
+
+	target = thread_pick_cpu(t);
+	if (target == NULL || target == curcpu->c_self) {
+		return false;
+	}
+	if (!spinlock_tryacquire(&target->c_runqueue_lock)) {
+		return false;
+	}
+	SCHEDTRACE(SCHEDTRACE_MIGRATE, t, curcpu->c_number, target->c_number);
+	t->t_cpu = target;
+	t->t_lastrun = target->c_hardclocks;
+	cpu_runqueue_add(target, t);
+	if (target->c_isidle) {
+		ipi_send(target, IPI_UNIDLE);
+	}
+	spinlock_release(&target->c_runqueue_lock);
+	return true;
+}
+
+/*
+ * T is about to be made runnable, but its affinity no longer allows
+ * its current cpu. Pick a new one, provided that T's context has been
+ * saved; that is, that T isn't still curthread on its old cpu. (See
+ * thread_steal_candidate.) T must not be on any run queue.
+ *
+ * t_cpu is changed holding the old cpu's run queue lock, so that
+ * anyone who has locked T's cpu's run queue (see thread_setinherited)
+ * can rely on t_cpu staying put. As with a migration, T counts as
+ * having just run on its new cpu.
+ */
+static
+void
+thread_rehome(struct thread *t)
+{
+	struct cpu *old, *target;
+
+	old = t->t_cpu;
+	spinlock_acquire(&old->c_runqueue_lock);
+	KASSERT(t->t_cpu == old);
+	if (old->c_curthread != t) {
+		target = thread_pick_cpu(t);
+		if (target != NULL && target != old) {
+			SCHEDTRACE(SCHEDTRACE_MIGRATE, t, old->c_number,
+				   target->c_number);
+			t->t_cpu = target;
+			t->t_lastrun = target->c_hardclocks;
+		}
+	}
+	spinlock_release(&old->c_runqueue_lock);
+}
+
+/*
+ * Poke an idle cpu, other than BUSY and ourselves, that T may run on,
+ * so that it comes out of cpu_idle and steals T (just queued on BUSY).
+ * Called with BUSY's run queue lock held.
+ */
+static
+void
+thread_kick_idle(struct cpu *busy, struct thread *t)
+{
+	struct cpu *c;
+	unsigned i, numcpus;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == busy || c == curcpu->c_self) {
+			continue;
+		}
+		if (c->c_isidle && thread_allowed(t, c)) {
+			ipi_send(c, IPI_UNIDLE);
+			return;
+		}
+	}
+}
+
+/*
+ * Make a thread runnable.
+ *
+ * targetcpu might be curcpu; it might not be, too.
+ */
+static
+void
+thread_make_runnable(struct thread *target, bool already_have_lock)
+{
+	struct cpu *targetcpu;
+	bool waking;
+
+	/*
+	 * A thread being woken up gave up the cpu to wait before its
+	 * quantum ran out. Move it up a level so I/O-bound and
+	 * interactive threads get the cpu back promptly.
+	 */
+	waking = (target->t_state == S_SLEEP);
+	if (waking) {
+		if (target->t_priority > 0) {
+			target->t_priority--;
+		}
+		target->t_ticks = 0;
+	}
+
+	/*
+	 * If the thread's affinity was changed since it last ran,
+	 * its cpu may no longer be allowed; move it. (Not if it's
+	 * the thread yielding in thread_switch, which is still
+	 * running; thread_switch takes care of that case.)
+	 */
+	if (!already_have_lock && !thread_allowed(target, target->t_cpu)) {
+		thread_rehome(target);
+	}
+
+	/* Lock the run queue of the target thread's cpu. */
+	targetcpu = target->t_cpu;
+
+	if (already_have_lock) {
+		/* The target thread's cpu should be already locked. */
+		KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
+	}
+	else {
+		spinlock_acquire(&targetcpu->c_runqueue_lock);
+	}
+
+	if (waking) {
+		SCHEDTRACE(SCHEDTRACE_WAKEUP, target, 0, targetcpu->c_number);
+	}
+
+	/* Target thread is now ready to run; put it on the run queue. */
+	target->t_state = S_READY;
+	cpu_runqueue_add(targetcpu, target);
+
+	if (targetcpu->c_isidle) {
+		if (targetcpu != curcpu->c_self) {
+			/*
+			 * Other processor is idle; send interrupt to
+			 * make sure it unidles.
+			 */
+			ipi_send(targetcpu, IPI_UNIDLE);
+		}
+	}
+	else {
+		/*
+		 * The target is busy, so this thread has to wait;
+		 * if some other cpu is idle, wake it up to steal it.
+		 */
+		thread_kick_idle(targetcpu, target);
+	}
+
+	if (!already_have_lock) {
+		spinlock_release(&targetcpu->c_runqueue_lock);
+	}
+}
 
-	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+/*
+ * Create a new thread based on an existing one.
+ *
+ * The new thread has name NAME, and starts executing in function
+ * ENTRYPOINT. DATA1 and DATA2 are passed to ENTRYPOINT.
+ *
+ * The new thread is created in the process P. If P is null, the
+ * process is inherited from the caller. It will start on the same CPU
+ * as the caller, unless the scheduler intervenes first.
+ */
+int
+thread_fork(const char *name,
+	    struct proc *proc,
+	    void (*entrypoint)(void *data1, unsigned long data2),
+	    void *data1, unsigned long data2)
+{
+	struct thread *newthread;
+	int result;
+
+	newthread = thread_create(name);
+	if (newthread == NULL) {
+		return ENOMEM;
+	}
+
+	/* Allocate a stack */
+	result = thread_stack_alloc(newthread);
+	if (result) {
+		thread_destroy(newthread);
+		return result;
+	}
+
+	/*
+	 * Now we clone various fields from the parent thread.
+	 */
+
+	/* Thread subsystem fields */
+	newthread->t_cpu = curthread->t_cpu;
+	newthread->t_affinity = curthread->t_affinity;
+
+	/* Attach the new thread to its process */
+	if (proc == NULL) {
+		proc = curthread->t_proc;
+	}
+	result = proc_addthread(proc, newthread);
+	if (result) {
+		/* thread_destroy will clean up the stack */
+		thread_destroy(newthread);
+		return result;
+	}
+
+	/*
+	 * Because new threads come out holding the cpu runqueue lock
+	 * (see notes at bottom of thread_switch), we need to account
+	 * for the spllower() that will be done releasing it.
+	 */
+	newthread->t_iplhigh_count++;
+
+	/* Set up the switchframe so entrypoint() gets called */
+	switchframe_init(newthread, entrypoint, data1, data2);
+
+	/* Lock the current cpu's run queue and make the new thread runnable */
+	thread_make_runnable(newthread, false);
+
+	return 0;
+}
+
+/*
+ * High level, machine-independent context switch code.
+ *
+ * The current thread is queued appropriately and its state is changed
+ * to NEWSTATE; another thread to run is selected and switched to.
+ *
+ * If NEWSTATE is S_SLEEP, the thread is queued on the wait channel
+ * WC, protected by the spinlock LK. Otherwise WC and Lk should be
+ * NULL.
+ */
+static
+void
+thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
+{
+	struct thread *cur, *next;
+	struct cpu *victim;
+	unsigned victim_count;
+	bool idled;
+	int spl;
+
+	DEBUGASSERT(curcpu->c_curthread == curthread);
+	DEBUGASSERT(curthread->t_cpu == curcpu->c_self);
+
+	/* Explicitly disable interrupts on this processor */
+	spl = splhigh();
+
+	cur = curthread;
+
+	/*
+	 * If we're idle, return without doing anything. This happens
+	 * when the timer interrupt interrupts the idle loop.
+	 */
+	if (curcpu->c_isidle) {
+		splx(spl);
+		return;
+	}
+
+	/* Check the stack guard band. */
+	thread_checkstack(cur);
+
+	/* A context switch is a quiescent state. */
+	qsbr_quiescent();
+
+	/* Lock the run queue. */
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+
+	/*
+	 * If we're yielding and nothing of the same or higher priority
+	 * is waiting, just keep running. Lower levels only get the cpu
+	 * when the higher ones are empty.
+	 */
+	if (newstate == S_READY &&
+	    cpu_runqueue_toplevel(curcpu->c_self) > thread_level(cur)) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
@@ -639,19 +1289,55 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	 * Note that c_isidle becomes true briefly even if we don't go
 	 * idle. However, because one is supposed to hold the runqueue
 	 * lock to look at it, this should not be visible or matter.
+	 *
+	 * Before idling, try to steal work from the busiest other
+	 * cpu. We come back around here every time cpu_idle returns,
+	 * which is at the latest the next hardclock, or sooner if
+	 * thread_kick_idle pokes us.
+	 *
+	 * A thread whose affinity excludes this cpu is sent on to
+	 * another one as it comes off the run queue, provided it's
+	 * not cur (whose context isn't saved yet) and the other cpu's
+	 * run queue lock is free; otherwise it runs here one more
+	 * time.
 	 */
 
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
+	idled = false;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		next = cpu_runqueue_remhead(curcpu->c_self);
+		if (next != NULL && next != cur &&
+		    !thread_allowed(next, curcpu->c_self) &&
+		    thread_push(next)) {
+			/* Not allowed here; sent elsewhere. Try again. */
+			next = NULL;
+			continue;
+		}
 		if (next == NULL) {
+			victim = thread_find_busiest(&victim_count);
+			if (victim != NULL &&
+			    thread_steal(victim, 1, true) > 0) {
+				continue;
+			}
+			if (!idled) {
+				SCHEDTRACE(SCHEDTRACE_IDLE, NULL, 0, 0);
+				idled = true;
+			}
 			spinlock_release(&curcpu->c_runqueue_lock);
 			cpu_idle();
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
+	if (idled) {
+		SCHEDTRACE(SCHEDTRACE_UNIDLE, NULL, 0, 0);
+	}
+	if (next != cur) {
+		counter_inc(&kstat_switches);
+		SCHEDTRACE(SCHEDTRACE_SWITCH, next, newstate,
+			   (uint32_t)(uintptr_t)cur);
+	}
 
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
@@ -663,6 +1349,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	curcpu->c_curthread = next;
 	curthread = next;
 
+	/* Remember when cur last had the cpu, for the migration code. */
+	cur->t_lastrun = curcpu->c_hardclocks;
+
 	/* do the switch (in assembler in switch.S) */
 	switchframe_switch(&cur->t_context, &next->t_context);
 
@@ -819,141 +1508,214 @@ thread_yield(void)
 ////////////////////////////////////////////////////////////
 
 /*
- * Scheduler.
+ * Scheduler.
+ *
+ * This is a multi-level feedback queue. Threads at level 0 have the
+ * highest priority; each cpu always runs the head of its highest
+ * nonempty level, round-robin within a level.
+ *
+ *    - New threads start at level 0.
+ *    - A thread that uses up its whole quantum is CPU-bound; it moves
+ *      down a level. Lower levels have longer quanta, so CPU-bound
+ *      jobs switch less often once they settle at the bottom.
+ *    - A thread that sleeps is waiting for I/O or for another thread;
+ *      when it wakes up it moves up a level (see thread_make_runnable).
+ *    - Periodically, schedule() moves everything back to level 0 so
+ *      that CPU-bound threads can't be starved indefinitely and so
+ *      that a thread that changes behavior gets reclassified.
+ *    - A thread holding a lock that higher-level threads are waiting
+ *      for runs at the best of their levels until it lets go (see
+ *      priority inheritance in synch.c). Quanta still go by the
+ *      thread's own level.
+ */
+
+/* Quantum, in hardclocks, for each level: 1, 2, 4, ... */
+#define SCHED_QUANTUM(level)	(1U << (level))
+
+/*
+ * Called from hardclock() on every tick.
+ */
+void
+thread_timeslice(void)
+{
+	struct thread *cur;
+	bool preempt;
+
+	cur = curthread;
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	if (curcpu->c_isidle) {
+		/* The timer interrupted the idle loop; nobody to charge. */
+		spinlock_release(&curcpu->c_runqueue_lock);
+		return;
+	}
+
+	cur->t_ticks++;
+	if (cur->t_ticks >= SCHED_QUANTUM(cur->t_priority)) {
+		/* Used the whole quantum; demote and start a new one. */
+		if (cur->t_priority < NPRIORITIES - 1) {
+			cur->t_priority++;
+		}
+		cur->t_ticks = 0;
+		preempt = true;
+	}
+	else if (!thread_allowed(cur, curcpu->c_self)) {
+		/* Affinity changed; get off this cpu (see thread_switch). */
+		preempt = true;
+	}
+	else {
+		/* Only something more important can cut the quantum short. */
+		preempt = cpu_runqueue_toplevel(curcpu->c_self) <
+			thread_level(cur);
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	if (preempt) {
+		thread_yield();
+	}
+}
+
+/*
+ * Priority boost.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * This is called periodically from hardclock(). Move every thread on
+ * the current cpu's run queues, and the current thread, back to the
+ * top level.
  */
-
 void
 schedule(void)
 {
-	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
-	 */
+	struct thread *t;
+	unsigned i;
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	for (i=1; i<NPRIORITIES; i++) {
+		while ((t = threadlist_remhead(&curcpu->c_runqueue[i])) != NULL) {
+			t->t_priority = 0;
+			t->t_ticks = 0;
+			threadlist_addtail(&curcpu->c_runqueue[0], t);
+		}
+	}
+	curcpu->c_runqueue_mask = curcpu->c_runqueue_count > 0 ? 1 : 0;
+	if (!curcpu->c_isidle) {
+		curthread->t_priority = 0;
+		curthread->t_ticks = 0;
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
 }
 
 /*
- * Thread migration.
- *
- * This is also called periodically from hardclock(). If the current
- * CPU is busy and other CPUs are idle, or less busy, it should move
- * threads across to those other other CPUs.
- *
- * Migrating threads isn't free because of cache affinity; a thread's
- * working cache set will end up having to be moved to the other CPU,
- * which is fairly slow. The tradeoff between this performance loss
- * and the performance loss due to underutilization of some CPUs is
- * something that needs to be tuned and probably is workload-specific.
- *
- * For here and now, because we know we're running on System/161 and
- * System/161 does not (yet) model such cache effects, we'll be very
- * aggressive.
+ * Priority inheritance hooks for synch.c.
+ */
+unsigned
+thread_priority(struct thread *t)
+{
+	return thread_level(t);
+}
+
+/*
+ * Change T's inherited level. If T is waiting on a run queue, it has
+ * to move to the queue for its new level, so this needs T's cpu's
+ * run queue lock; T may be migrated while we're getting it, so check
+ * that it's still the right cpu once we have it. Everything that
+ * changes t_cpu (stealing, thread_push, thread_rehome) holds the old
+ * cpu's run queue lock, so after that it can't change under us.
  */
 void
-thread_consider_migration(void)
+thread_setinherited(struct thread *t, unsigned level)
 {
-	unsigned my_count, total_count, one_share, to_send;
-	unsigned i, numcpus;
 	struct cpu *c;
-	struct threadlist victims;
-	struct thread *t;
 
-	my_count = total_count = 0;
-	numcpus = cpuarray_num(&allcpus);
-	for (i=0; i<numcpus; i++) {
-		c = cpuarray_get(&allcpus, i);
+	KASSERT(level <= NPRIORITIES);
+
+	while (1) {
+		c = t->t_cpu;
 		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
-		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+		if (t->t_cpu == c) {
+			break;
 		}
 		spinlock_release(&c->c_runqueue_lock);
 	}
 
-	one_share = DIVROUNDUP(total_count, numcpus);
-	if (my_count < one_share) {
-		return;
+	if (t->t_state == S_READY) {
+		cpu_runqueue_remove(c, t);
+		t->t_inherited = level;
+		cpu_runqueue_add(c, t);
 	}
+	else {
+		t->t_inherited = level;
+	}
+
+	spinlock_release(&c->c_runqueue_lock);
+}
+
+/*
+ * Thread migration.
+ *
+ * This is also called periodically from hardclock(). If the busiest
+ * other cpu has at least two more threads waiting than we do, pull
+ * half the difference over here. (Idle cpus don't wait for this; see
+ * the idle loop in thread_switch.)
+ */
+void
+thread_consider_migration(void)
+{
+	struct cpu *victim;
+	unsigned my_count, their_count;
 
-	to_send = my_count - one_share;
-	threadlist_init(&victims);
 	spinlock_acquire(&curcpu->c_runqueue_lock);
-	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
+	my_count = curcpu->c_runqueue_count;
+	victim = thread_find_busiest(&their_count);
+	if (victim != NULL && their_count > my_count + 1) {
+		thread_steal(victim, (their_count - my_count) / 2, false);
 	}
 	spinlock_release(&curcpu->c_runqueue_lock);
+}
 
-	for (i=0; i < numcpus && to_send > 0; i++) {
-		c = cpuarray_get(&allcpus, i);
-		if (c == curcpu->c_self) {
-			continue;
-		}
-		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
-			t = threadlist_remhead(&victims);
-			/*
-			 * Ordinarily, curthread will not appear on
-			 * the run queue. However, it can under the
-			 * following circumstances:
-			 *   - it went to sleep;
-			 *   - the processor became idle, so it
-			 *     remained curthread;
-			 *   - it was reawakened, so it was put on the
-			 *     run queue;
-			 *   - and the processor hasn't fully unidled
-			 *     yet, so all these things are still true.
-			 *
-			 * If the timer interrupt happens at (almost)
-			 * exactly the proper moment, we can come here
-			 * while things are in this state and see
-			 * curthread. However, *migrating* curthread
-			 * can cause bad things to happen (Exercise:
-			 * Why? And what?) so shuffle it to the end of
-			 * the list and decrement to_send in order to
-			 * skip it. Then it goes back on our own run
-			 * queue below.
-			 */
-			if (t == curthread) {
-				threadlist_addtail(&victims, t);
-				to_send--;
-				continue;
-			}
+/*
+ * Set the current thread's cpu affinity mask. Bit N of MASK allows
+ * cpu number N. At least one cpu in the mask must exist.
+ *
+ * If the current cpu is no longer allowed we yield so thread_switch
+ * can send us elsewhere. Note that if there's nothing else to run
+ * here we will keep running here until there is (or until we next
+ * sleep), because without a thread to switch to, this cpu has to
+ * idle on our stack and our context can't be handed to another cpu.
+ */
+int
+thread_setaffinity(uint32_t mask)
+{
+	struct cpu *c;
+	unsigned i, numcpus;
+	bool ok;
 
-			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
-			DEBUG(DB_THREADS,
-			      "Migrated thread %s: cpu %u -> %u",
-			      t->t_name, curcpu->c_number, c->c_number);
-			to_send--;
-			if (c->c_isidle) {
-				/*
-				 * Other processor is idle; send
-				 * interrupt to make sure it unidles.
-				 */
-				ipi_send(c, IPI_UNIDLE);
-			}
+	ok = false;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (mask & ((uint32_t)1 << c->c_number)) {
+			ok = true;
+			break;
 		}
-		spinlock_release(&c->c_runqueue_lock);
+	}
+	if (!ok) {
+		return EINVAL;
 	}
 
-	/*
-	 * Because the code above isn't atomic, the thread counts may have
-	 * changed while we were working and we may end up with leftovers.
-	 * Don't panic; just put them back on our own run queue.
-	 */
-	if (!threadlist_isempty(&victims)) {
-		spinlock_acquire(&curcpu->c_runqueue_lock);
-		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
-		}
-		spinlock_release(&curcpu->c_runqueue_lock);
+	curthread->t_affinity = mask;
+	if (!thread_allowed(curthread, curcpu->c_self)) {
+		thread_yield();
 	}
+	return 0;
+}
 
-	KASSERT(threadlist_isempty(&victims));
-	threadlist_cleanup(&victims);
+/*
+ * Get the current thread's cpu affinity mask.
+ */
+uint32_t
+thread_getaffinity(void)
+{
+	return curthread->t_affinity;
 }
 
 ////////////////////////////////////////////////////////////
@@ -1019,6 +1781,74 @@ wchan_sleep(struct wchan *wc, struct spinlock *lk)
 	spinlock_acquire(lk);
 }
 
+/*
+ * Same, but the sleep can be cut short by thread_interrupt, in which
+ * case (or if the thread has already been interrupted) EINTR is
+ * returned instead of 0. The caller has to cope with being woken up
+ * and interrupted at the same time.
+ *
+ * thread_interrupt may get to LK after the thread has woken up and
+ * gone on its way, so WC and LK must be ones that are never
+ * destroyed, such as the sleep queue chains. The thread also must not
+ * be moved to another wchan with wchan_transfer while asleep.
+ */
+int
+wchan_sleep_intr(struct wchan *wc, struct spinlock *lk)
+{
+	struct thread *cur = curthread;
+
+	KASSERT(spinlock_do_i_hold(lk));
+
+	cur->t_intrwchan = wc;
+	cur->t_intrlock = lk;
+	membar_any_any();
+	if (!cur->t_interrupted) {
+		wchan_sleep(wc, lk);
+	}
+	cur->t_intrwchan = NULL;
+	cur->t_intrlock = NULL;
+
+	return cur->t_interrupted ? EINTR : 0;
+}
+
+/*
+ * Interrupt T; see thread.h. Publishing t_interrupted before looking
+ * at t_intrlock (and wchan_sleep_intr doing the reverse) means that
+ * either we see the sleep and take the thread off its wchan, or the
+ * thread sees the flag and doesn't sleep.
+ */
+void
+thread_interrupt(struct thread *t)
+{
+	struct spinlock *lk;
+	struct wchan *wc;
+	struct thread *t2;
+
+	t->t_interrupted = true;
+	membar_any_any();
+	lk = t->t_intrlock;
+	if (lk == NULL) {
+		return;
+	}
+
+	/*
+	 * If the thread is still in the same sleep, it's on the wchan.
+	 * (t_state isn't good enough: it's set after LK is released.)
+	 */
+	spinlock_acquire(lk);
+	if (t->t_intrlock == lk) {
+		wc = t->t_intrwchan;
+		THREADLIST_FORALL(t2, wc->wc_threads) {
+			if (t2 == t) {
+				threadlist_remove(&wc->wc_threads, t);
+				thread_make_runnable(t, false);
+				break;
+			}
+		}
+	}
+	spinlock_release(lk);
+}
+
 /*
  * Wake up one thread sleeping on a wait channel.
  */
@@ -1081,6 +1911,310 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	threadlist_cleanup(&list);
 }
 
+/*
+ * Move sleeping threads from one wait channel to another.
+ */
+unsigned
+wchan_transfer(struct wchan *from, struct spinlock *fromlk,
+	       struct wchan *to, struct spinlock *tolk, bool all)
+{
+	struct thread *target;
+	unsigned count;
+
+	KASSERT(spinlock_do_i_hold(fromlk));
+	KASSERT(spinlock_do_i_hold(tolk));
+
+	count = 0;
+	while ((target = threadlist_remhead(&from->wc_threads)) != NULL) {
+		KASSERT(target->t_intrlock == NULL);
+		target->t_wchan_name = to->wc_name;
+		threadlist_addtail(&to->wc_threads, target);
+		count++;
+		if (!all) {
+			break;
+		}
+	}
+	return count;
+}
+
+/*
+ * Keyed sleeping: a wait channel shared by many objects, with each
+ * sleeping thread tagged with the object (KEY) it's waiting for. This
+ * is what sleepq.c is built on.
+ */
+void
+wchan_sleepkey(struct wchan *wc, struct spinlock *lk, const void *key)
+{
+	KASSERT(key != NULL);
+
+	curthread->t_sleepkey = key;
+	wchan_sleep(wc, lk);
+	curthread->t_sleepkey = NULL;
+}
+
+int
+wchan_sleepkey_intr(struct wchan *wc, struct spinlock *lk, const void *key)
+{
+	int result;
+
+	KASSERT(key != NULL);
+
+	curthread->t_sleepkey = key;
+	result = wchan_sleep_intr(wc, lk);
+	curthread->t_sleepkey = NULL;
+	return result;
+}
+
+/*
+ * Wake the first thread, or all threads, on WC waiting for KEY.
+ * Returns the number woken.
+ */
+unsigned
+wchan_wakekey(struct wchan *wc, struct spinlock *lk, const void *key,
+	      bool all)
+{
+	struct thread *target, *next;
+	struct threadlist list;
+	unsigned count;
+
+	KASSERT(spinlock_do_i_hold(lk));
+	KASSERT(key != NULL);
+
+	threadlist_init(&list);
+	count = 0;
+	for (target = wc->wc_threads.tl_head.tln_next->tln_self;
+	     target != NULL; target = next) {
+		next = target->t_listnode.tln_next->tln_self;
+		if (target->t_sleepkey != key) {
+			continue;
+		}
+		threadlist_remove(&wc->wc_threads, target);
+		threadlist_addtail(&list, target);
+		count++;
+		if (!all) {
+			break;
+		}
+	}
+
+	/* As in wchan_wakeall. */
+	while ((target = threadlist_remhead(&list)) != NULL) {
+		thread_make_runnable(target, false);
+	}
+	threadlist_cleanup(&list);
+
+	return count;
+}
+
+/*
+ * Move the first thread, or all threads, waiting for FROMKEY on FROM
+ * over to TO, to wait for TOKEY instead, and let the caller know
+ * about each one through MOVED. FROM and TO (and their spinlocks) may
+ * be the same. Returns the number moved.
+ */
+unsigned
+wchan_transferkey(struct wchan *from, struct spinlock *fromlk,
+		  const void *fromkey, struct wchan *to,
+		  struct spinlock *tolk, const void *tokey, bool all,
+		  void (*moved)(struct thread *, void *), void *data)
+{
+	struct thread *target, *next;
+	struct threadlist list;
+	unsigned count;
+
+	KASSERT(spinlock_do_i_hold(fromlk));
+	KASSERT(spinlock_do_i_hold(tolk));
+	KASSERT(fromkey != NULL && tokey != NULL);
+
+	/* Collect them first, in case FROM and TO are the same. */
+	threadlist_init(&list);
+	count = 0;
+	for (target = from->wc_threads.tl_head.tln_next->tln_self;
+	     target != NULL; target = next) {
+		next = target->t_listnode.tln_next->tln_self;
+		if (target->t_sleepkey != fromkey) {
+			continue;
+		}
+		KASSERT(target->t_intrlock == NULL);
+		threadlist_remove(&from->wc_threads, target);
+		threadlist_addtail(&list, target);
+		count++;
+		if (!all) {
+			break;
+		}
+	}
+	while ((target = threadlist_remhead(&list)) != NULL) {
+		target->t_wchan_name = to->wc_name;
+		target->t_sleepkey = tokey;
+		threadlist_addtail(&to->wc_threads, target);
+		if (moved != NULL) {
+			moved(target, data);
+		}
+	}
+	threadlist_cleanup(&list);
+
+	return count;
+}
+
+/*
+ * Return true if any thread on WC is waiting for KEY. Like
+ * wchan_isempty, for diagnostics.
+ */
+bool
+wchan_haskey(struct wchan *wc, struct spinlock *lk, const void *key)
+{
+	struct thread *t;
+
+	KASSERT(spinlock_do_i_hold(lk));
+
+	THREADLIST_FORALL(t, wc->wc_threads) {
+		if (t->t_sleepkey == key) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Timeout callout for wchan_timeout_arm. Runs in interrupt context.
+ *
+ * If the thread is still on the channel, waiting for the same key it
+ * went to sleep with, take it off and wake it; that's a timeout.
+ * Either way, mark the timeout expired so the thread notices the
+ * next time it checks. Once wt_done is set the thread may return
+ * and free WT (and the object holding the wchan and spinlock), so
+ * it must be the last thing we touch.
+ */
+static
+void
+wchan_timeout_fire(void *data)
+{
+	struct wchan_timeout *wt = data;
+	struct spinlock *lk;
+	struct thread *t;
+
+	lk = wt->wt_lock;
+	spinlock_acquire(lk);
+	wt->wt_expired = true;
+	THREADLIST_FORALL(t, wt->wt_wchan->wc_threads) {
+		if (t == wt->wt_thread) {
+			if (t->t_sleepkey == wt->wt_key) {
+				threadlist_remove(&wt->wt_wchan->wc_threads,
+						  t);
+				thread_make_runnable(t, false);
+				wt->wt_timedout = true;
+			}
+			break;
+		}
+	}
+	spinlock_release(lk);
+
+	membar_any_any();
+	wt->wt_done = true;
+}
+
+/*
+ * Arm a timeout of TICKS hardclocks for the current thread's wait on
+ * WC. With TICKS of 0 the timeout is expired from the start, which
+ * allows polling.
+ */
+void
+wchan_timeout_arm(struct wchan_timeout *wt, struct wchan *wc,
+		  struct spinlock *lk, unsigned ticks)
+{
+	wchan_timeout_armkey(wt, wc, lk, NULL, ticks);
+}
+
+/*
+ * Same, for a wait on WC for KEY.
+ */
+void
+wchan_timeout_armkey(struct wchan_timeout *wt, struct wchan *wc,
+		     struct spinlock *lk, const void *key, unsigned ticks)
+{
+	KASSERT(spinlock_do_i_hold(lk));
+
+	wt->wt_thread = curthread;
+	wt->wt_wchan = wc;
+	wt->wt_lock = lk;
+	wt->wt_key = key;
+	wt->wt_expired = (ticks == 0);
+	wt->wt_timedout = (ticks == 0);
+	wt->wt_done = (ticks == 0);
+	callout_init(&wt->wt_callout, wchan_timeout_fire, wt);
+	if (ticks > 0) {
+		callout_schedule(&wt->wt_callout, ticks);
+	}
+}
+
+/*
+ * Check if the timeout has gone off.
+ */
+bool
+wchan_timeout_expired(struct wchan_timeout *wt)
+{
+	KASSERT(spinlock_do_i_hold(wt->wt_lock));
+	return wt->wt_expired;
+}
+
+/*
+ * Check if the wait ended because of the timeout: either the timeout
+ * took the thread off the channel, or it had already expired when the
+ * thread went to sleep. (With plain wchan_sleep the thread holds the
+ * spinlock from arming the timeout until it's asleep, so the latter
+ * only happens with a timeout of 0.)
+ */
+bool
+wchan_timeout_timedout(struct wchan_timeout *wt)
+{
+	KASSERT(spinlock_do_i_hold(wt->wt_lock));
+	return wt->wt_timedout;
+}
+
+/*
+ * Sleep on WC for KEY, unless the timeout has already expired.
+ */
+void
+wchan_sleepkey_timeout(struct wchan *wc, struct spinlock *lk,
+		       const void *key, struct wchan_timeout *wt)
+{
+	KASSERT(wt->wt_lock == lk);
+	KASSERT(wt->wt_key == key);
+
+	if (wt->wt_expired) {
+		wt->wt_timedout = true;
+		return;
+	}
+	wchan_sleepkey(wc, lk, key);
+}
+
+/*
+ * Cancel the timeout, or if it's too late for that, wait until the
+ * callout has let go of it.
+ */
+void
+wchan_timeout_disarm(struct wchan_timeout *wt)
+{
+	KASSERT(spinlock_do_i_hold(wt->wt_lock));
+	KASSERT(wt->wt_thread == curthread);
+
+	if (wt->wt_done || callout_stop(&wt->wt_callout)) {
+		return;
+	}
+
+	/*
+	 * The callout has been taken off the wheel and is about to
+	 * run, or is running, on another cpu. (It can't be this cpu:
+	 * callouts run to completion at interrupt level.) It needs
+	 * our spinlock to finish.
+	 */
+	spinlock_release(wt->wt_lock);
+	while (!wt->wt_done) {
+		/* spin */
+	}
+	membar_any_any();
+	spinlock_acquire(wt->wt_lock);
+}
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
@@ -0,0 +1,351 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Workqueues: per-cpu worker threads that run deferred work.
+ *
+ * Locking: each queue's spinlock protects its list, its wq_running,
+ * and the state of every work item whose wk_queue points at it. The
+ * wk_queue field itself only changes while the item is idle, which
+ * the caller (who serializes operations on the item) can see. The
+ * callout for delayed work is scheduled and stopped with the queue
+ * lock held, so the lock order is queue lock, then callwheel lock;
+ * the callout function takes the queue lock itself (callout functions
+ * are called without the callwheel lock).
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <cpu.h>
+#include <current.h>
+#include <workqueue.h>
+
+/*
+ * Set up a queue. Called from cpu_create.
+ */
+void
+workq_init(struct workq *wq)
+{
+	spinlock_init(&wq->wq_lock);
+	spinlock_setname(&wq->wq_lock, "workq");
+	wq->wq_head = NULL;
+	wq->wq_tailp = &wq->wq_head;
+	wq->wq_wchan = wchan_create("workq");
+	wq->wq_donewchan = wchan_create("workdone");
+	if (wq->wq_wchan == NULL || wq->wq_donewchan == NULL) {
+		panic("workq_init: Out of memory\n");
+	}
+	wq->wq_running = NULL;
+	wq->wq_worker = NULL;
+}
+
+/*
+ * Append to the tail of the queue and poke the worker. Queue must be
+ * locked.
+ */
+static
+void
+workq_append(struct workq *wq, struct work *wk)
+{
+	KASSERT(spinlock_do_i_hold(&wq->wq_lock));
+	KASSERT(wk->wk_queue == wq);
+
+	wk->wk_next = NULL;
+	wk->wk_prevp = wq->wq_tailp;
+	*wq->wq_tailp = wk;
+	wq->wq_tailp = &wk->wk_next;
+	wk->wk_state = WORK_QUEUED;
+	wchan_wakeone(wq->wq_wchan, &wq->wq_lock);
+}
+
+/*
+ * Unlink from the queue. Queue must be locked.
+ */
+static
+void
+workq_remove(struct workq *wq, struct work *wk)
+{
+	KASSERT(spinlock_do_i_hold(&wq->wq_lock));
+	KASSERT(wk->wk_state == WORK_QUEUED);
+
+	*wk->wk_prevp = wk->wk_next;
+	if (wk->wk_next != NULL) {
+		wk->wk_next->wk_prevp = wk->wk_prevp;
+	}
+	else {
+		wq->wq_tailp = wk->wk_prevp;
+	}
+	wk->wk_next = NULL;
+	wk->wk_prevp = NULL;
+	wk->wk_state = WORK_IDLE;
+}
+
+/*
+ * Callout function for delayed work: move it onto its queue.
+ * Runs in interrupt context.
+ */
+static
+void
+work_timeout(void *arg)
+{
+	struct work *wk = arg;
+	struct workq *wq;
+
+	wq = wk->wk_queue;
+	spinlock_acquire(&wq->wq_lock);
+	if (wk->wk_state == WORK_DELAYED) {
+		workq_append(wq, wk);
+	}
+	spinlock_release(&wq->wq_lock);
+}
+
+/*
+ * Set up a work item.
+ */
+void
+work_init(struct work *wk, void (*func)(void *), void *arg)
+{
+	wk->wk_next = NULL;
+	wk->wk_prevp = NULL;
+	wk->wk_queue = NULL;
+	wk->wk_state = WORK_IDLE;
+	callout_init(&wk->wk_callout, work_timeout, wk);
+	wk->wk_func = func;
+	wk->wk_arg = arg;
+}
+
+/*
+ * Check if a work item is idle, that is, not on any queue and not
+ * waiting for its delay to run out.
+ */
+static
+bool
+work_idle(struct work *wk)
+{
+	struct workq *wq;
+	bool ret;
+
+	wq = wk->wk_queue;
+	if (wq == NULL) {
+		return true;
+	}
+	spinlock_acquire(&wq->wq_lock);
+	ret = wk->wk_state == WORK_IDLE;
+	spinlock_release(&wq->wq_lock);
+
+	/*
+	 * Only the caller can take it out of the idle state, so this
+	 * stays true after we let go of the lock.
+	 */
+	return ret;
+}
+
+/*
+ * Queue work to run on the current cpu.
+ */
+bool
+work_queue(struct work *wk)
+{
+	struct workq *wq;
+
+	if (!work_idle(wk)) {
+		return false;
+	}
+
+	/*
+	 * If we migrate after looking at curcpu, the work just goes
+	 * to the cpu we were on, which is fine.
+	 */
+	wq = &curcpu->c_workq;
+	spinlock_acquire(&wq->wq_lock);
+	wk->wk_queue = wq;
+	workq_append(wq, wk);
+	spinlock_release(&wq->wq_lock);
+	return true;
+}
+
+/*
+ * Queue work to run on the current cpu after TICKS hardclocks.
+ */
+bool
+work_queue_delayed(struct work *wk, unsigned ticks)
+{
+	struct workq *wq;
+
+	if (!work_idle(wk)) {
+		return false;
+	}
+
+	wq = &curcpu->c_workq;
+	spinlock_acquire(&wq->wq_lock);
+	wk->wk_queue = wq;
+	wk->wk_state = WORK_DELAYED;
+	callout_schedule(&wk->wk_callout, ticks);
+	spinlock_release(&wq->wq_lock);
+	return true;
+}
+
+/*
+ * Cancel work that hasn't started yet.
+ */
+bool
+work_cancel(struct work *wk)
+{
+	struct workq *wq;
+	bool ret;
+
+	KASSERT(!curthread->t_in_interrupt);
+
+	wq = wk->wk_queue;
+	if (wq == NULL) {
+		return false;
+	}
+
+	ret = false;
+	spinlock_acquire(&wq->wq_lock);
+	if (wk->wk_state == WORK_DELAYED) {
+		if (callout_stop(&wk->wk_callout)) {
+			wk->wk_state = WORK_IDLE;
+			spinlock_release(&wq->wq_lock);
+			return true;
+		}
+		/*
+		 * The callout is firing right now on some cpu and
+		 * waiting for the queue lock. Let it in to put the work
+		 * on the queue; otherwise if we marked it idle and the
+		 * caller requeued it, the stale callout would find it
+		 * delayed again and queue it early.
+		 */
+		while (wk->wk_state == WORK_DELAYED) {
+			spinlock_release(&wq->wq_lock);
+			spinlock_acquire(&wq->wq_lock);
+		}
+	}
+	if (wk->wk_state == WORK_QUEUED) {
+		workq_remove(wq, wk);
+		ret = true;
+	}
+	spinlock_release(&wq->wq_lock);
+	return ret;
+}
+
+/*
+ * Cancel work and wait for it if it's running.
+ */
+void
+work_drain(struct work *wk)
+{
+	struct workq *wq;
+
+	work_cancel(wk);
+
+	wq = wk->wk_queue;
+	if (wq == NULL) {
+		return;
+	}
+	KASSERT(wq->wq_running != wk || curthread != wq->wq_worker);
+
+	spinlock_acquire(&wq->wq_lock);
+	while (wq->wq_running == wk) {
+		wchan_sleep(wq->wq_donewchan, &wq->wq_lock);
+	}
+	spinlock_release(&wq->wq_lock);
+}
+
+/*
+ * The worker thread for a cpu. Runs work in the order queued.
+ *
+ * Once the work function is called we don't touch the work item
+ * again (it might have been freed); we only compare its address in
+ * wq_running, for work_drain.
+ */
+static
+void
+workq_worker(void *data1, unsigned long num)
+{
+	struct workq *wq = data1;
+	struct work *wk;
+	void (*func)(void *);
+	void *arg;
+	int result;
+
+	/* Move to our cpu and stay there. */
+	result = thread_setaffinity((uint32_t)1 << num);
+	KASSERT(result == 0);
+
+	spinlock_acquire(&wq->wq_lock);
+	wq->wq_worker = curthread;
+	while (1) {
+		while (wq->wq_head == NULL) {
+			wchan_sleep(wq->wq_wchan, &wq->wq_lock);
+		}
+		wk = wq->wq_head;
+		workq_remove(wq, wk);
+		func = wk->wk_func;
+		arg = wk->wk_arg;
+		wq->wq_running = wk;
+		spinlock_release(&wq->wq_lock);
+
+		func(arg);
+
+		spinlock_acquire(&wq->wq_lock);
+		wq->wq_running = NULL;
+		wchan_wakeall(wq->wq_donewchan, &wq->wq_lock);
+	}
+}
+
+/*
+ * Start a worker thread for each cpu. Called from boot() once the
+ * secondary cpus are up.
+ */
+void
+workqueue_bootstrap(void)
+{
+	struct cpu *c;
+	char name[16];
+	unsigned i, numcpus;
+	int result;
+
+	numcpus = cpu_count();
+	for (i=0; i<numcpus; i++) {
+		c = cpu_get(i);
+		/* The affinity mask has one bit per cpu. */
+		KASSERT(c->c_number < 32);
+		snprintf(name, sizeof(name), "workq/%u", c->c_number);
+		result = thread_fork(name, NULL, workq_worker,
+				     &c->c_workq, c->c_number);
+		if (result) {
+			panic("workqueue_bootstrap: thread_fork: %s\n",
+			      strerror(result));
+		}
+	}
+}
@@ -48,6 +48,24 @@
  *
  */
 
+/*
+ * Give back the page behind a page table entry: shared text pages go
+ * back to the text cache, private ones to the frame allocator.
+ */
+static
+void
+as_unmap(paddr_t pte)
+{
+	paddr_t paddr = pte & PAGE_FRAME;
+
+	if (pte & PTE_SHARED) {
+		textcache_put(paddr);
+	}
+	else {
+		free_kpages(PADDR_TO_KVADDR(paddr));
+	}
+}
+
 struct addrspace *
 as_create(void)
 {
@@ -57,6 +75,16 @@ as_create(void)
 	if (as == NULL) {
 		return NULL;
 	}
+	// empty first level of the page table
+	as->pagetable = kmalloc(1024 * sizeof(paddr_t *));
+	if (as->pagetable == NULL) {
+		kfree(as);
+		return NULL;
+	}
+	for (int i = 0; i < 1024; i++) {
+		as->pagetable[i] = NULL;
+	}
+	spinlock_init(&as->as_lock);
 	// start with no regions
 	as->head = NULL;	
 	as->stackbase = USERSTACK;
@@ -68,40 +96,81 @@ int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	struct addrspace *newas;
+	vaddr_t kva;
+	paddr_t pte;
+	int result;
 
 	newas = as_create();
 	if (newas == NULL) {
 		return ENOMEM;
 	}
 
+	// other threads of the process may be faulting pages in while
+	// we copy, so hold the page table still
+	spinlock_acquire(&old->as_lock);
+
 	newas->stackbase = old->stackbase;
-	newas->nregions = old->nregions;
-	// if no regions return
-	if (old->head == NULL) {
-		newas->head = NULL;
-		return 0;
-	}
 	// copy all regions
 	struct region_node *pointer = old->head;
-	int first = 1;
 	struct region_node *prev =  NULL;
 	while (pointer != NULL) {
 		struct region_node *new_node = kmalloc(sizeof(struct region_node));
-		struct region *new_region = kmalloc(sizeof(struct region));
-		memcpy((void *)new_region, (void *)&pointer->region, sizeof(pointer->region));
-		new_node->region = *new_region;
+		if (new_node == NULL) {
+			spinlock_release(&old->as_lock);
+			as_destroy(newas);
+			return ENOMEM;
+		}
+		new_node->region = pointer->region;
 		new_node->next = NULL;
-		if (first) {
+		if (prev == NULL) {
 			newas->head = new_node;
-			first = 0;
 		}
-		if (prev != NULL) {
+		else {
 			prev->next = new_node;
 		}
+		newas->nregions++;
 		prev = new_node;
 		pointer = pointer->next;
 	}
-	newas = old;
+
+	// copy the page table: private pages are copied, shared text
+	// pages just get another reference
+	for (int i = 0; i < 1024; i++) {
+		if (old->pagetable[i] == NULL) {
+			continue;
+		}
+		for (int j = 0; j < 1024; j++) {
+			pte = old->pagetable[i][j];
+			if (pte == 0) {
+				continue;
+			}
+			if (pte & PTE_SHARED) {
+				// no tc_lock needed; see textcache.c
+				share_kpage(PADDR_TO_KVADDR(pte & PAGE_FRAME));
+			}
+			else {
+				kva = alloc_kpages(1);
+				if (kva == 0) {
+					spinlock_release(&old->as_lock);
+					as_destroy(newas);
+					return ENOMEM;
+				}
+				memmove((void *)kva,
+					(const void *)PADDR_TO_KVADDR(pte & PAGE_FRAME),
+					PAGE_SIZE);
+				pte = KVADDR_TO_PADDR(kva) | (pte & PTE_WRITABLE);
+			}
+			result = insert_pt(newas, (i << 22) | (j << 12), pte);
+			if (result) {
+				spinlock_release(&old->as_lock);
+				as_unmap(pte);
+				as_destroy(newas);
+				return result;
+			}
+		}
+	}
+	spinlock_release(&old->as_lock);
+
 	*ret = newas;
 	return 0;
 }
@@ -109,16 +178,29 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 void
 as_destroy(struct addrspace *as)
 {
+	// give back every mapped page, then the page table
+	for (int i = 0; i < 1024; i++) {
+		if (as->pagetable[i] == NULL) {
+			continue;
+		}
+		for (int j = 0; j < 1024; j++) {
+			if (as->pagetable[i][j] != 0) {
+				as_unmap(as->pagetable[i][j]);
+			}
+		}
+		kfree(as->pagetable[i]);
+	}
+	kfree(as->pagetable);
+	spinlock_cleanup(&as->as_lock);
+
 	// free all nodes then free as
-	/*
 	struct region_node *pointer = as->head;
-	struct region_node *next = as->head->next;
+	struct region_node *next;
 	while (pointer != NULL) {
-		kfree(&pointer->region);
 		next = pointer->next;
+		kfree(pointer);
 		pointer = next;
 	}
-	*/
 	kfree(as);
 }
 
@@ -246,14 +328,29 @@ as_prepare_load(struct addrspace *as)
 int
 as_complete_load(struct addrspace *as)
 {
+	int result;
 	struct region_node *pointer = as->head;
 	while (pointer != NULL) {
 		if (pointer->region.was_readonly) {
 			pointer->region.writeable = 0;
+			// pages written during the load become readonly too
+			for (size_t i = 0; i < pointer->region.npages; i++) {
+				vaddr_t vaddr = pointer->region.base + i * PAGE_SIZE;
+				paddr_t pte = lookup_pt(as, vaddr);
+				if (pte & PTE_WRITABLE) {
+					// the second level table exists, so
+					// this can't run out of memory
+					result = insert_pt(as, vaddr,
+							   pte & ~PTE_WRITABLE);
+					KASSERT(result == 0);
+				}
+			}
 		}
 		pointer = pointer->next;
 	}
-	
+
+	// and get rid of their writable tlb entries
+	as_activate();
 
 	return 0;
 }
@@ -261,11 +358,89 @@ as_complete_load(struct addrspace *as)
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
-	as_define_region(as, USERSTACK - 16 * PAGE_SIZE, 16 * PAGE_SIZE, 1, 1, 1);
+	as_define_region(as, USERSTACK - STACKPAGES * PAGE_SIZE,
+			 STACKPAGES * PAGE_SIZE, 1, 1, 1);
 
 	/* Initial user-level stack pointer */
 	*stackptr = USERSTACK;
-	as->stackbase = 16 * PAGE_SIZE;
+	as->stackbase = STACKPAGES * PAGE_SIZE;
 
 	return 0;
 }
+
+int
+as_define_stack_pages(struct addrspace *as, const vaddr_t *pages,
+		      unsigned npages, vaddr_t *stackptr)
+{
+	vaddr_t vaddr;
+	unsigned i;
+	int result;
+
+	if (npages > STACKPAGES) {
+		return E2BIG;
+	}
+
+	result = as_define_stack(as, stackptr);
+	if (result) {
+		return result;
+	}
+
+	// map the pages straight in as the top of the stack
+	vaddr = USERSTACK - npages * PAGE_SIZE;
+	for (i = 0; i < npages; i++) {
+		result = insert_pt(as, vaddr + i * PAGE_SIZE,
+				   KVADDR_TO_PADDR(pages[i]) | PTE_WRITABLE);
+		if (result) {
+			// take back the ones already in
+			while (i-- > 0) {
+				insert_pt(as, vaddr + i * PAGE_SIZE, 0);
+			}
+			return result;
+		}
+	}
+
+	*stackptr = vaddr;
+	return 0;
+}
+
+int
+as_map_text(struct addrspace *as, struct vnode *v, off_t offset,
+	    vaddr_t vaddr, unsigned npages)
+{
+	vaddr_t va;
+	paddr_t paddr, pte;
+	bool replaced = false;
+	unsigned i;
+	int result;
+
+	KASSERT(vaddr % PAGE_SIZE == 0);
+	KASSERT(offset % PAGE_SIZE == 0);
+
+	result = 0;
+	for (i = 0; i < npages; i++) {
+		va = vaddr + i * PAGE_SIZE;
+
+		result = textcache_get(v, offset + i * PAGE_SIZE, &paddr);
+		if (result) {
+			// the pages already mapped go with the address space
+			break;
+		}
+
+		// a mis-linked executable may already have this page
+		pte = lookup_pt(as, va);
+		result = insert_pt(as, va, paddr | PTE_SHARED);
+		if (result) {
+			textcache_put(paddr);
+			break;
+		}
+		if (pte != 0) {
+			as_unmap(pte);
+			replaced = true;
+		}
+	}
+
+	if (replaced) {
+		as_activate();
+	}
+	return result;
+}
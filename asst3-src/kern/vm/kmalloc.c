@@ -30,6 +30,7 @@
 #include <types.h>
 #include <lib.h>
 #include <spinlock.h>
+#include <thread.h>
 #include <vm.h>
 
 /*
@@ -164,9 +165,12 @@ struct pageref {
  * logic per-cpu is worthwhile for scalability; however, for the time
  * being at least we won't, because it adds a lot of complexity and in
  * OS/161 performance and scalability aren't super-critical.
+ *
+ * Since every cpu comes through here, it's a ticket lock, so that
+ * when it is contended the cpus at least take turns.
  */
 
-static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
+static struct spinlock kmalloc_spinlock = SPINLOCK_TICKET_INITIALIZER;
 
 ////////////////////////////////////////
 
@@ -866,6 +870,23 @@ int blocktype(size_t clientsz)
 	return 0;
 }
 
+/*
+ * Get pages from alloc_kpages. If there aren't any, have the thread
+ * system give back its spare stacks and try once more.
+ */
+static
+vaddr_t
+kmalloc_getpages(unsigned long npages)
+{
+	vaddr_t address;
+
+	address = alloc_kpages(npages);
+	if (address == 0 && thread_stack_drain()) {
+		address = alloc_kpages(npages);
+	}
+	return address;
+}
+
 /*
  * Allocate a block of size SZ, where SZ is not large enough to
  * warrant a whole-page allocation.
@@ -964,7 +985,7 @@ subpage_kmalloc(size_t sz
 	 */
 
 	spinlock_release(&kmalloc_spinlock);
-	prpage = alloc_kpages(1);
+	prpage = kmalloc_getpages(1);
 	if (prpage==0) {
 		/* Out of memory. */
 		kprintf("kmalloc: Subpage allocator couldn't get a page\n");
@@ -1189,7 +1210,7 @@ kmalloc(size_t sz)
 
 		/* Round up to a whole number of pages. */
 		npages = (sz + PAGE_SIZE - 1)/PAGE_SIZE;
-		address = alloc_kpages(npages);
+		address = kmalloc_getpages(npages);
 		if (address==0) {
 			return NULL;
 		}
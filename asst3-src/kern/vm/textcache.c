@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Shared text pages.
+ *
+ * Every process running the same program has the same read-only
+ * text, so rather than each reading in a copy of its own, load_elf
+ * gets those pages through here (via as_map_text) and every process
+ * gets the same physical page for the same page of the same file.
+ *
+ * Each mapping of a page holds a reference on it in the frame table;
+ * the cache itself holds none, and forgets the page when its last
+ * mapping goes away. Each cached page does hold a reference on its
+ * vnode, so the vnode can't be reclaimed (and its address reused as
+ * a key for some other file) while the page is around.
+ *
+ * Pages are looked up by file and offset when they are mapped, and
+ * by physical address when they are unmapped, so each page is on
+ * two hash chains.
+ *
+ * as_copy (for fork) takes more references to pages that are already
+ * mapped, with share_kpage, without going through here or taking
+ * tc_lock. That's safe because an address space is never copied and
+ * torn down at the same time: it's only destroyed when the last
+ * thread of its process is done with it, or by execv, which refuses
+ * to run while there are other threads; and only a thread of the
+ * same process can fork it. So while as_copy is running, each page it
+ * shares has at least one mapping that isn't going away, and
+ * textcache_put can't see the last reference drop.
+ *
+ * Nothing invalidates the cached pages if the file is written while
+ * it is running.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vm.h>
+
+struct tcpage {
+	struct vnode *tp_vnode;
+	off_t tp_offset;
+	paddr_t tp_paddr;
+	struct tcpage *tp_filenext;	/* chain in tc_byfile */
+	struct tcpage *tp_pagenext;	/* chain in tc_bypage */
+};
+
+#define TC_HASHSIZE 61
+
+/*
+ * The lock is held across reading a page in, so that two processes
+ * starting the same program don't both read it; this also means
+ * nobody can look up a page while its last reference is being
+ * dropped.
+ */
+static struct lock *tc_lock;
+static struct tcpage *tc_byfile[TC_HASHSIZE];
+static struct tcpage *tc_bypage[TC_HASHSIZE];
+
+static
+unsigned
+tc_filehash(struct vnode *v, off_t offset)
+{
+	return ((uintptr_t)v / sizeof(void *) + offset / PAGE_SIZE)
+		% TC_HASHSIZE;
+}
+
+static
+unsigned
+tc_pagehash(paddr_t paddr)
+{
+	return (paddr / PAGE_SIZE) % TC_HASHSIZE;
+}
+
+void
+textcache_bootstrap(void)
+{
+	unsigned i;
+
+	tc_lock = lock_create("textcache");
+	if (tc_lock == NULL) {
+		panic("textcache_bootstrap: Out of memory\n");
+	}
+	for (i=0; i<TC_HASHSIZE; i++) {
+		tc_byfile[i] = NULL;
+		tc_bypage[i] = NULL;
+	}
+}
+
+/*
+ * Read in a page of V at OFFSET and add it to the cache.
+ */
+static
+int
+tc_load(struct vnode *v, off_t offset, unsigned hash, paddr_t *ret)
+{
+	struct tcpage *tp;
+	struct iovec iov;
+	struct uio ku;
+	vaddr_t kva;
+	int result;
+
+	tp = kmalloc(sizeof(*tp));
+	if (tp == NULL) {
+		return ENOMEM;
+	}
+
+	kva = alloc_kpages(1);
+	if (kva == 0) {
+		kfree(tp);
+		return ENOMEM;
+	}
+
+	uio_kinit(&iov, &ku, (void *)kva, PAGE_SIZE, offset, UIO_READ);
+	result = VOP_READ(v, &ku);
+	if (result == 0 && ku.uio_resid != 0) {
+		/* the ELF headers said these bytes were there */
+		result = ENOEXEC;
+	}
+	if (result) {
+		free_kpages(kva);
+		kfree(tp);
+		return result;
+	}
+
+	VOP_INCREF(v);
+	tp->tp_vnode = v;
+	tp->tp_offset = offset;
+	tp->tp_paddr = KVADDR_TO_PADDR(kva);
+
+	tp->tp_filenext = tc_byfile[hash];
+	tc_byfile[hash] = tp;
+	hash = tc_pagehash(tp->tp_paddr);
+	tp->tp_pagenext = tc_bypage[hash];
+	tc_bypage[hash] = tp;
+
+	/* The allocation's reference is the caller's mapping. */
+	*ret = tp->tp_paddr;
+	return 0;
+}
+
+/*
+ * Get the physical page holding the page of V at OFFSET (which is
+ * page-aligned), reading it in if nobody has it mapped already. The
+ * caller gets a reference to the page, and should give it back with
+ * textcache_put when it unmaps it.
+ */
+int
+textcache_get(struct vnode *v, off_t offset, paddr_t *ret)
+{
+	struct tcpage *tp;
+	unsigned hash;
+	int result;
+
+	KASSERT(offset % PAGE_SIZE == 0);
+
+	hash = tc_filehash(v, offset);
+
+	lock_acquire(tc_lock);
+	for (tp = tc_byfile[hash]; tp != NULL; tp = tp->tp_filenext) {
+		if (tp->tp_vnode == v && tp->tp_offset == offset) {
+			share_kpage(PADDR_TO_KVADDR(tp->tp_paddr));
+			*ret = tp->tp_paddr;
+			lock_release(tc_lock);
+			return 0;
+		}
+	}
+	result = tc_load(v, offset, hash, ret);
+	lock_release(tc_lock);
+	return result;
+}
+
+/*
+ * Drop a reference to a page from textcache_get. The last one takes
+ * the page out of the cache and frees it.
+ */
+void
+textcache_put(paddr_t paddr)
+{
+	struct tcpage *tp, **tpp;
+	vaddr_t kva;
+
+	kva = PADDR_TO_KVADDR(paddr);
+
+	lock_acquire(tc_lock);
+
+	/*
+	 * New references are only taken under tc_lock, or by copying
+	 * an existing mapping that isn't being unmapped (see above);
+	 * so if ours is the only one, it stays that way.
+	 */
+	if (kpage_refcount(kva) > 1) {
+		free_kpages(kva);
+		lock_release(tc_lock);
+		return;
+	}
+
+	for (tpp = &tc_bypage[tc_pagehash(paddr)]; *tpp != NULL;
+	     tpp = &(*tpp)->tp_pagenext) {
+		if ((*tpp)->tp_paddr == paddr) {
+			break;
+		}
+	}
+	tp = *tpp;
+	KASSERT(tp != NULL);
+	*tpp = tp->tp_pagenext;
+
+	for (tpp = &tc_byfile[tc_filehash(tp->tp_vnode, tp->tp_offset)];
+	     *tpp != tp; tpp = &(*tpp)->tp_filenext) {
+		KASSERT(*tpp != NULL);
+	}
+	*tpp = tp->tp_filenext;
+
+	lock_release(tc_lock);
+
+	free_kpages(kva);
+	VOP_DECREF(tp->tp_vnode);
+	kfree(tp);
+}
@@ -7,7 +7,10 @@
 #include <machine/tlb.h>
 #include <current.h>
 #include <spl.h>
+#include <spinlock.h>
+#include <membar.h>
 #include <proc.h>
+#include <kstat.h>
 
 /* Place your page table functions here */
 paddr_t add_page(struct region *region);
@@ -19,44 +22,62 @@ void vm_bootstrap(void)
      * You may or may not need to add anything here depending what's
      * provided or required by the assignment spec.
      */
-    // initalise first level of 2 level page table to NULL
-    pagetable = kmalloc(1024 * sizeof(paddr_t *));
-    // set first entry to null
-    for (paddr_t i = 0; i < 1024; i++) {
-        //bzero(pagetable[i],1);
-        pagetable[i] = NULL;
-    }
+    // page tables are per address space (see as_create); the only
+    // global state is the shared text cache
+    textcache_bootstrap();
 }
 
-// function to allocate frame(s) to region
+// function to allocate a zeroed frame for a page of a region
 paddr_t add_page(struct region *region) {
+    (void)region;
     //frame allocation
-    vaddr_t alloc = alloc_kpages(region->npages);
+    vaddr_t alloc = alloc_kpages(1);
+    if (alloc == 0) {
+        return 0;
+    }
     // bzero - turn everything to zeros
-    bzero((void *)alloc, region->npages * PAGE_SIZE);   
+    bzero((void *)alloc, PAGE_SIZE);
     //convert to physical address
-    KVADDR_TO_PADDR(alloc);
-    return alloc;
+    return KVADDR_TO_PADDR(alloc);
 }
 
-paddr_t lookup_pt(vaddr_t faultaddress) {
+// look up the page table entry for an address; 0 if there isn't one
+paddr_t lookup_pt(struct addrspace *as, vaddr_t faultaddress) {
     // split up faultaddress
-    // can check if valid with if (pte && TLBLO_VALID) (w9 tutorial q10)
-    //vaddr_t offset = faultaddress & ~ TLBHI_VPAGE;
     vaddr_t page_num = (faultaddress >> 22);
     vaddr_t frame_num = (faultaddress << 10) >> 22;
 
-    if (pagetable[page_num] != 0) {
-        if (pagetable[page_num][frame_num] != 0) {
-            return pagetable[page_num][frame_num];
+    if (as->pagetable[page_num] != NULL) {
+        return as->pagetable[page_num][frame_num];
+    }
+    return 0;
+}
+
+// install a page table entry, making the second level table for it
+// if there isn't one yet; the new table is zeroed before it goes in,
+// so nobody looking at the page table ever sees garbage entries
+int insert_pt(struct addrspace *as, vaddr_t vaddr, paddr_t pte) {
+    vaddr_t page_num = (vaddr >> 22);
+    vaddr_t frame_num = (vaddr << 10) >> 22;
+
+    if (as->pagetable[page_num] == NULL) {
+        paddr_t *table = kmalloc(1024 * sizeof(paddr_t));
+        if (table == NULL) {
+            return ENOMEM;
         }
+        bzero(table, 1024 * sizeof(paddr_t));
+        membar_store_store();
+        as->pagetable[page_num] = table;
     }
+    as->pagetable[page_num][frame_num] = pte;
     return 0;
 }
 
 int
 vm_fault(int faulttype, vaddr_t faultaddress)
 {
+    counter_inc(&kstat_vmfaults);
+
     switch (faulttype) {
         // attempting to write to readonly memory - return EFAULT
 	    case VM_FAULT_READONLY:
@@ -73,55 +94,65 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		return EFAULT;
 	}	
 
-    // given the fault address - this is split up into page # and offset
-    paddr_t result = lookup_pt(faultaddress);
-    // if there is a valid translation in page table - load into tlb
-    if (result != 0) {
-        //int spl = splhigh();
-        // shift physical address
-        uint32_t entryhi = faultaddress & PAGE_FRAME;
-        uint32_t entrylo = (result & PAGE_FRAME) | TLBLO_DIRTY | TLBLO_VALID;
-        // load into tlb
-        tlb_random(entryhi, entrylo);
-        //splx(spl);
-        return 0;
-    }
-
-    // no translation in page table - is it a valid region?
     struct addrspace *as = NULL;
     as = proc_getas();
 	if (as == NULL) {
 		return EFAULT;
 	}
-    // traverse all regions to see if valid
-    struct region *region = NULL;
-    struct region_node *pointer = as->head;
-    while (pointer != NULL) {
-        if (faultaddress > pointer->region.base && faultaddress < (pointer->region.base + pointer->region.npages * PAGE_SIZE)) {
-            region = &pointer->region;
-            break;
+
+    faultaddress &= PAGE_FRAME;
+
+    // threads of a process share the page table, so two of them
+    // faulting on the same page mustn't both fill it in
+    spinlock_acquire(&as->as_lock);
+
+    // given the fault address - this is split up into page # and offset
+    paddr_t pte = lookup_pt(as, faultaddress);
+    if (pte == 0) {
+        // no translation in page table - is it a valid region?
+        struct region *region = NULL;
+        struct region_node *pointer = as->head;
+        while (pointer != NULL) {
+            if (faultaddress >= pointer->region.base && faultaddress < (pointer->region.base + pointer->region.npages * PAGE_SIZE)) {
+                region = &pointer->region;
+                break;
+            }
+            pointer = pointer->next;
         }
-        pointer = pointer->next;
-    }
-    if (region != NULL) {
-        int spl = splhigh();
-        // allocate frame and load into tlb
+        if (region == NULL) {
+            spinlock_release(&as->as_lock);
+            return EFAULT;
+        }
+        // allocate frame and install into page table
         paddr_t new_frame = add_page(region);
-        // install into tlb
-        uint32_t entryhi = faultaddress;
-        uint32_t entrylo = new_frame | TLBLO_DIRTY | TLBLO_VALID;
-        tlb_random(entryhi, entrylo);
-        //install into page table
-        vaddr_t page_num = (faultaddress >> 22);
-        vaddr_t frame_num = (faultaddress << 10) >> 22;
-        pagetable[page_num] = kmalloc(sizeof(paddr_t *));
-        pagetable[page_num][frame_num] = new_frame;
-        splx(spl);
-        return 0;
-    } else {
-        return EFAULT;
+        if (new_frame == 0) {
+            spinlock_release(&as->as_lock);
+            return ENOMEM;
+        }
+        pte = new_frame;
+        if (region->writeable) {
+            pte |= PTE_WRITABLE;
+        }
+        int result = insert_pt(as, faultaddress, pte);
+        if (result) {
+            free_kpages(PADDR_TO_KVADDR(new_frame));
+            spinlock_release(&as->as_lock);
+            return result;
+        }
     }
-    
+    spinlock_release(&as->as_lock);
+
+    // load the translation into the tlb; only writable pages are
+    // marked dirty, so writes to (shared) text fault as readonly
+    uint32_t entryhi = faultaddress;
+    uint32_t entrylo = (pte & PAGE_FRAME) | TLBLO_VALID;
+    if (pte & PTE_WRITABLE) {
+        entrylo |= TLBLO_DIRTY;
+    }
+    int spl = splhigh();
+    tlb_random(entryhi, entrylo);
+    splx(spl);
+    return 0;
 }
 
 /*
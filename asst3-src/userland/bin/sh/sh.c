@@ -421,11 +421,17 @@ docommand(char *buf, struct exitinfo *ei)
 		__time(&startsecs, &startnsecs);
 	}
 
-	pid = fork();
+	/*
+	 * The child only execs, so use vfork to avoid copying our
+	 * address space just to throw it away. (The child runs in our
+	 * memory until it execs, so it mustn't touch anything it
+	 * doesn't have to on the way.)
+	 */
+	pid = vfork();
 	switch (pid) {
 		case -1:
 			/* error */
-			warn("fork");
+			warn("vfork");
 			exitinfo_exit(ei, 255);
 			return;
 		case 0:
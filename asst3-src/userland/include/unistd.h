@@ -68,6 +68,7 @@
  *     remove:   stdio.h
  *     rename:   stdio.h
  *     time:     time.h
+ *     nanosleep: time.h
  *
  * Also note that the prototypes for open() and mkdir() contain, for
  * compatibility with Unix, an extra argument that is not meaningful
@@ -112,6 +113,7 @@
 __DEAD void _exit(int code);
 int execv(const char *prog, char *const *args);
 pid_t fork(void);
+pid_t vfork(void);
 pid_t waitpid(pid_t pid, int *returncode, int flags);
 /*
  * Open actually takes either two or three args: the optional third
@@ -147,7 +149,14 @@ ssize_t readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 int __time(time_t *seconds, unsigned long *nanoseconds);
+int nanosleep(const struct timespec *req, struct timespec *rem);
 ssize_t __getcwd(char *buf, size_t buflen);
+int getaffinity(unsigned *mask);
+int setaffinity(unsigned mask);
+int futex_wait(volatile int *addr, int val);
+int futex_wake(volatile int *addr, int n);
+int threadfork(void (*func)(void *), void *arg, void *stack);
+__DEAD void threadexit(void);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
@@ -74,7 +74,8 @@ system(const char *cmd)
 
 	argv[nargs] = NULL;
 
-	pid = fork();
+	/* the child only execs, so don't make it copy our memory */
+	pid = vfork();
 	switch (pid) {
 	    case -1:
 		return -1;
@@ -0,0 +1,386 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * schedtrace - turn a kernel scheduler trace into a timeline.
+ *
+ * Usage: host-schedtrace [-s] [logfile...]
+ *
+ * Reads console output from a kernel built with "options schedtrace"
+ * (e.g. a sys161 session log) in which the "schedtrace" menu command
+ * was run, picks out the trace lines, which look like
+ *
+ *    st <sec>.<nsec> <cpu> <event> <thread> <name> <arg> <other>
+ *
+ * and prints them as a timeline, in milliseconds from the first
+ * event, followed by per-thread and per-cpu summaries: time spent
+ * running, and run queue latency, which is the time from a thread
+ * being woken to it getting a cpu. With -s only the summaries are
+ * printed.
+ *
+ * This runs on the host, not on OS/161.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+
+#ifdef HOST
+#include "hostcompat.h"
+#endif
+
+#define MAXCPUS		32
+#define NAMELEN		16
+#define HASHSIZE	1024
+
+/* Thread states, as in the kernel's threadstate_t. */
+static const char *const statenames[] = {
+	"run", "ready", "sleep", "zombie",
+};
+#define NSTATES (sizeof(statenames) / sizeof(statenames[0]))
+
+struct tinfo {
+	struct tinfo *next;		/* Hash chain */
+	uint32_t id;
+	char name[NAMELEN];
+	unsigned runs;			/* Times switched to */
+	uint64_t runtime;		/* Total ns on a cpu */
+	unsigned migrations;
+	bool waking;			/* Woken, not yet run */
+	uint64_t woketime;
+	unsigned nlatency;		/* Wakeup-to-run samples */
+	uint64_t latency;		/* ...total */
+	uint64_t maxlatency;		/* ...worst */
+};
+
+struct cinfo {
+	bool seen;
+	uint32_t cur;			/* Thread on the cpu, 0 if unknown */
+	bool idle;
+	uint64_t since;			/* When cur/idle last changed */
+	uint64_t idletime;
+	unsigned switches;
+};
+
+static struct tinfo *threads[HASHSIZE];
+static unsigned nthreads;
+static struct cinfo cpus[MAXCPUS];
+static bool started;
+static uint64_t firsttime, lasttime;
+static bool summaryonly;
+
+static
+struct tinfo *
+lookupthread(uint32_t id)
+{
+	struct tinfo *ti;
+
+	for (ti = threads[(id >> 4) % HASHSIZE]; ti != NULL; ti = ti->next) {
+		if (ti->id == id) {
+			return ti;
+		}
+	}
+	return NULL;
+}
+
+static
+struct tinfo *
+findthread(uint32_t id, const char *name)
+{
+	struct tinfo *ti;
+	unsigned h;
+
+	ti = lookupthread(id);
+	if (ti != NULL) {
+		/* Thread structs get reused; keep the latest name. */
+		if (name != NULL) {
+			strncpy(ti->name, name, NAMELEN - 1);
+		}
+		return ti;
+	}
+	h = (id >> 4) % HASHSIZE;
+	ti = calloc(1, sizeof(*ti));
+	if (ti == NULL) {
+		err(1, "calloc");
+	}
+	ti->id = id;
+	strncpy(ti->name, name != NULL ? name : "?", NAMELEN - 1);
+	ti->next = threads[h];
+	threads[h] = ti;
+	nthreads++;
+	return ti;
+}
+
+static
+double
+ms(uint64_t ns)
+{
+	return ns / 1000000.0;
+}
+
+/*
+ * Charge the cpu's time since its last change to whatever it was
+ * doing.
+ */
+static
+void
+account(struct cinfo *ci, uint64_t now)
+{
+	if (ci->idle) {
+		ci->idletime += now - ci->since;
+	}
+	else if (ci->cur != 0) {
+		lookupthread(ci->cur)->runtime += now - ci->since;
+	}
+	ci->since = now;
+}
+
+static
+void
+event(uint64_t now, unsigned cpu, const char *ev, uint32_t id,
+      const char *name, unsigned arg, uint32_t other)
+{
+	struct cinfo *ci = &cpus[cpu];
+	struct tinfo *ti, *prev;
+	char prevname[NAMELEN];
+	uint64_t lat;
+
+	if (!ci->seen) {
+		ci->seen = true;
+		ci->since = now;
+	}
+
+	if (!strcmp(ev, "switch")) {
+		account(ci, now);
+		ti = findthread(id, name);
+		ti->runs++;
+		ci->switches++;
+		ci->cur = id;
+		if (ti->waking) {
+			lat = now - ti->woketime;
+			ti->waking = false;
+			ti->nlatency++;
+			ti->latency += lat;
+			if (lat > ti->maxlatency) {
+				ti->maxlatency = lat;
+			}
+		}
+		if (!summaryonly) {
+			prev = lookupthread(other);
+			if (prev != NULL) {
+				strcpy(prevname, prev->name);
+			}
+			else {
+				snprintf(prevname, sizeof(prevname), "%08x",
+					 (unsigned)other);
+			}
+			printf("%12.3f cpu%-2u %-14s -> %-14s (%s)\n",
+			       ms(now - firsttime), cpu, prevname, ti->name,
+			       arg < NSTATES ? statenames[arg] : "?");
+		}
+	}
+	else if (!strcmp(ev, "wakeup")) {
+		ti = findthread(id, name);
+		if (!ti->waking) {
+			ti->waking = true;
+			ti->woketime = now;
+		}
+		if (!summaryonly) {
+			printf("%12.3f cpu%-2u wakeup %s on cpu%u\n",
+			       ms(now - firsttime), cpu, ti->name, other);
+		}
+	}
+	else if (!strcmp(ev, "migrate")) {
+		ti = findthread(id, name);
+		ti->migrations++;
+		if (!summaryonly) {
+			printf("%12.3f cpu%-2u migrate %s cpu%u -> cpu%u\n",
+			       ms(now - firsttime), cpu, ti->name, arg, other);
+		}
+	}
+	else if (!strcmp(ev, "idle")) {
+		account(ci, now);
+		ci->idle = true;
+		if (!summaryonly) {
+			printf("%12.3f cpu%-2u idle\n", ms(now - firsttime), cpu);
+		}
+	}
+	else if (!strcmp(ev, "unidle")) {
+		account(ci, now);
+		ci->idle = false;
+		if (!summaryonly) {
+			printf("%12.3f cpu%-2u unidle\n", ms(now - firsttime),
+			       cpu);
+		}
+	}
+}
+
+/*
+ * Parse one line; ignore it if it isn't a trace line.
+ */
+static
+void
+doline(const char *line)
+{
+	unsigned long sec, nsec;
+	unsigned cpu, arg;
+	unsigned long id, other;
+	char ev[16], name[64];
+	uint64_t now;
+
+	if (sscanf(line, "st %lu.%lu %u %15s %lx %63s %u %lx",
+		   &sec, &nsec, &cpu, ev, &id, name, &arg, &other) != 8) {
+		return;
+	}
+	if (cpu >= MAXCPUS) {
+		warnx("cpu %u out of range", cpu);
+		return;
+	}
+	name[NAMELEN - 1] = 0;
+
+	now = sec * 1000000000ULL + nsec;
+	if (!started) {
+		started = true;
+		firsttime = now;
+	}
+	lasttime = now;
+	event(now, cpu, ev, id, name, arg, other);
+}
+
+static
+void
+dofile(FILE *f)
+{
+	char buf[256];
+
+	while (fgets(buf, sizeof(buf), f) != NULL) {
+		doline(buf);
+	}
+}
+
+static
+int
+byruntime(const void *a, const void *b)
+{
+	const struct tinfo *x = *(const struct tinfo *const *)a;
+	const struct tinfo *y = *(const struct tinfo *const *)b;
+
+	if (x->runtime != y->runtime) {
+		return x->runtime > y->runtime ? -1 : 1;
+	}
+	return x->id < y->id ? -1 : x->id > y->id;
+}
+
+static
+void
+summary(void)
+{
+	struct tinfo **all, *ti;
+	unsigned i, n;
+
+	if (!started) {
+		printf("No trace events found.\n");
+		return;
+	}
+
+	for (i=0; i<MAXCPUS; i++) {
+		if (cpus[i].seen) {
+			account(&cpus[i], lasttime);
+		}
+	}
+
+	all = malloc(nthreads * sizeof(*all));
+	if (all == NULL) {
+		err(1, "malloc");
+	}
+	n = 0;
+	for (i=0; i<HASHSIZE; i++) {
+		for (ti = threads[i]; ti != NULL; ti = ti->next) {
+			all[n++] = ti;
+		}
+	}
+	qsort(all, n, sizeof(*all), byruntime);
+
+	printf("\nTrace covers %.3f ms\n\n", ms(lasttime - firsttime));
+	printf("%-16s %8s %6s %10s %6s %10s %10s\n", "thread", "id",
+	       "runs", "run(ms)", "migr", "lat(ms)", "maxlat");
+	for (i=0; i<n; i++) {
+		ti = all[i];
+		printf("%-16s %08x %6u %10.3f %6u %10.3f %10.3f\n",
+		       ti->name, (unsigned)ti->id, ti->runs, ms(ti->runtime),
+		       ti->migrations,
+		       ti->nlatency ? ms(ti->latency / ti->nlatency) : 0.0,
+		       ms(ti->maxlatency));
+	}
+
+	printf("\n%-6s %10s %10s\n", "cpu", "switches", "idle(ms)");
+	for (i=0; i<MAXCPUS; i++) {
+		if (cpus[i].seen) {
+			printf("cpu%-3u %10u %10.3f\n", i, cpus[i].switches,
+			       ms(cpus[i].idletime));
+		}
+	}
+	free(all);
+}
+
+int
+main(int argc, char *argv[])
+{
+	FILE *f;
+	int i;
+
+#ifdef HOST
+	hostcompat_init(argc, argv);
+#endif
+
+	i = 1;
+	if (i < argc && !strcmp(argv[i], "-s")) {
+		summaryonly = true;
+		i++;
+	}
+
+	if (i == argc) {
+		dofile(stdin);
+	}
+	for (; i < argc; i++) {
+		f = fopen(argv[i], "r");
+		if (f == NULL) {
+			err(1, "%s", argv[i]);
+		}
+		dofile(f);
+		fclose(f);
+	}
+
+	summary();
+	return 0;
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * affinitytest - test setaffinity and getaffinity.
+ *
+ * Check that masks with no cpu that exists are rejected, that
+ * getaffinity returns whatever was last set, and that the mask
+ * survives the move to a cpu inside it.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+/*
+ * A mask that can't name any cpu: System/161 has at most 32, so this
+ * only fails to fail on a maximal configuration.
+ */
+#define BADMASK 0x80000000U
+
+/*
+ * Set MASK and check that getaffinity gives it back.
+ */
+static
+void
+setget(unsigned mask)
+{
+	unsigned got;
+
+	if (setaffinity(mask) < 0) {
+		err(1, "setaffinity 0x%x", mask);
+	}
+	if (getaffinity(&got) < 0) {
+		err(1, "getaffinity");
+	}
+	if (got != mask) {
+		errx(1, "FAILED: set mask 0x%x, got back 0x%x", mask, got);
+	}
+}
+
+int
+main(void)
+{
+	unsigned orig, got;
+
+	if (getaffinity(&orig) < 0) {
+		err(1, "getaffinity");
+	}
+	if (orig == 0) {
+		errx(1, "FAILED: initial mask is empty");
+	}
+
+	if (setaffinity(0) != -1 || errno != EINVAL) {
+		errx(1, "FAILED: setaffinity with an empty mask didn't "
+		     "fail with EINVAL");
+	}
+	if (setaffinity(BADMASK) != -1 || errno != EINVAL) {
+		errx(1, "FAILED: setaffinity with no existing cpu didn't "
+		     "fail with EINVAL");
+	}
+	if (getaffinity(&got) < 0) {
+		err(1, "getaffinity");
+	}
+	if (got != orig) {
+		errx(1, "FAILED: failed setaffinity changed the mask "
+		     "from 0x%x to 0x%x", orig, got);
+	}
+	if (getaffinity(NULL) != -1 || errno != EFAULT) {
+		errx(1, "FAILED: getaffinity(NULL) didn't fail with "
+		     "EFAULT");
+	}
+	printf("affinitytest: error cases ok\n");
+
+	/* cpu0 always exists; extra bits for missing cpus are kept. */
+	setget(1);
+	setget(1 | BADMASK);
+	setget(orig);
+	printf("affinitytest: passed\n");
+	return 0;
+}
@@ -0,0 +1,399 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * futextest - test threadfork, threadexit, futex_wait and futex_wake.
+ *
+ * Several threads of one process take turns incrementing a shared
+ * counter under a mutex built on a futex word, and the main thread
+ * waits for them to finish by sleeping on another futex word. Then
+ * the error cases, and what happens to the other threads when one of
+ * them calls _exit or the last one calls threadexit.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+#define NTHREADS   4
+#define NLOOPS     500
+#define STACKSIZE  8192
+
+/* Thread stacks; double for 8-byte alignment. */
+static double stacks[NTHREADS][STACKSIZE / sizeof(double)];
+
+static volatile int mutex;	/* 0 free, 1 held, 2 held with waiters */
+static volatile int counter;	/* protected by mutex */
+static volatile int running;	/* threads not yet finished */
+static volatile int ncontended;	/* times someone had to sleep */
+
+////////////////////////////////////////////////////////////
+// atomic operations (as in the kernel's <machine/atomic.h>)
+
+/*
+ * Compare-and-swap: if *p is OLD, make it NEW. Returns the value that
+ * was there.
+ */
+static
+int
+cas(volatile int *p, int old, int new)
+{
+	int x, y;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set volatile;"	/* avoid unwanted optimization */
+		".set reorder;"		/* let the assembler fill delay slots */
+		"1: ll %0, 0(%2);"	/*   x = *p */
+		"bne %0, %3, 2f;"	/*   if (x != old) goto out */
+		"move %1, %4;"		/*   y = new */
+		"sc %1, 0(%2);"		/*   *p = y; y = success? */
+		"beqz %1, 1b;"		/*   if (!y) start over */
+		"2: .set pop"		/* out: restore assembler mode */
+		: "=&r" (x), "=&r" (y)
+		: "r" (p), "r" (old), "r" (new)
+		: "memory");
+	return x;
+}
+
+/*
+ * Exchange: make *p NEW and return what was there.
+ */
+static
+int
+xchg(volatile int *p, int new)
+{
+	int x, y;
+
+	__asm volatile(
+		".set push;"
+		".set mips32;"
+		".set volatile;"
+		".set reorder;"
+		"1: ll %0, 0(%2);"	/*   x = *p */
+		"move %1, %3;"		/*   y = new */
+		"sc %1, 0(%2);"		/*   *p = y; y = success? */
+		"beqz %1, 1b;"		/*   if (!y) start over */
+		".set pop"
+		: "=&r" (x), "=&r" (y)
+		: "r" (p), "r" (new)
+		: "memory");
+	return x;
+}
+
+/*
+ * Add AMT to *p and return the new value.
+ */
+static
+int
+addfetch(volatile int *p, int amt)
+{
+	int x, y;
+
+	__asm volatile(
+		".set push;"
+		".set mips32;"
+		".set volatile;"
+		".set reorder;"
+		"1: ll %0, 0(%2);"	/*   x = *p */
+		"addu %1, %0, %3;"	/*   y = x + amt */
+		"sc %1, 0(%2);"		/*   *p = y; y = success? */
+		"beqz %1, 1b;"		/*   if (!y) start over */
+		".set pop"
+		: "=&r" (x), "=&r" (y)
+		: "r" (p), "r" (amt)
+		: "memory");
+	return x + amt;
+}
+
+////////////////////////////////////////////////////////////
+// futex mutex
+
+static
+void
+mutex_lock(void)
+{
+	int c;
+
+	c = cas(&mutex, 0, 1);
+	if (c == 0) {
+		/* uncontended; no system call */
+		return;
+	}
+	if (c != 2) {
+		c = xchg(&mutex, 2);
+	}
+	while (c != 0) {
+		addfetch(&ncontended, 1);
+		if (futex_wait(&mutex, 2) < 0 && errno != EAGAIN) {
+			err(1, "futex_wait");
+		}
+		c = xchg(&mutex, 2);
+	}
+}
+
+static
+void
+mutex_unlock(void)
+{
+	if (xchg(&mutex, 0) == 2) {
+		if (futex_wake(&mutex, 1) < 0) {
+			err(1, "futex_wake");
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// the threads
+
+static
+void
+worker(void *arg)
+{
+	volatile int spin;
+	int i, tmp;
+
+	(void)arg;
+
+	for (i=0; i<NLOOPS; i++) {
+		mutex_lock();
+		/* Widen the window a lost update would need. */
+		tmp = counter;
+		for (spin = 0; spin < 100; spin++) {
+			/* nothing */
+		}
+		counter = tmp + 1;
+		mutex_unlock();
+	}
+
+	if (addfetch(&running, -1) == 0) {
+		futex_wake(&running, 1);
+	}
+	threadexit();
+}
+
+static
+void
+spinner(void *arg)
+{
+	volatile int *flag = arg;
+
+	*flag = 1;
+	while (1) {
+		/* wait to be killed */
+	}
+}
+
+static
+void
+finisher(void *arg)
+{
+	int how = (int)arg;
+	volatile int spin;
+
+	for (spin = 0; spin < 100000; spin++) {
+		/* outlast the main thread */
+	}
+	if (how) {
+		_exit(how);
+	}
+	threadexit();
+}
+
+static
+void *
+stacktop(int i)
+{
+	return &stacks[i][STACKSIZE / sizeof(double)];
+}
+
+////////////////////////////////////////////////////////////
+// tests
+
+static
+void
+test_contention(void)
+{
+	int i, n;
+
+	printf("futextest: %d threads x %d increments\n", NTHREADS, NLOOPS);
+
+	running = NTHREADS;
+	for (i=0; i<NTHREADS; i++) {
+		if (threadfork(worker, NULL, stacktop(i)) < 0) {
+			err(1, "threadfork");
+		}
+	}
+
+	/* Wait for the last worker to finish. */
+	while ((n = running) != 0) {
+		if (futex_wait(&running, n) < 0 && errno != EAGAIN) {
+			err(1, "futex_wait on running");
+		}
+	}
+
+	if (counter != NTHREADS * NLOOPS) {
+		errx(1, "FAILED: counter is %d, expected %d",
+		     counter, NTHREADS * NLOOPS);
+	}
+	if (mutex != 0) {
+		errx(1, "FAILED: mutex left at %d", mutex);
+	}
+	printf("futextest: counter ok; slept on the mutex %d times\n",
+	       ncontended);
+}
+
+static
+void
+test_errors(void)
+{
+	volatile int word = 5;
+	char *misaligned;
+
+	if (futex_wait(&word, 6) != -1 || errno != EAGAIN) {
+		errx(1, "FAILED: futex_wait on a changed word didn't "
+		     "fail with EAGAIN");
+	}
+	misaligned = (char *)&word + 1;
+	if (futex_wait((volatile int *)misaligned, 5) != -1 ||
+	    errno != EINVAL) {
+		errx(1, "FAILED: misaligned futex_wait didn't fail with "
+		     "EINVAL");
+	}
+	if (futex_wake(&word, -1) != -1 || errno != EINVAL) {
+		errx(1, "FAILED: futex_wake with n < 0 didn't fail with "
+		     "EINVAL");
+	}
+	if (futex_wake(&word, 1) != 0) {
+		errx(1, "FAILED: futex_wake with no waiters didn't "
+		     "return 0");
+	}
+	if (threadfork(worker, NULL, (char *)stacktop(0) - 4) != -1 ||
+	    errno != EINVAL) {
+		errx(1, "FAILED: threadfork with a misaligned stack didn't "
+		     "fail with EINVAL");
+	}
+	printf("futextest: error cases ok\n");
+}
+
+/*
+ * Run FUNC in a child process and check it exits with STATUS.
+ */
+static
+void
+inchild(void (*func)(void), int status, const char *what)
+{
+	pid_t pid;
+	int ret;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		func();
+		_exit(99);
+	}
+	if (waitpid(pid, &ret, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(ret) || WEXITSTATUS(ret) != status) {
+		errx(1, "FAILED: %s: exit status 0x%x", what, ret);
+	}
+	printf("futextest: %s ok\n", what);
+}
+
+static
+void
+exitall(void)
+{
+	static volatile int started;
+	char *args[2];
+
+	if (threadfork(spinner, (void *)&started, stacktop(0)) < 0) {
+		err(1, "threadfork");
+	}
+	while (!started) {
+		/* make sure it's really running */
+	}
+
+	args[0] = (char *)"/testbin/add";
+	args[1] = NULL;
+	if (execv(args[0], args) != -1 || errno != EBUSY) {
+		_exit(98);
+	}
+
+	/* This must take the spinner with it. */
+	_exit(7);
+}
+
+/*
+ * The main thread leaves first; the process must live on until the
+ * other thread is done, and then exit with 0 if that leaves with
+ * threadexit, or with its status if it calls _exit.
+ */
+static
+void
+lastout(int how)
+{
+	if (threadfork(finisher, (void *)how, stacktop(0)) < 0) {
+		err(1, "threadfork");
+	}
+	threadexit();
+}
+
+static
+void
+lastout_threadexit(void)
+{
+	lastout(0);
+}
+
+static
+void
+lastout_exit(void)
+{
+	lastout(5);
+}
+
+int
+main(void)
+{
+	test_contention();
+	test_errors();
+	inchild(exitall, 7, "_exit with another thread running");
+	inchild(lastout_exit, 5, "_exit after the main thread left");
+	inchild(lastout_threadexit, 0, "threadexit by the last thread");
+	printf("futextest: passed\n");
+	return 0;
+}
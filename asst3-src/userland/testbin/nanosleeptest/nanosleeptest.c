@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * nanosleeptest - test nanosleep.
+ *
+ * Check that bad intervals are rejected, and that a sleep lasts at
+ * least as long as asked for, as measured with __time.
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+#define NSEC_PER_SEC 1000000000LL
+
+/*
+ * Current time in nanoseconds.
+ */
+static
+long long
+now(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	if (__time(&secs, &nsecs) < 0) {
+		err(1, "__time");
+	}
+	return secs * NSEC_PER_SEC + nsecs;
+}
+
+/*
+ * Check that nanosleep rejects SECS/NSECS with EINVAL.
+ */
+static
+void
+badinterval(time_t secs, long nsecs)
+{
+	struct timespec ts;
+
+	ts.tv_sec = secs;
+	ts.tv_nsec = nsecs;
+	if (nanosleep(&ts, NULL) != -1 || errno != EINVAL) {
+		errx(1, "FAILED: nanosleep of %lld s %ld ns didn't fail "
+		     "with EINVAL", (long long)secs, nsecs);
+	}
+}
+
+/*
+ * Sleep for SECS/NSECS and check it took at least that long.
+ */
+static
+void
+timedsleep(time_t secs, long nsecs)
+{
+	struct timespec ts;
+	long long start, want, took;
+
+	ts.tv_sec = secs;
+	ts.tv_nsec = nsecs;
+	want = secs * NSEC_PER_SEC + nsecs;
+
+	start = now();
+	if (nanosleep(&ts, NULL) < 0) {
+		err(1, "nanosleep of %lld s %ld ns", (long long)secs, nsecs);
+	}
+	took = now() - start;
+	if (took < want) {
+		errx(1, "FAILED: nanosleep of %lld ns returned after "
+		     "%lld ns", want, took);
+	}
+	printf("nanosleeptest: asked for %lld ns, slept %lld ns\n",
+	       want, took);
+}
+
+int
+main(void)
+{
+	badinterval(0, NSEC_PER_SEC);
+	badinterval(1, NSEC_PER_SEC + 1);
+	badinterval(0, -1);
+	badinterval(-1, 0);
+	if (nanosleep(NULL, NULL) != -1 || errno != EFAULT) {
+		errx(1, "FAILED: nanosleep(NULL) didn't fail with EFAULT");
+	}
+	printf("nanosleeptest: error cases ok\n");
+
+	timedsleep(0, 0);
+	timedsleep(0, 1);
+	timedsleep(0, 30000000);
+	timedsleep(1, 250000000);
+	printf("nanosleeptest: passed\n");
+	return 0;
+}
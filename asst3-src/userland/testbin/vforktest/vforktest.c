@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * vforktest - test vfork.
+ *
+ * The child of vfork runs in the parent's memory, so it can leave
+ * marks there for the parent to check: that the parent didn't run
+ * again until the child had exited or exec'd, that the child's stores
+ * are visible, and that a child whose execv fails can still _exit and
+ * release the parent. waitpid must then give the child's status as
+ * usual.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+/* Long enough for the parent to get a turn if it weren't blocked. */
+#define STALLLOOPS 200000
+
+static volatile int stage;	/* how far the child got */
+static volatile int childerr;	/* errno from the child's execv */
+
+/*
+ * Burn some time, giving up the cpu now and then.
+ */
+static
+void
+stall(void)
+{
+	volatile int i;
+
+	for (i=0; i<STALLLOOPS; i++) {
+		if (i % 1000 == 0) {
+			(void)getpid();
+		}
+	}
+}
+
+/*
+ * Wait for PID and check it exited with STATUS.
+ */
+static
+void
+checkstatus(pid_t pid, int status, const char *what)
+{
+	int ret;
+
+	if (waitpid(pid, &ret, 0) != pid) {
+		err(1, "%s: waitpid", what);
+	}
+	if (!WIFEXITED(ret) || WEXITSTATUS(ret) != status) {
+		errx(1, "FAILED: %s: exit status 0x%x, expected %d",
+		     what, ret, status);
+	}
+}
+
+/*
+ * The child marks its progress and exits; the parent should see
+ * only the final mark, and the exit status.
+ */
+static
+void
+test_exit(void)
+{
+	pid_t pid;
+
+	stage = 0;
+	pid = vfork();
+	if (pid < 0) {
+		err(1, "vfork");
+	}
+	if (pid == 0) {
+		stage = 1;
+		stall();
+		stage = 2;
+		_exit(3);
+	}
+	if (stage != 2) {
+		errx(1, "FAILED: parent ran before the child exited "
+		     "(stage %d)", stage);
+	}
+	checkstatus(pid, 3, "vfork and _exit");
+	printf("vforktest: _exit ok\n");
+}
+
+/*
+ * Same, but the child execs /bin/false, whose exit status 1 shows
+ * that the exec happened.
+ */
+static
+void
+test_execv(void)
+{
+	char *args[2];
+	pid_t pid;
+
+	args[0] = (char *)"false";
+	args[1] = NULL;
+
+	stage = 0;
+	pid = vfork();
+	if (pid < 0) {
+		err(1, "vfork");
+	}
+	if (pid == 0) {
+		stage = 1;
+		stall();
+		stage = 2;
+		execv("/bin/false", args);
+		_exit(99);
+	}
+	if (stage != 2) {
+		errx(1, "FAILED: parent ran before the child exec'd "
+		     "(stage %d)", stage);
+	}
+	checkstatus(pid, 1, "vfork and execv");
+	printf("vforktest: execv ok\n");
+}
+
+/*
+ * The child's execv fails; the parent must still get going again
+ * when the child exits, and see the error the child got.
+ */
+static
+void
+test_badexec(void)
+{
+	char *args[2];
+	pid_t pid;
+
+	args[0] = (char *)"nonexistent";
+	args[1] = NULL;
+
+	childerr = 0;
+	pid = vfork();
+	if (pid < 0) {
+		err(1, "vfork");
+	}
+	if (pid == 0) {
+		execv("/testbin/nonexistent", args);
+		childerr = errno;
+		_exit(4);
+	}
+	if (childerr != ENOENT) {
+		errx(1, "FAILED: child's execv of a missing file: "
+		     "errno %d, expected ENOENT", childerr);
+	}
+	checkstatus(pid, 4, "vfork with a failed execv");
+	printf("vforktest: failed execv ok\n");
+}
+
+int
+main(void)
+{
+	test_exit();
+	test_execv();
+	test_badexec();
+	printf("vforktest: passed\n");
+	return 0;
+}